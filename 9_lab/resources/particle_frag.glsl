@@ -1,10 +1,10 @@
 #version 120
 varying vec2 fragTex;
+varying vec4 fragColor;
 uniform sampler2D alphaTexture;
-uniform vec4 color;
 
 void main()
 {
 	float alpha = texture2D(alphaTexture, fragTex).r;
-	gl_FragColor = vec4(color.rgb, color.a*alpha);
+	gl_FragColor = vec4(fragColor.rgb, fragColor.a*alpha);
 }
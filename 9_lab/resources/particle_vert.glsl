@@ -1,18 +1,20 @@
 #version 120
 attribute vec4 vertPos;
 attribute vec2 vertTex;
+// Per particle
+attribute vec4 instPosRadius; // world position, and radius in w
+attribute vec4 instColor;
 uniform mat4 P;
 uniform mat4 MV;
-uniform float radius;
 varying vec2 fragTex;
+varying vec4 fragColor;
 
 void main()
 {
-	// Billboarding: set the upper 3x3 to be the identity matrix
-	mat4 MV0 = MV;
-	MV0[0] = vec4(1.0, 0.0, 0.0, 0.0);
-	MV0[1] = vec4(0.0, 1.0, 0.0, 0.0);
-	MV0[2] = vec4(0.0, 0.0, 1.0, 0.0);
-	gl_Position = P * MV0 * vec4(radius * vertPos.xy, 0.0, 1.0);
+	// Billboarding: the center goes through MV, but the quad around it is
+	// added in camera space, as if the upper 3x3 of MV were the identity
+	vec4 center = MV * vec4(instPosRadius.xyz, 1.0);
+	gl_Position = P * (center + vec4(instPosRadius.w * vertPos.xy, 0.0, 0.0));
 	fragTex = vertTex;
+	fragColor = instColor;
 }
@@ -0,0 +1,262 @@
+#include "BarnesHut.h"
+#include "ThreadPool.h"
+#include "Bodies.h"
+
+#include <cmath>
+#include <limits>
+#include <algorithm>
+
+using namespace std;
+using namespace Eigen;
+
+// Cells with this many bodies or fewer aren't split any further
+#define LEAF_SIZE 8
+// Stops splitting bodies that sit on top of each other
+#define MAX_DEPTH 32
+
+BarnesHut::BarnesHut() :
+	theta(0.5),
+	interactions(0)
+{
+}
+
+BarnesHut::~BarnesHut()
+{
+}
+
+// Adds m (3 d d^T - |d|^2 I) to a quadrupole
+static inline void addQuadrupole(double *q, double m, const Vector3d &d)
+{
+	double d2 = d.squaredNorm();
+	q[0] += m * (3.0 * d(0) * d(0) - d2);
+	q[1] += m * (3.0 * d(1) * d(1) - d2);
+	q[2] += m * (3.0 * d(2) * d(2) - d2);
+	q[3] += m * 3.0 * d(0) * d(1);
+	q[4] += m * 3.0 * d(0) * d(2);
+	q[5] += m * 3.0 * d(1) * d(2);
+}
+
+static inline int octant(const Vector3d &x, const Vector3d &center)
+{
+	return (x(0) > center(0) ? 1 : 0) | (x(1) > center(1) ? 2 : 0) | (x(2) > center(2) ? 4 : 0);
+}
+
+int BarnesHut::buildNode(int begin, int end, const Vector3d &center, double half, int depth)
+{
+	int idx = (int)nodes.size();
+	nodes.push_back(Node());
+
+	Vector3d com(0.0, 0.0, 0.0);
+	double mass = 0.0;
+	int children[8];
+	int num_children = 0;
+	bool leaf = (end - begin <= LEAF_SIZE || depth >= MAX_DEPTH);
+	if(leaf) {
+		for(int k = begin; k < end; ++k) {
+			com += sortedM[k] * sortedX[k];
+			mass += sortedM[k];
+		}
+	} else {
+		// Counting sort of the bodies into the 8 octants
+		int count[8] = {0};
+		for(int k = begin; k < end; ++k) {
+			count[octant(sortedX[k], center)]++;
+		}
+		int start[9];
+		start[0] = begin;
+		for(int c = 0; c < 8; ++c) {
+			start[c+1] = start[c] + count[c];
+		}
+		int next[8];
+		copy(start, start + 8, next);
+		for(int k = begin; k < end; ++k) {
+			scratch[next[octant(sortedX[k], center)]++] = k;
+		}
+		// scratch says where each body comes from, so permute all three arrays
+		for(int k = begin; k < end; ++k) {
+			scratchX[k] = sortedX[scratch[k]];
+			scratchM[k] = sortedM[scratch[k]];
+			scratchOrder[k] = order[scratch[k]];
+		}
+		copy(scratchX.begin() + begin, scratchX.begin() + end, sortedX.begin() + begin);
+		copy(scratchM.begin() + begin, scratchM.begin() + end, sortedM.begin() + begin);
+		copy(scratchOrder.begin() + begin, scratchOrder.begin() + end, order.begin() + begin);
+
+		double h = 0.5 * half;
+		for(int c = 0; c < 8; ++c) {
+			if(count[c] == 0) {
+				continue;
+			}
+			Vector3d cc = center + Vector3d(c & 1 ? h : -h, c & 2 ? h : -h, c & 4 ? h : -h);
+			int child = buildNode(start[c], start[c+1], cc, h, depth + 1);
+			com += nodes[child].mass * nodes[child].com;
+			mass += nodes[child].mass;
+			children[num_children++] = child;
+		}
+	}
+
+	Node &node = nodes[idx];
+	node.com = mass > 0.0 ? Vector3d(com / mass) : center;
+	node.mass = mass;
+	// Moments about our com, from the bodies or (shifted) from the children
+	fill(node.quad, node.quad + 6, 0.0);
+	if(leaf) {
+		for(int k = begin; k < end; ++k) {
+			addQuadrupole(node.quad, sortedM[k], sortedX[k] - node.com);
+		}
+	} else {
+		for(int c = 0; c < num_children; ++c) {
+			const Node &child = nodes[children[c]];
+			for(int j = 0; j < 6; ++j) {
+				node.quad[j] += child.quad[j];
+			}
+			addQuadrupole(node.quad, child.mass, child.com - node.com);
+		}
+	}
+	node.begin = begin;
+	node.end = end;
+	node.next = (int)nodes.size();
+	node.leaf = leaf;
+	// Open the cell when closer than s/theta to its center of mass. The
+	// offset of the com from the center is added on so that a body sitting
+	// inside a lopsided cell can't see it as far away.
+	if(theta > 0.0) {
+		double r = 2.0 * half / theta + (node.com - center).norm();
+		node.open2 = r * r;
+	} else {
+		node.open2 = numeric_limits<double>::max();
+	}
+	return idx;
+}
+
+void BarnesHut::build(const Bodies &b)
+{
+	int n = b.size();
+	order.resize(n);
+	sortedX.resize(n);
+	for(int i = 0; i < n; ++i) {
+		order[i] = i;
+		sortedX[i] = b.getPosition(i);
+	}
+	sortedM = b.m;
+	scratch.resize(n);
+	scratchX.resize(n);
+	scratchM.resize(n);
+	scratchOrder.resize(n);
+
+	// Root cell: the bounding cube of all the bodies
+	Vector3d xmin = sortedX[0];
+	Vector3d xmax = sortedX[0];
+	for(int i = 1; i < n; ++i) {
+		xmin = xmin.cwiseMin(sortedX[i]);
+		xmax = xmax.cwiseMax(sortedX[i]);
+	}
+	Vector3d center = 0.5 * (xmin + xmax);
+	double half = 0.5 * (xmax - xmin).maxCoeff();
+	half = half * (1.0 + 1e-9) + 1e-12;
+
+	// clear() keeps the memory from the last step
+	nodes.clear();
+	buildNode(0, n, center, half, 0);
+}
+
+Vector3d BarnesHut::accelerationAt(const Vector3d &xi, int self, double e2, long long &count) const
+{
+	Vector3d a(0.0, 0.0, 0.0);
+	int num_nodes = (int)nodes.size();
+	int i = 0;
+	while(i < num_nodes) {
+		const Node &node = nodes[i];
+		Vector3d d = node.com - xi;
+		double d2 = d.squaredNorm();
+		if(d2 > node.open2) {
+			// Far enough away to use the cell's moments. With r = xi - com,
+			// a = -M r/|r|^3 + Q r/|r|^5 - 5/2 (r.Q.r) r/|r|^7.
+			double inv = 1.0 / sqrt(d2 + e2);
+			double inv2 = inv * inv;
+			double inv3 = inv * inv2;
+			const double *q = node.quad;
+			Vector3d qr(q[0] * d(0) + q[3] * d(1) + q[4] * d(2),
+			            q[3] * d(0) + q[1] * d(1) + q[5] * d(2),
+			            q[4] * d(0) + q[5] * d(1) + q[2] * d(2));
+			double rqr = d.dot(qr);
+			// d = -r, so the terms odd in r flip sign
+			a += (node.mass * inv3 + 2.5 * rqr * inv3 * inv2 * inv2) * d - inv3 * inv2 * qr;
+			count++;
+			i = node.next;
+		} else if(node.leaf) {
+			for(int k = node.begin; k < node.end; ++k) {
+				if(k == self) {
+					continue;
+				}
+				Vector3d dk = sortedX[k] - xi;
+				double inv = 1.0 / sqrt(dk.squaredNorm() + e2);
+				a += sortedM[k] * inv * inv * inv * dk;
+			}
+			count += node.end - node.begin;
+			i = node.next;
+		} else {
+			i++;
+		}
+	}
+	return a;
+}
+
+void BarnesHut::accelerationRange(int begin, int end, double e2, double *ax, double *ay, double *az, long long &count) const
+{
+	// Walk the bodies in tree order, since neighbors open the same cells
+	long long local = 0;
+	for(int k = begin; k < end; ++k) {
+		Vector3d a = accelerationAt(sortedX[k], k, e2, local);
+		int i = order[k];
+		ax[i] = a(0);
+		ay[i] = a(1);
+		az[i] = a(2);
+	}
+	count += local;
+}
+
+void BarnesHut::computeAccelerations(const Bodies &b, double e2, double *ax, double *ay, double *az, ThreadPool *pool,
+                                     const vector<int> *active)
+{
+	int n = b.size();
+	interactions = 0;
+	if(n == 0 || (active && active->empty())) {
+		return;
+	}
+	build(b);
+	if(active) {
+		// Still walked in tree order
+		rank.resize(n);
+		for(int k = 0; k < n; ++k) {
+			rank[order[k]] = k;
+		}
+		activeSorted.clear();
+		for(int i : *active) {
+			activeSorted.push_back(rank[i]);
+		}
+		sort(activeSorted.begin(), activeSorted.end());
+	}
+	int num = active ? (int)activeSorted.size() : n;
+	auto walk = [&](int begin, int end, long long &count) {
+		if(!active) {
+			accelerationRange(begin, end, e2, ax, ay, az, count);
+			return;
+		}
+		for(int a = begin; a < end; ++a) {
+			accelerationRange(activeSorted[a], activeSorted[a] + 1, e2, ax, ay, az, count);
+		}
+	};
+	if(!pool) {
+		walk(0, num, interactions);
+		return;
+	}
+	// Bodies in dense regions open more cells, so hand out small chunks
+	vector<long long> counts(pool->getNumThreads(), 0);
+	pool->parallelForDynamic(num, 256, [&](int begin, int end, int thread) {
+		walk(begin, end, counts[thread]);
+	});
+	for(long long c : counts) {
+		interactions += c;
+	}
+}
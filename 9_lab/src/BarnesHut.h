@@ -0,0 +1,89 @@
+#pragma once
+#ifndef _BARNESHUT_H_
+#define _BARNESHUT_H_
+
+#include <vector>
+#include <algorithm>
+
+#define EIGEN_DONT_ALIGN_STATICALLY
+#include <Eigen/Dense>
+
+class ThreadPool;
+struct Bodies;
+
+// Barnes-Hut gravity: an octree over the bodies is rebuilt every step, and a
+// cell that looks small enough from where a body is sitting is treated as a
+// single mass at its center of mass. That makes a step O(n log n) instead of
+// O(n^2). Cells carry their quadrupole moment as well as their mass, which
+// for the same error lets far more of them be used without opening.
+//
+// The nodes live in one array that is reused from step to step, so after the
+// first step building the tree doesn't allocate.
+class BarnesHut
+{
+public:
+	BarnesHut();
+	virtual ~BarnesHut();
+
+	// Opening angle. A cell of size s at distance d is used without opening
+	// it when s/d < theta. 0 is exact (but slower than direct sum), 0.5 is the
+	// usual choice, 1 is fast and rough.
+	void setTheta(double theta) { this->theta = theta; }
+	double getTheta() const { return theta; }
+
+	// Sets a[i] to sum_j m_j (x_j - x_i) / (|x_j - x_i|^2 + e2)^(3/2), which
+	// is the acceleration of body i for G = 1, and writes it to ax[i], ay[i]
+	// and az[i]. The tree is built serially, and the force walk is split over
+	// the pool if there is one. With `active`, only those bodies get new
+	// accelerations (the tree still has all of them).
+	void computeAccelerations(const Bodies &b, double e2, double *ax, double *ay, double *az, ThreadPool *pool = 0,
+	                          const std::vector<int> *active = 0);
+
+	int getNumNodes() const { return (int)nodes.size(); }
+	// Body-body plus body-cell interactions in the last computeAccelerations()
+	long long getNumInteractions() const { return interactions; }
+
+private:
+	// Nodes are stored in depth-first order, so the first child of node i (if
+	// any) is i+1, and next is the node after i's subtree. That lets the force
+	// walk run without a stack.
+	struct Node
+	{
+		Node() : com(0.0, 0.0, 0.0), mass(0.0), open2(0.0), begin(0), end(0), next(-1), leaf(true)
+		{
+			std::fill(quad, quad + 6, 0.0);
+		}
+
+		Eigen::Vector3d com; // center of mass
+		double mass;
+		double quad[6];      // traceless quadrupole about com: xx yy zz xy xz yz
+		double open2;        // squared distance from com inside which we open the cell
+		int begin;           // bodies in [begin, end) of the sorted arrays
+		int end;
+		int next;
+		bool leaf;
+	};
+
+	void build(const Bodies &b);
+	int buildNode(int begin, int end, const Eigen::Vector3d &center, double half, int depth);
+	Eigen::Vector3d accelerationAt(const Eigen::Vector3d &xi, int self, double e2, long long &count) const;
+	void accelerationRange(int begin, int end, double e2, double *ax, double *ay, double *az, long long &count) const;
+
+	double theta;
+	std::vector<Node> nodes;
+	// The bodies sorted into tree order, so every node's bodies are contiguous
+	std::vector<int> order;
+	std::vector<Eigen::Vector3d> sortedX;
+	std::vector<double> sortedM;
+	// Where each body is in tree order, and the active bodies in tree order
+	std::vector<int> rank;
+	std::vector<int> activeSorted;
+	// Scratch space for splitting cells
+	std::vector<int> scratch;
+	std::vector<int> scratchOrder;
+	std::vector<Eigen::Vector3d> scratchX;
+	std::vector<double> scratchM;
+	long long interactions;
+};
+
+#endif
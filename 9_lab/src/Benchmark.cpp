@@ -0,0 +1,202 @@
+#include "Benchmark.h"
+#include "ThreadPool.h"
+#include "Timer.h"
+
+#include <cmath>
+#include <cstdio>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <thread>
+
+#include <unistd.h>
+
+using namespace std;
+
+// Resident memory now, from /proc, or 0 where there isn't one
+static double residentMB()
+{
+	FILE *f = fopen("/proc/self/statm", "r");
+	if(!f) {
+		return 0.0;
+	}
+	long pages = 0, resident = 0;
+	if(fscanf(f, "%ld %ld", &pages, &resident) != 2) {
+		resident = 0;
+	}
+	fclose(f);
+	return resident * (double)sysconf(_SC_PAGESIZE) / (1 << 20);
+}
+
+// Starts the process's high water mark of resident memory again from what
+// it is now (Linux 4.0 and later). False where that can't be done.
+static bool resetPeakResident()
+{
+	FILE *f = fopen("/proc/self/clear_refs", "w");
+	if(!f) {
+		return false;
+	}
+	bool ok = fputs("5", f) >= 0;
+	return fclose(f) == 0 && ok;
+}
+
+// Highest resident memory since the last reset, from /proc, or NaN where
+// there isn't one
+static double peakResidentMB()
+{
+	FILE *f = fopen("/proc/self/status", "r");
+	if(!f) {
+		return NAN;
+	}
+	double peak = NAN;
+	char line[256];
+	long kB;
+	while(fgets(line, sizeof(line), f)) {
+		if(sscanf(line, "VmHWM: %ld kB", &kB) == 1) {
+			peak = kB / 1024.0;
+			break;
+		}
+	}
+	fclose(f);
+	return peak;
+}
+
+static const char *solverKey(Solver solver)
+{
+	switch(solver) {
+		case SOLVER_BARNES_HUT: return "bh";
+		case SOLVER_FMM: return "fmm";
+		case SOLVER_PM: return "pm";
+		default: return "direct";
+	}
+}
+
+static const char *schemeKey(Integrator::Scheme scheme)
+{
+	switch(scheme) {
+		case Integrator::LEAPFROG: return "leapfrog";
+		case Integrator::BLOCK: return "block";
+		default: return "euler";
+	}
+}
+
+// A number, or null for NaN and infinity, which JSON doesn't have
+static string jsonNumber(double x)
+{
+	if(!isfinite(x)) {
+		return "null";
+	}
+	char buf[32];
+	snprintf(buf, sizeof(buf), "%.9g", x);
+	return buf;
+}
+
+Benchmark::Benchmark() :
+	models({MODEL_PLUMMER, MODEL_DISK, MODEL_COLLISION}),
+	sizes({1000, 10000, 100000}),
+	solvers({SOLVER_DIRECT, SOLVER_BARNES_HUT, SOLVER_FMM, SOLVER_PM}),
+	maxThreads(max(1u, thread::hardware_concurrency())),
+	steps(10),
+	scheme(Integrator::LEAPFROG),
+	maxDirect(100000)
+{
+}
+
+Benchmark::~Benchmark()
+{
+}
+
+void Benchmark::run()
+{
+	vector<int> threadCounts;
+	for(int T = 1; T < maxThreads; T *= 2) {
+		threadCounts.push_back(T);
+	}
+	threadCounts.push_back(maxThreads);
+
+	results.clear();
+	printf("model          n  solver        threads   steps/s  interactions/s   RSS MB  |dE/E|\n");
+	for(Model model : models) {
+		for(int n : sizes) {
+			double energy0 = NAN;
+			if(n <= Simulation::MAX_ENERGY_BODIES) {
+				Simulation initial;
+				initial.create(model, n, 1);
+				ThreadPool pool(maxThreads);
+				energy0 = initial.energy(&pool);
+			}
+			for(Solver solver : solvers) {
+				if(solver == SOLVER_DIRECT && n > maxDirect) {
+					continue;
+				}
+				for(int T : threadCounts) {
+					ThreadPool pool(T);
+					// So that the peak is this run's, not the biggest one so far
+					bool peakReset = resetPeakResident();
+					unique_ptr<Simulation> sim(new Simulation());
+					sim->create(model, n, 1);
+					sim->solver = solver;
+					sim->integrator.setScheme(scheme);
+					auto begin = chrono::steady_clock::now();
+					for(int k = 0; k < steps; ++k) {
+						sim->step(&pool);
+					}
+					BenchmarkResult r;
+					r.model = model;
+					r.n = n;
+					r.solver = solver;
+					r.threads = T;
+					r.steps = steps;
+					r.seconds = secondsSince(begin);
+					r.interactions = sim->interactions;
+					r.rssMB = residentMB();
+					r.peakRssMB = peakReset ? peakResidentMB() : NAN;
+					r.energy0 = r.energy1 = NAN;
+					if(T == 1 && !isnan(energy0)) {
+						r.energy0 = energy0;
+						r.energy1 = sim->energy(&pool);
+					}
+					results.push_back(r);
+					printf("%-9s %7d  %-13s %7d %9.3f %15.4g %8.0f  %.3g\n", modelName(model), n, sim->solverName(), T,
+					       steps / r.seconds, r.interactions / r.seconds, r.rssMB, fabs((r.energy1 - r.energy0) / r.energy0));
+					fflush(stdout);
+				}
+			}
+		}
+	}
+}
+
+bool Benchmark::writeJSON(const string &filename) const
+{
+	ofstream out(filename);
+	if(!out.good()) {
+		cerr << "Could not write " << filename << endl;
+		return false;
+	}
+	out << "{\n";
+	out << "  \"hardware_threads\": " << thread::hardware_concurrency() << ",\n";
+	out << "  \"avx2\": " << (haveAVX2() ? "true" : "false") << ",\n";
+	out << "  \"integrator\": \"" << schemeKey(scheme) << "\",\n";
+	out << "  \"steps\": " << steps << ",\n";
+	out << "  \"runs\": [\n";
+	for(size_t i = 0; i < results.size(); ++i) {
+		const BenchmarkResult &r = results[i];
+		double relative = fabs((r.energy1 - r.energy0) / r.energy0);
+		out << "    {\"model\": \"" << modelName(r.model) << "\""
+		    << ", \"n\": " << r.n
+		    << ", \"solver\": \"" << solverKey(r.solver) << "\""
+		    << ", \"threads\": " << r.threads
+		    << ", \"seconds\": " << jsonNumber(r.seconds)
+		    << ", \"steps_per_second\": " << jsonNumber(r.steps / r.seconds)
+		    << ", \"interactions_per_second\": " << (r.interactions > 0 ? jsonNumber(r.interactions / r.seconds) : "null")
+		    << ", \"rss_mb\": " << jsonNumber(r.rssMB)
+		    << ", \"run_peak_rss_mb\": " << jsonNumber(r.peakRssMB)
+		    << ", \"energy0\": " << jsonNumber(r.energy0)
+		    << ", \"energy1\": " << jsonNumber(r.energy1)
+		    << ", \"rel_energy_error\": " << jsonNumber(relative)
+		    << "}" << (i + 1 < results.size() ? "," : "") << "\n";
+	}
+	out << "  ]\n}\n";
+	return out.good();
+}
@@ -0,0 +1,67 @@
+#pragma once
+#ifndef _BENCHMARK_H_
+#define _BENCHMARK_H_
+
+#include <string>
+#include <vector>
+
+#include "Simulation.h"
+
+// One row of a benchmark: a model at one size, stepped with one solver on
+// some number of threads
+struct BenchmarkResult
+{
+	Model model;
+	int n;
+	Solver solver;
+	int threads;
+	int steps;
+	double seconds;
+	long long interactions; // 0 for the particle mesh, which doesn't count them
+	// Both for the whole process, so they include what the allocator kept
+	// from earlier runs
+	double rssMB;           // resident memory after the run
+	double peakRssMB;       // highest resident memory during the run, NaN if unknown
+	double energy0, energy1; // NaN unless measured (one thread, not too many bodies)
+};
+
+// The scaling benchmark: every model at every size, with every solver, on
+// 1, 2, 4, ... threads up to the maximum, each from the same initial
+// conditions for the same number of steps, written to a JSON file so that
+// later changes can be compared with it.
+//
+// Direct sum is skipped above maxDirect bodies (it would take hours). The
+// energy error is measured on one thread only, and only up to
+// Simulation::MAX_ENERGY_BODIES, since it is a direct sum itself.
+class Benchmark
+{
+public:
+	Benchmark();
+	virtual ~Benchmark();
+
+	void setModels(const std::vector<Model> &models) { this->models = models; }
+	void setSizes(const std::vector<int> &sizes) { this->sizes = sizes; }
+	void setSolvers(const std::vector<Solver> &solvers) { this->solvers = solvers; }
+	void setMaxThreads(int maxThreads) { this->maxThreads = maxThreads; }
+	void setSteps(int steps) { this->steps = steps; }
+	void setScheme(Integrator::Scheme scheme) { this->scheme = scheme; }
+	void setMaxDirect(int maxDirect) { this->maxDirect = maxDirect; }
+
+	// Runs everything, printing a line per run as it goes
+	void run();
+	const std::vector<BenchmarkResult> &getResults() const { return results; }
+
+	bool writeJSON(const std::string &filename) const;
+
+private:
+	std::vector<Model> models;
+	std::vector<int> sizes;
+	std::vector<Solver> solvers;
+	int maxThreads;
+	int steps;
+	Integrator::Scheme scheme;
+	int maxDirect;
+	std::vector<BenchmarkResult> results;
+};
+
+#endif
@@ -0,0 +1,35 @@
+#include "Bodies.h"
+
+using namespace std;
+using namespace Eigen;
+
+void Bodies::clear()
+{
+	m.clear();
+	x.clear(); y.clear(); z.clear();
+	vx.clear(); vy.clear(); vz.clear();
+	ax.clear(); ay.clear(); az.clear();
+	radius.clear();
+	color.clear();
+}
+
+void Bodies::reserve(int n)
+{
+	m.reserve(n);
+	x.reserve(n); y.reserve(n); z.reserve(n);
+	vx.reserve(n); vy.reserve(n); vz.reserve(n);
+	ax.reserve(n); ay.reserve(n); az.reserve(n);
+	radius.reserve(n);
+	color.reserve(n);
+}
+
+int Bodies::add(double mass, const Vector3d &pos, const Vector3d &vel, const Vector3f &col, float r)
+{
+	m.push_back(mass);
+	x.push_back(pos(0)); y.push_back(pos(1)); z.push_back(pos(2));
+	vx.push_back(vel(0)); vy.push_back(vel(1)); vz.push_back(vel(2));
+	ax.push_back(0.0); ay.push_back(0.0); az.push_back(0.0);
+	radius.push_back(r);
+	color.push_back(col);
+	return size() - 1;
+}
@@ -0,0 +1,36 @@
+#pragma once
+#ifndef _BODIES_H_
+#define _BODIES_H_
+
+#include <vector>
+
+#define EIGEN_DONT_ALIGN_STATICALLY
+#include <Eigen/Dense>
+
+// The simulation state, one array per component. The force loops only touch
+// the arrays they need and can load several bodies at once. Everything is
+// public since the solvers work on the arrays directly.
+struct Bodies
+{
+	int size() const { return (int)m.size(); }
+	void clear();
+	void reserve(int n);
+	// Appends a body and returns its index
+	int add(double mass, const Eigen::Vector3d &pos, const Eigen::Vector3d &vel, const Eigen::Vector3f &col, float r);
+
+	Eigen::Vector3d getPosition(int i) const { return Eigen::Vector3d(x[i], y[i], z[i]); }
+	Eigen::Vector3d getVelocity(int i) const { return Eigen::Vector3d(vx[i], vy[i], vz[i]); }
+	Eigen::Vector3d getAcceleration(int i) const { return Eigen::Vector3d(ax[i], ay[i], az[i]); }
+
+	// For physics
+	std::vector<double> m;
+	std::vector<double> x, y, z;
+	std::vector<double> vx, vy, vz;
+	std::vector<double> ax, ay, az; // from the last force calculation
+
+	// For display only
+	std::vector<float> radius;
+	std::vector<Eigen::Vector3f> color;
+};
+
+#endif
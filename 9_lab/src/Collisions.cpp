@@ -0,0 +1,327 @@
+#include "Collisions.h"
+#include "Bodies.h"
+#include "ThreadPool.h"
+#include "Timer.h"
+
+#include <cmath>
+#include <chrono>
+#include <algorithm>
+#include <functional>
+
+using namespace std;
+using namespace Eigen;
+
+// Keeps the entries with keep[i] set, in order
+template <typename T>
+static void compact(vector<T> &v, const vector<char> &keep)
+{
+	size_t k = 0;
+	for(size_t i = 0; i < v.size(); ++i) {
+		if(keep[i]) {
+			v[k++] = v[i];
+		}
+	}
+	v.resize(k);
+}
+
+// Root of i's group, halving the path on the way
+static int findRoot(vector<int> &parent, int i)
+{
+	while(parent[i] != i) {
+		parent[i] = parent[parent[i]];
+		i = parent[i];
+	}
+	return i;
+}
+
+Collisions::Collisions() :
+	scale(1.0),
+	cellSize(0.0),
+	buckets(0),
+	mask(0),
+	numPairs(0),
+	detectSeconds(0.0),
+	mergeSeconds(0.0)
+{
+}
+
+Collisions::~Collisions()
+{
+}
+
+uint32_t Collisions::blockOf(long long bx, long long by, long long bz) const
+{
+	uint64_t h = (uint64_t)bx * 73856093u ^ (uint64_t)by * 19349663u ^ (uint64_t)bz * 83492791u;
+	return (uint32_t)(h ^ (h >> 32)) & (mask >> 6);
+}
+
+uint32_t Collisions::bucketOf(long long cx, long long cy, long long cz) const
+{
+	return blockOf(cx >> 2, cy >> 2, cz >> 2) << 6 | (uint32_t)((cx & 3) | (cy & 3) << 2 | (cz & 3) << 4);
+}
+
+void Collisions::build(const Bodies &b, ThreadPool *pool)
+{
+	int n = b.size();
+	uint32_t size = 64;
+	while(size < 4 * (uint32_t)n) {
+		size *= 2;
+	}
+	if(size != buckets) {
+		buckets = size;
+		mask = buckets - 1;
+		counts.reset(new atomic<int>[buckets]);
+		bucketStart.resize(buckets + 1);
+		used.resize(buckets / 64 + 1);
+	}
+	int words = (int)used.size();
+	ThreadPool::forRange(pool, words, 0, [&](int begin, int end, int thread) {
+		for(int w = begin; w < end; ++w) {
+			used[w] = 0;
+			for(uint32_t k = 64 * w; k < min(64 * (uint32_t)(w + 1), buckets); ++k) {
+				counts[k].store(0, memory_order_relaxed);
+			}
+		}
+	});
+
+	bucket.resize(n);
+	ThreadPool::forRange(pool, n, 0, [&](int begin, int end, int thread) {
+		for(int i = begin; i < end; ++i) {
+			uint32_t k = bucketOf((long long)floor(b.x[i] / cellSize), (long long)floor(b.y[i] / cellSize),
+			                      (long long)floor(b.z[i] / cellSize));
+			bucket[i] = k;
+			counts[k].fetch_add(1, memory_order_relaxed);
+		}
+	});
+
+	// Where each bucket starts: every thread sums a range of buckets, then
+	// adds the sums of the ranges before its own
+	int T = pool ? pool->getNumThreads() : 1;
+	vector<int> rangeSum(T + 1, 0);
+	ThreadPool::forRange(pool, buckets, 0, [&](int begin, int end, int thread) {
+		int sum = 0;
+		for(int k = begin; k < end; ++k) {
+			sum += counts[k].load(memory_order_relaxed);
+		}
+		rangeSum[thread + 1] = sum;
+	});
+	for(int t = 0; t < T; ++t) {
+		rangeSum[t + 1] += rangeSum[t];
+	}
+	ThreadPool::forRange(pool, buckets, 0, [&](int begin, int end, int thread) {
+		int offset = rangeSum[thread];
+		for(int k = begin; k < end; ++k) {
+			int c = counts[k].load(memory_order_relaxed);
+			bucketStart[k] = offset;
+			// Now where the next body of the bucket goes
+			counts[k].store(offset, memory_order_relaxed);
+			offset += c;
+		}
+	});
+	bucketStart[buckets] = n;
+
+	// The order within a bucket depends on the threads' timing, but nothing
+	// that comes out of merge() does
+	sortedIndex.resize(n);
+	sortedX.resize(n);
+	sortedY.resize(n);
+	sortedZ.resize(n);
+	sortedR.resize(n);
+	ThreadPool::forRange(pool, n, 0, [&](int begin, int end, int thread) {
+		for(int i = begin; i < end; ++i) {
+			int s = counts[bucket[i]].fetch_add(1, memory_order_relaxed);
+			sortedIndex[s] = i;
+			sortedX[s] = b.x[i];
+			sortedY[s] = b.y[i];
+			sortedZ[s] = b.z[i];
+			sortedR[s] = b.radius[i];
+		}
+	});
+	ThreadPool::forRange(pool, words, 0, [&](int begin, int end, int thread) {
+		for(int w = begin; w < end; ++w) {
+			uint64_t bits = 0;
+			for(uint32_t k = 64 * w; k < min(64 * (uint32_t)(w + 1), buckets); ++k) {
+				if(bucketStart[k + 1] > bucketStart[k]) {
+					bits |= (uint64_t)1 << (k - 64 * w);
+				}
+			}
+			used[w] = bits;
+		}
+	});
+}
+
+void Collisions::findPairs(ThreadPool *pool)
+{
+	int n = (int)sortedIndex.size();
+	int T = pool ? pool->getNumThreads() : 1;
+	pairs.resize(T);
+	for(auto &p : pairs) {
+		p.clear();
+	}
+	double inverse = 1.0 / cellSize;
+	auto work = [&](int begin, int end, int thread) {
+		vector< pair<int, int> > &found = pairs[thread];
+		for(int s = begin; s < end; ++s) {
+			int i = sortedIndex[s];
+			double xi = sortedX[s], yi = sortedY[s], zi = sortedZ[s];
+			double ri = sortedR[s];
+			long long c[3] = {(long long)floor(xi * inverse), (long long)floor(yi * inverse), (long long)floor(zi * inverse)};
+			// The 3x3x3 cells around the body are in 1 to 8 blocks. For each
+			// of those, the cells wanted from it and the cells with bodies in
+			// it are two 64 bit masks.
+			for(long long bz = (c[2] - 1) >> 2; bz <= (c[2] + 1) >> 2; ++bz) {
+				int z0 = (int)(max(c[2] - 1, 4 * bz) - 4 * bz), z1 = (int)(min(c[2] + 1, 4 * bz + 3) - 4 * bz);
+				for(long long by = (c[1] - 1) >> 2; by <= (c[1] + 1) >> 2; ++by) {
+					int y0 = (int)(max(c[1] - 1, 4 * by) - 4 * by), y1 = (int)(min(c[1] + 1, 4 * by + 3) - 4 * by);
+					for(long long bx = (c[0] - 1) >> 2; bx <= (c[0] + 1) >> 2; ++bx) {
+						int x0 = (int)(max(c[0] - 1, 4 * bx) - 4 * bx), x1 = (int)(min(c[0] + 1, 4 * bx + 3) - 4 * bx);
+						uint32_t block = blockOf(bx, by, bz);
+						uint64_t bits = used[block];
+						if(!bits) {
+							continue;
+						}
+						uint64_t row = ((1u << (x1 - x0 + 1)) - 1) << x0;
+						uint64_t want = 0;
+						for(int z = z0; z <= z1; ++z) {
+							for(int y = y0; y <= y1; ++y) {
+								want |= row << (z * 16 + y * 4);
+							}
+						}
+						bits &= want;
+						while(bits) {
+							uint32_t k = block << 6 | (uint32_t)__builtin_ctzll(bits);
+							bits &= bits - 1;
+							for(int t = bucketStart[k]; t < bucketStart[k+1]; ++t) {
+								int j = sortedIndex[t];
+								if(j <= i) {
+									continue;
+								}
+								double dx = sortedX[t] - xi, dy = sortedY[t] - yi, dz = sortedZ[t] - zi;
+								double contact = scale * (ri + sortedR[t]);
+								if(dx * dx + dy * dy + dz * dz < contact * contact) {
+									found.push_back(make_pair(i, j));
+								}
+							}
+						}
+					}
+				}
+			}
+		}
+	};
+	ThreadPool::forRange(pool, n, 1024, work);
+	// Two of the blocks can share a slot of the table, and then a pair can
+	// be found twice
+	touching.clear();
+	for(auto &p : pairs) {
+		touching.insert(touching.end(), p.begin(), p.end());
+	}
+	sort(touching.begin(), touching.end());
+	touching.erase(unique(touching.begin(), touching.end()), touching.end());
+	numPairs = (int)touching.size();
+}
+
+int Collisions::mergeGroups(Bodies &b, ThreadPool *pool)
+{
+	int n = b.size();
+	// Each group's root is its first body
+	vector<int> parent(n);
+	for(int i = 0; i < n; ++i) {
+		parent[i] = i;
+	}
+	vector<int> touched;
+	for(auto &ij : touching) {
+		int ri = findRoot(parent, ij.first), rj = findRoot(parent, ij.second);
+		if(ri != rj) {
+			parent[max(ri, rj)] = min(ri, rj);
+		}
+		touched.push_back(ij.first);
+		touched.push_back(ij.second);
+	}
+	// Members of each group together, in index order
+	vector< pair<int, int> > members;
+	for(int i : touched) {
+		members.push_back(make_pair(findRoot(parent, i), i));
+	}
+	sort(members.begin(), members.end());
+	members.erase(unique(members.begin(), members.end()), members.end());
+
+	vector<char> keep(n, 1);
+	int merged = 0;
+	for(size_t g = 0; g < members.size();) {
+		int root = members[g].first;
+		double mass = 0.0, volume = 0.0;
+		Vector3d x(0.0, 0.0, 0.0), p(0.0, 0.0, 0.0), f(0.0, 0.0, 0.0);
+		Vector3d color(0.0, 0.0, 0.0);
+		size_t end = g;
+		for(; end < members.size() && members[end].first == root; ++end) {
+			int i = members[end].second;
+			double m = b.m[i];
+			mass += m;
+			x += m * b.getPosition(i);
+			p += m * b.getVelocity(i);
+			f += m * b.getAcceleration(i);
+			color += m * b.color[i].cast<double>();
+			volume += (double)b.radius[i] * b.radius[i] * b.radius[i];
+			if(i != root) {
+				keep[i] = 0;
+				merged++;
+			}
+		}
+		if(mass > 0.0) {
+			x /= mass;
+			p /= mass;
+			f /= mass;
+			color /= mass;
+		}
+		b.m[root] = mass;
+		b.x[root] = x(0); b.y[root] = x(1); b.z[root] = x(2);
+		b.vx[root] = p(0); b.vy[root] = p(1); b.vz[root] = p(2);
+		b.ax[root] = f(0); b.ay[root] = f(1); b.az[root] = f(2);
+		b.radius[root] = (float)cbrt(volume);
+		b.color[root] = color.cast<float>();
+		g = end;
+	}
+
+	// Every array on its own, so they can go on different threads
+	vector< function<void()> > arrays = {
+		[&]() { compact(b.m, keep); },
+		[&]() { compact(b.x, keep); }, [&]() { compact(b.y, keep); }, [&]() { compact(b.z, keep); },
+		[&]() { compact(b.vx, keep); }, [&]() { compact(b.vy, keep); }, [&]() { compact(b.vz, keep); },
+		[&]() { compact(b.ax, keep); }, [&]() { compact(b.ay, keep); }, [&]() { compact(b.az, keep); },
+		[&]() { compact(b.radius, keep); }, [&]() { compact(b.color, keep); }
+	};
+	auto work = [&](int begin, int end, int thread) {
+		for(int a = begin; a < end; ++a) {
+			arrays[a]();
+		}
+	};
+	ThreadPool::forRange(pool, (int)arrays.size(), 1, work);
+	return merged;
+}
+
+int Collisions::merge(Bodies &b, ThreadPool *pool)
+{
+	numPairs = 0;
+	detectSeconds = 0.0;
+	mergeSeconds = 0.0;
+	int n = b.size();
+	if(n < 2 || scale <= 0.0) {
+		return 0;
+	}
+	auto start = chrono::steady_clock::now();
+	float maxRadius = *max_element(b.radius.begin(), b.radius.end());
+	cellSize = 2.0 * scale * maxRadius;
+	if(!(cellSize > 0.0)) {
+		return 0;
+	}
+	build(b, pool);
+	findPairs(pool);
+	detectSeconds = secondsSince(start);
+	if(numPairs == 0) {
+		return 0;
+	}
+	start = chrono::steady_clock::now();
+	int merged = mergeGroups(b, pool);
+	mergeSeconds = secondsSince(start);
+	return merged;
+}
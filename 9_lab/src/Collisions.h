@@ -0,0 +1,88 @@
+#pragma once
+#ifndef _COLLISIONS_H_
+#define _COLLISIONS_H_
+
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <cstdint>
+
+class ThreadPool;
+struct Bodies;
+
+// Finds bodies that touch, |x_i - x_j| < scale * (r_i + r_j), and merges
+// each touching group into one body.
+//
+// The bodies are put in a uniform grid of cells as wide as the largest
+// contact distance, so every touching pair is in the same or neighbouring
+// cells. The cells are hashed into a table of 4-8 buckets per body, so
+// empty space costs nothing however spread out the bodies are. The table is
+// rebuilt every call, on the pool: the bodies are counted per bucket, the
+// counts summed up into where each bucket starts, and the bodies scattered
+// there, with their positions copied along so a bucket is contiguous.
+//
+// Then each body checks the buckets of its 27 cells. Cells are usually much
+// smaller than the distance between bodies, so most of those are empty. The
+// cells are hashed in blocks of 4x4x4 whose buckets are consecutive, and a
+// bit per bucket says whether it has bodies, so the cells around a body are
+// looked up a block (one 64 bit word) at a time and only the ones with
+// bodies are visited. O(n) for bodies that are spread out.
+//
+// Touching pairs are joined into groups (a touches b touches c), and each
+// group becomes its first body: the masses add up, the position is the
+// center of mass and the velocity the total momentum over the total mass,
+// so mass and momentum are conserved; the radius keeps the total volume
+// and the color is mass weighted. The merged-away bodies are then removed
+// from every array, keeping the others in order.
+class Collisions
+{
+public:
+	Collisions();
+	virtual ~Collisions();
+
+	// Bodies touch when closer than scale times the sum of their radii
+	void setScale(double scale) { this->scale = scale; }
+	double getScale() const { return scale; }
+
+	// Merges what touches. Returns how many bodies were merged away, so the
+	// bodies are that many fewer.
+	int merge(Bodies &b, ThreadPool *pool = 0);
+
+	// From the last merge(): time spent building the table and finding the
+	// pairs, and merging and compacting
+	double getDetectSeconds() const { return detectSeconds; }
+	double getMergeSeconds() const { return mergeSeconds; }
+	int getNumPairs() const { return numPairs; }
+
+private:
+	void build(const Bodies &b, ThreadPool *pool);
+	void findPairs(ThreadPool *pool);
+	int mergeGroups(Bodies &b, ThreadPool *pool);
+	// Table slot of a block of 4x4x4 cells; its cells are the 64 buckets
+	// from slot * 64 on, so the cells around a body are in a few runs of the
+	// table and their bits in a few words of `used`
+	uint32_t blockOf(long long bx, long long by, long long bz) const;
+	uint32_t bucketOf(long long cx, long long cy, long long cz) const;
+
+	double scale;
+	double cellSize;
+	uint32_t buckets; // a power of two
+	uint32_t mask;    // buckets - 1
+
+	std::vector<uint32_t> bucket;     // of each body
+	std::vector<int> bucketStart;     // buckets + 1
+	std::vector<uint64_t> used;       // a bit per bucket, set if it has bodies
+	std::unique_ptr< std::atomic<int>[] > counts; // per bucket while building
+	// The bodies in bucket order, with their positions and radii
+	std::vector<int> sortedIndex;
+	std::vector<double> sortedX, sortedY, sortedZ;
+	std::vector<float> sortedR;
+	std::vector< std::vector<std::pair<int, int> > > pairs; // per thread, i < j
+	std::vector< std::pair<int, int> > touching; // all of them, sorted
+
+	int numPairs;
+	double detectSeconds;
+	double mergeSeconds;
+};
+
+#endif
@@ -0,0 +1,157 @@
+#include "DepthSorter.h"
+#include "Bodies.h"
+#include "ThreadPool.h"
+
+#include <cstring>
+#include <functional>
+
+using namespace std;
+using namespace Eigen;
+
+// 11 bits per pass: three passes for 32 bit keys, with counts that still
+// fit in L1
+static const int RADIX_BITS = 11;
+static const int RADIX = 1 << RADIX_BITS;
+
+// Flips the float's bits so that the unsigned ints sort like the floats:
+// negatives reversed and below the positives
+static uint32_t floatKey(float f)
+{
+	uint32_t u;
+	memcpy(&u, &f, sizeof(u));
+	return (u & 0x80000000u) ? ~u : (u | 0x80000000u);
+}
+
+DepthSorter::DepthSorter() :
+	coherence(0.05f),
+	lastV(Matrix4f::Zero()),
+	incremental(false),
+	skip(0)
+{
+}
+
+DepthSorter::~DepthSorter()
+{
+}
+
+void DepthSorter::computeKeys(const Bodies &b, const Matrix4f &V, ThreadPool *pool)
+{
+	int n = b.size();
+	keys.resize(n);
+	float r0 = V(2, 0), r1 = V(2, 1), r2 = V(2, 2), r3 = V(2, 3);
+	ThreadPool::forRange(pool, n, 0, [&](int begin, int end, int thread) {
+		for(int i = begin; i < end; ++i) {
+			float z = r0 * (float)b.x[i] + r1 * (float)b.y[i] + r2 * (float)b.z[i] + r3;
+			keys[i] = floatKey(z);
+		}
+	});
+}
+
+bool DepthSorter::insertionSort()
+{
+	size_t n = order.size();
+	// Gives up after this many moves, when a radix sort would be cheaper
+	size_t budget = 4 * n;
+	size_t moves = 0;
+	for(size_t k = 1; k < n; ++k) {
+		size_t i = order[k];
+		uint32_t key = keys[i];
+		size_t j = k;
+		while(j > 0 && keys[order[j-1]] > key) {
+			order[j] = order[j-1];
+			--j;
+		}
+		order[j] = i;
+		moves += k - j;
+		if(moves > budget) {
+			return false;
+		}
+	}
+	return true;
+}
+
+void DepthSorter::radixSort(ThreadPool *pool)
+{
+	int n = (int)keys.size();
+	int T = pool ? pool->getNumThreads() : 1;
+	for(int s = 0; s < 2; ++s) {
+		sortKeys[s].resize(n);
+		sortIndices[s].resize(n);
+	}
+	counts.resize(RADIX * T);
+	ThreadPool::forRange(pool, n, 0, [&](int begin, int end, int thread) {
+		for(int i = begin; i < end; ++i) {
+			sortKeys[0][i] = keys[i];
+			sortIndices[0][i] = (uint32_t)i;
+		}
+	});
+	// The digits that differ somewhere; the others needn't be sorted on
+	uint32_t first = keys.empty() ? 0 : keys[0];
+	uint32_t differ = 0;
+	for(int i = 1; i < n; ++i) {
+		differ |= keys[i] ^ first;
+	}
+	int src = 0;
+	for(int shift = 0; shift < 32; shift += RADIX_BITS) {
+		if(((differ >> shift) & (RADIX - 1)) == 0) {
+			continue;
+		}
+		const uint32_t *inKeys = &sortKeys[src][0];
+		const uint32_t *inIndices = &sortIndices[src][0];
+		uint32_t *outKeys = &sortKeys[1 - src][0];
+		uint32_t *outIndices = &sortIndices[1 - src][0];
+		fill(counts.begin(), counts.end(), 0);
+		ThreadPool::forRange(pool, n, 0, [&](int begin, int end, int thread) {
+			int *c = &counts[RADIX * thread];
+			for(int i = begin; i < end; ++i) {
+				c[(inKeys[i] >> shift) & (RADIX - 1)]++;
+			}
+		});
+		// Thread t's digit d goes after all smaller digits, and after the
+		// d's of threads before t
+		int offset = 0;
+		for(int d = 0; d < RADIX; ++d) {
+			for(int t = 0; t < T; ++t) {
+				int c = counts[RADIX * t + d];
+				counts[RADIX * t + d] = offset;
+				offset += c;
+			}
+		}
+		ThreadPool::forRange(pool, n, 0, [&](int begin, int end, int thread) {
+			int *next = &counts[RADIX * thread];
+			for(int i = begin; i < end; ++i) {
+				int dst = next[(inKeys[i] >> shift) & (RADIX - 1)]++;
+				outKeys[dst] = inKeys[i];
+				outIndices[dst] = inIndices[i];
+			}
+		});
+		src = 1 - src;
+	}
+	order.resize(n);
+	ThreadPool::forRange(pool, n, 0, [&](int begin, int end, int thread) {
+		for(int i = begin; i < end; ++i) {
+			order[i] = sortIndices[src][i];
+		}
+	});
+}
+
+const vector<size_t> &DepthSorter::sort(const Bodies &b, const Matrix4f &V, ThreadPool *pool)
+{
+	computeKeys(b, V, pool);
+	bool close = (V - lastV).cwiseAbs().maxCoeff() < coherence;
+	lastV = V;
+	incremental = false;
+	if(close && order.size() == keys.size()) {
+		if(skip > 0) {
+			--skip;
+		} else {
+			incremental = insertionSort();
+			// Don't pay for another try for a few frames
+			skip = incremental ? 0 : 8;
+		}
+	}
+	if(!incremental) {
+		radixSort(pool);
+	}
+	return order;
+}
@@ -0,0 +1,65 @@
+#pragma once
+#ifndef _DEPTHSORTER_H_
+#define _DEPTHSORTER_H_
+
+#include <vector>
+#include <cstdint>
+
+#define EIGEN_DONT_ALIGN_STATICALLY
+#include <Eigen/Dense>
+
+class ThreadPool;
+struct Bodies;
+
+// Orders the bodies back to front (by increasing camera space z) for
+// drawing transparent particles.
+//
+// Each body's depth is computed once per frame into a key buffer, as the
+// bits of the float turned into an unsigned int that sorts the same way.
+// The keys are sorted with an LSD radix sort, 11 bits per pass, each pass
+// split over the pool: every thread counts the digits in its chunk, and
+// then scatters its chunk to the offsets the counts give it, so the sort
+// stays stable. Passes where all the keys share the digit are skipped.
+//
+// Between frames the order barely changes when the camera and the bodies
+// barely move, so if the view matrix is close to last frame's, the
+// previous order is fixed up with an insertion sort instead. That is
+// O(n + moves); if the moves add up to more than a few per body it gives
+// up and radix sorts, and doesn't try again for the next few frames.
+class DepthSorter
+{
+public:
+	DepthSorter();
+	virtual ~DepthSorter();
+
+	// The last order is reused while every entry of the view matrix has
+	// changed by less than this. 0 always radix sorts.
+	void setCoherence(float coherence) { this->coherence = coherence; }
+	float getCoherence() const { return coherence; }
+
+	// Returns the indices of the bodies, farthest first, for the view V
+	const std::vector<size_t> &sort(const Bodies &b, const Eigen::Matrix4f &V, ThreadPool *pool = 0);
+	const std::vector<size_t> &getOrder() const { return order; }
+
+	// Whether the last sort() took the insertion sort path
+	bool wasIncremental() const { return incremental; }
+
+private:
+	void computeKeys(const Bodies &b, const Eigen::Matrix4f &V, ThreadPool *pool);
+	bool insertionSort();
+	void radixSort(ThreadPool *pool);
+
+	float coherence;
+	Eigen::Matrix4f lastV;
+	bool incremental;
+	int skip; // frames before the insertion sort is tried again
+
+	std::vector<uint32_t> keys; // by body
+	std::vector<size_t> order;
+	// Radix sort buffers, keys and indices in sorted order
+	std::vector<uint32_t> sortKeys[2];
+	std::vector<uint32_t> sortIndices[2];
+	std::vector<int> counts; // one per digit per thread
+};
+
+#endif
@@ -0,0 +1,348 @@
+#include "Ensemble.h"
+#include "ThreadPool.h"
+#include "Timer.h"
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <cmath>
+#include <chrono>
+#include <memory>
+#include <algorithm>
+#include <functional>
+
+using namespace std;
+using namespace Eigen;
+
+static Vector3d totalMomentum(const Bodies &b)
+{
+	Vector3d p(0.0, 0.0, 0.0);
+	for(int i = 0; i < b.size(); ++i) {
+		p += b.m[i] * b.getVelocity(i);
+	}
+	return p;
+}
+
+EnsembleRun::EnsembleRun() :
+	uniform(0),
+	seed(0),
+	steps(-1),
+	h(NAN),
+	e2(NAN),
+	solver(SOLVER_DIRECT),
+	scheme(Integrator::EULER),
+	haveSolver(false),
+	haveScheme(false),
+	theta(0.5),
+	order(4),
+	grid(64),
+	levels(6),
+	eta(0.02),
+	n(0),
+	t(0.0),
+	seconds(0.0),
+	energy0(NAN),
+	energy1(NAN),
+	momentum(NAN),
+	forces(0)
+{
+}
+
+Ensemble::Ensemble() :
+	defaultSteps(100),
+	poolStepCost(1e7),
+	seconds(0.0)
+{
+}
+
+Ensemble::~Ensemble()
+{
+}
+
+bool Ensemble::parseLine(const string &line, EnsembleRun &r, string &error) const
+{
+	istringstream words(line);
+	string word;
+	while(words >> word) {
+		size_t eq = word.find('=');
+		if(eq == string::npos || eq == 0 || eq + 1 == word.size()) {
+			error = "expected key=value, got " + word;
+			return false;
+		}
+		string key = word.substr(0, eq);
+		string value = word.substr(eq + 1);
+		bool ok = true;
+		try {
+			if(key == "name") {
+				r.name = value;
+			} else if(key == "input") {
+				r.input = value;
+			} else if(key == "uniform") {
+				r.uniform = stoi(value);
+			} else if(key == "seed") {
+				r.seed = (unsigned)stoul(value);
+			} else if(key == "steps") {
+				r.steps = stoi(value);
+			} else if(key == "h") {
+				r.h = stod(value);
+				ok = r.h > 0.0;
+			} else if(key == "e2") {
+				r.e2 = stod(value);
+				ok = r.e2 >= 0.0;
+			} else if(key == "solver") {
+				ok = r.haveSolver = parseSolver(value, r.solver);
+			} else if(key == "integrator") {
+				ok = r.haveScheme = parseScheme(value, r.scheme);
+			} else if(key == "theta") {
+				r.theta = stod(value);
+			} else if(key == "order") {
+				r.order = stoi(value);
+			} else if(key == "grid") {
+				r.grid = stoi(value);
+			} else if(key == "levels") {
+				r.levels = max(0, min(20, stoi(value)));
+			} else if(key == "eta") {
+				r.eta = stod(value);
+			} else {
+				error = "unknown key " + key;
+				return false;
+			}
+		} catch(const exception &e) {
+			ok = false;
+		}
+		if(!ok) {
+			error = "bad value for " + key + ": " + value;
+			return false;
+		}
+	}
+	if(r.input.empty() == (r.uniform <= 0)) {
+		error = "needs either input= or uniform=";
+		return false;
+	}
+	if(r.steps < 0) {
+		r.steps = defaultSteps;
+	}
+	return true;
+}
+
+bool Ensemble::readManifest(const string &filename)
+{
+	ifstream in(filename);
+	if(!in.good()) {
+		cerr << "Cannot read " << filename << endl;
+		return false;
+	}
+	runs.clear();
+	// Inputs are relative to the manifest, wherever it is run from
+	size_t slash = filename.find_last_of("/\\");
+	string dir = slash == string::npos ? "" : filename.substr(0, slash + 1);
+	string line;
+	for(int number = 1; getline(in, line); ++number) {
+		line = line.substr(0, line.find('#'));
+		if(line.find_first_not_of(" \t\r") == string::npos) {
+			continue;
+		}
+		EnsembleRun r;
+		string error;
+		if(!parseLine(line, r, error)) {
+			cerr << filename << ":" << number << ": " << error << endl;
+			return false;
+		}
+		if(r.name.empty()) {
+			r.name = "run" + to_string(runs.size());
+		}
+		if(!r.input.empty() && r.input[0] != '/') {
+			r.input = dir + r.input;
+		}
+		runs.push_back(r);
+	}
+	return true;
+}
+
+bool Ensemble::setUp(EnsembleRun &r, Simulation &sim) const
+{
+	if(r.uniform > 0) {
+		sim.createUniform(r.uniform, r.seed);
+	} else if(isSnapshot(r.input)) {
+		Snapshot s;
+		if(!readSnapshot(r.input, s)) {
+			r.error = "cannot read snapshot";
+			return false;
+		}
+		sim.restore(move(s));
+		// Carries on the way it was going unless told otherwise
+		if(!r.haveSolver) {
+			r.solver = sim.solver;
+		}
+		if(!r.haveScheme) {
+			r.scheme = sim.integrator.getScheme();
+		}
+	} else if(!sim.loadText(r.input)) {
+		r.error = "cannot read input";
+		return false;
+	}
+	if(!isnan(r.h)) {
+		sim.h = r.h;
+	}
+	if(!isnan(r.e2)) {
+		sim.e2 = r.e2;
+	}
+	r.h = sim.h;
+	r.e2 = sim.e2;
+	sim.solver = r.solver;
+	sim.barnesHut.setTheta(r.theta);
+	sim.fmm.setTheta(r.theta);
+	sim.fmm.setOrder(r.order);
+	sim.particleMesh.setGridSize(r.grid);
+	if(sim.integrator.getScheme() != r.scheme) {
+		sim.integrator.setScheme(r.scheme);
+	}
+	sim.integrator.setMaxLevel(r.levels);
+	sim.integrator.setEta(r.eta);
+	r.n = sim.bodies.size();
+	if(r.n == 0) {
+		r.error = "no bodies";
+		return false;
+	}
+	return true;
+}
+
+double Ensemble::stepCost(const EnsembleRun &r) const
+{
+	// Rough work per step, about one unit a nanosecond
+	double n = r.n;
+	double perStep;
+	switch(r.solver) {
+		case SOLVER_BARNES_HUT: perStep = 50.0 * n * log2(n + 1.0); break;
+		case SOLVER_FMM: perStep = 200.0 * n; break;
+		case SOLVER_PM: perStep = 50.0 * n + pow((double)r.grid, 3) * 30.0; break;
+		default: perStep = 0.5 * n * n; break;
+	}
+	if(r.scheme == Integrator::BLOCK) {
+		// Every tick drifts everybody, and some get forces. The FMM and
+		// particle mesh do all of them on every tick that has any.
+		bool full = r.solver == SOLVER_FMM || r.solver == SOLVER_PM;
+		perStep = perStep * (full ? (1 << r.levels) : 2) + n * (1 << r.levels);
+	}
+	return perStep;
+}
+
+void Ensemble::runOne(EnsembleRun &r, Simulation &sim, ThreadPool *pool) const
+{
+	const Bodies &b = sim.bodies;
+	bool energy = r.n <= Simulation::MAX_ENERGY_BODIES;
+	if(energy) {
+		r.energy0 = sim.energy(pool);
+	}
+	Vector3d p0 = totalMomentum(b);
+	double scale = 0.0;
+	for(int i = 0; i < b.size(); ++i) {
+		scale += b.m[i] * b.getVelocity(i).norm();
+	}
+	auto start = chrono::steady_clock::now();
+	for(int k = 0; k < r.steps; ++k) {
+		sim.step(pool);
+	}
+	r.seconds = secondsSince(start);
+	if(energy) {
+		r.energy1 = sim.energy(pool);
+	}
+	r.momentum = scale > 0.0 ? (totalMomentum(b) - p0).norm() / scale : 0.0;
+	r.t = sim.t;
+	r.forces = sim.integrator.getNumForces();
+}
+
+void Ensemble::run(ThreadPool *pool)
+{
+	auto start = chrono::steady_clock::now();
+	int count = (int)runs.size();
+	vector< unique_ptr<Simulation> > sims(count);
+	ThreadPool::forRange(pool, count, 1, [&](int begin, int end, int thread) {
+		for(int i = begin; i < end; ++i) {
+			sims[i].reset(new Simulation());
+			runs[i].error.clear();
+			if(!setUp(runs[i], *sims[i])) {
+				sims[i].reset();
+			}
+		}
+	});
+
+	// The big ones one at a time on the whole pool, then the rest side by
+	// side, biggest first
+	vector<int> order;
+	for(int i = 0; i < count; ++i) {
+		if(!sims[i]) {
+			continue;
+		}
+		if(pool && pool->getNumThreads() > 1 && stepCost(runs[i]) >= poolStepCost) {
+			runOne(runs[i], *sims[i], pool);
+			sims[i].reset();
+		} else {
+			order.push_back(i);
+		}
+	}
+	auto cost = [&](int i) { return stepCost(runs[i]) * runs[i].steps; };
+	stable_sort(order.begin(), order.end(), [&](int a, int b) { return cost(a) > cost(b); });
+	ThreadPool::forRange(pool, (int)order.size(), 1, [&](int begin, int end, int thread) {
+		for(int k = begin; k < end; ++k) {
+			int i = order[k];
+			runOne(runs[i], *sims[i], 0);
+			// Done with it
+			sims[i].reset();
+		}
+	});
+	seconds = secondsSince(start);
+}
+
+// Quoted if it has to be, with quotes doubled, so any name or message is
+// one CSV field
+static string csvField(const string &s)
+{
+	if(s.find_first_of(",\"\r\n") == string::npos) {
+		return s;
+	}
+	string quoted = "\"";
+	for(char c : s) {
+		quoted += c;
+		if(c == '"') {
+			quoted += '"';
+		}
+	}
+	return quoted + "\"";
+}
+
+bool Ensemble::writeResults(const string &filename) const
+{
+	ofstream out(filename);
+	if(!out.good()) {
+		cerr << "Could not write " << filename << endl;
+		return false;
+	}
+	out.precision(10);
+	out << "name,n,steps,t,h,e2,solver,integrator,seconds,steps_per_second,forces,energy0,energy1,rel_energy_error,rel_momentum_error,error\n";
+	for(const EnsembleRun &r : runs) {
+		const char *solvers[] = {"direct", "bh", "fmm", "pm"};
+		const char *schemes[] = {"euler", "leapfrog", "block"};
+		out << csvField(r.name) << "," << r.n << "," << r.steps << "," << r.t << ",";
+		// Not known for runs that couldn't be loaded
+		for(double x : {r.h, r.e2}) {
+			if(!isnan(x)) {
+				out << x;
+			}
+			out << ",";
+		}
+		out << solvers[r.solver] << "," << schemes[r.scheme] << ",";
+		if(!r.error.empty()) {
+			out << ",,,,,,," << csvField(r.error) << "\n";
+			continue;
+		}
+		out << r.seconds << "," << (r.seconds > 0.0 ? r.steps / r.seconds : 0.0) << "," << r.forces << ",";
+		if(isnan(r.energy0)) {
+			out << ",,,";
+		} else {
+			out << r.energy0 << "," << r.energy1 << "," << fabs((r.energy1 - r.energy0) / r.energy0) << ",";
+		}
+		out << r.momentum << ",\n";
+	}
+	return out.good();
+}
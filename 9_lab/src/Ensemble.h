@@ -0,0 +1,99 @@
+#pragma once
+#ifndef _ENSEMBLE_H_
+#define _ENSEMBLE_H_
+
+#include <string>
+#include <vector>
+
+#include "Simulation.h"
+
+class ThreadPool;
+
+// One simulation of an ensemble: where it starts, how it is stepped, and
+// what came out of it
+struct EnsembleRun
+{
+	// From the manifest
+	std::string name;
+	std::string input; // a text galaxy or a snapshot, or else
+	int uniform;       // this many random bodies
+	unsigned seed;     // for the random bodies
+	int steps;
+	double h, e2;      // NAN keeps the input's
+	Solver solver;     // a snapshot's own unless given
+	Integrator::Scheme scheme;
+	bool haveSolver, haveScheme; // given in the manifest
+	double theta;
+	int order;
+	int grid;
+	int levels;
+	double eta;
+
+	// Filled in by Ensemble::run()
+	std::string error; // empty if it ran
+	int n;
+	double t;
+	double seconds;
+	double energy0, energy1; // total energy before and after
+	double momentum;         // |change in total momentum| / sum of m |v| at the start
+	long long forces;        // accelerations of single bodies computed
+
+	EnsembleRun();
+};
+
+// Runs many independent simulations at once, one per thread, for parameter
+// sweeps.
+//
+// The manifest has one run per line, as key=value words:
+//    name=<name> steps=<k> input=<file> | uniform=<n> seed=<s>
+//    h=<h> e2=<e2> solver=direct|bh|fmm|pm integrator=euler|leapfrog|block
+//    theta=<theta> order=<p> grid=<g> levels=<n> eta=<eta>
+// Everything but input or uniform is optional. # starts a comment. An input
+// path is relative to the manifest's directory unless it starts with /. h and
+// e2 default to the input's, and a snapshot carries on with its own solver
+// and integrator unless they are given.
+//
+// Small simulations are stepped on a single thread each: they have too
+// little work per step to split, and running many of them side by side
+// keeps every core busy without any synchronization between steps. They are
+// started biggest first, each going to whichever thread is free, so a long
+// run can't be left to start at the end while the other threads sit idle.
+// Runs with enough work per step to split go first, one at a time, each on
+// the whole pool. All the initial conditions are loaded first (also in
+// parallel), since the size of a run is only known then.
+class Ensemble
+{
+public:
+	Ensemble();
+	virtual ~Ensemble();
+
+	// Runs without steps= take this many
+	void setDefaultSteps(int steps) { defaultSteps = steps; }
+	// Runs whose estimated work per step is at least this get the whole
+	// pool to themselves. About 10^7 is 10 ms of single-threaded work.
+	void setPoolStepCost(double cost) { poolStepCost = cost; }
+
+	// Returns false, and prints why, if the file can't be read or has a line
+	// that doesn't make sense
+	bool readManifest(const std::string &filename);
+	const std::vector<EnsembleRun> &getRuns() const { return runs; }
+
+	void run(ThreadPool *pool = 0);
+	double getSeconds() const { return seconds; }
+
+	// One line per run, in manifest order, comma separated, with a header
+	bool writeResults(const std::string &filename) const;
+
+private:
+	bool parseLine(const std::string &line, EnsembleRun &r, std::string &error) const;
+	bool setUp(EnsembleRun &r, Simulation &sim) const;
+	void runOne(EnsembleRun &r, Simulation &sim, ThreadPool *pool) const;
+	double stepCost(const EnsembleRun &r) const;
+
+	int defaultSteps;
+	double poolStepCost;
+	std::vector<EnsembleRun> runs;
+	double seconds;
+};
+
+#endif
@@ -0,0 +1,137 @@
+#include "FFT.h"
+#include "ThreadPool.h"
+
+#include <cmath>
+#include <algorithm>
+
+using namespace std;
+
+// y and z lines are gathered this many at a time: neighbouring lines are
+// next to each other in memory, so each read is a short contiguous run
+#define LINES_PER_BATCH 16
+
+FFT::FFT() :
+	n(0)
+{
+}
+
+FFT::~FFT()
+{
+}
+
+void FFT::setSize(int n)
+{
+	if(n == this->n) {
+		return;
+	}
+	this->n = n;
+	int bits = 0;
+	while((1 << bits) < n) {
+		bits++;
+	}
+	bitReverse.resize(n);
+	for(int i = 0; i < n; ++i) {
+		int r = 0;
+		for(int b = 0; b < bits; ++b) {
+			r |= ((i >> b) & 1) << (bits - 1 - b);
+		}
+		bitReverse[i] = r;
+	}
+	twiddles.resize(max(1, n / 2));
+	for(int k = 0; k < n / 2; ++k) {
+		double a = -2.0 * M_PI * k / n;
+		twiddles[k] = complex<double>(cos(a), sin(a));
+	}
+}
+
+void FFT::transformLine(complex<double> *line, bool inverse) const
+{
+	for(int i = 0; i < n; ++i) {
+		int r = bitReverse[i];
+		if(i < r) {
+			swap(line[i], line[r]);
+		}
+	}
+	// Butterflies of size 2, 4, ..., n. The complex products are written
+	// out, since std::complex's operator* checks for infinities and NaNs.
+	double sign = inverse ? -1.0 : 1.0;
+	for(int len = 2; len <= n; len <<= 1) {
+		int half = len / 2;
+		int step = n / len;
+		for(int i = 0; i < n; i += len) {
+			complex<double> *a = line + i;
+			complex<double> *b = line + i + half;
+			for(int k = 0; k < half; ++k) {
+				double wr = twiddles[k * step].real();
+				double wi = sign * twiddles[k * step].imag();
+				double vr = b[k].real() * wr - b[k].imag() * wi;
+				double vi = b[k].real() * wi + b[k].imag() * wr;
+				double ur = a[k].real();
+				double ui = a[k].imag();
+				a[k] = complex<double>(ur + vr, ui + vi);
+				b[k] = complex<double>(ur - vr, ui - vi);
+			}
+		}
+	}
+}
+
+void FFT::transformAxis(complex<double> *data, int stride, bool inverse, int filled, ThreadPool *pool)
+{
+	// The lines along this axis start at every (x, y, z) with the axis
+	// coordinate 0. Batches are lines next to each other in x. Only the
+	// first `filled` values of the other coordinate can be nonzero.
+	int lines = min(LINES_PER_BATCH, n);
+	int batches_per_row = n / lines;
+	int num_batches = filled * batches_per_row;
+	auto work = [&](int begin, int end, int thread) {
+		vector< complex<double> > &buffer = buffers[thread];
+		buffer.resize(lines * n);
+		for(int b = begin; b < end; ++b) {
+			// The other coordinate that isn't x (z for the y axis, y for the z axis)
+			int other = b / batches_per_row;
+			int x0 = (b % batches_per_row) * lines;
+			complex<double> *start = data + x0 + (stride == n ? other * n * n : other * n);
+			for(int t = 0; t < n; ++t) {
+				const complex<double> *src = start + t * stride;
+				for(int l = 0; l < lines; ++l) {
+					buffer[l * n + t] = src[l];
+				}
+			}
+			for(int l = 0; l < lines; ++l) {
+				transformLine(&buffer[l * n], inverse);
+			}
+			for(int t = 0; t < n; ++t) {
+				complex<double> *dst = start + t * stride;
+				for(int l = 0; l < lines; ++l) {
+					dst[l] = buffer[l * n + t];
+				}
+			}
+		}
+	};
+	ThreadPool::forRange(pool, num_batches, 4, work);
+}
+
+void FFT::transform(complex<double> *data, bool inverse, ThreadPool *pool, int filled)
+{
+	if(n <= 1) {
+		return;
+	}
+	if(filled <= 0 || filled > n) {
+		filled = n;
+	}
+	buffers.resize(pool ? pool->getNumThreads() : 1);
+	// x lines are contiguous. Only the ones with y and z below `filled` have
+	// anything in them.
+	auto rows = [&](int begin, int end, int thread) {
+		for(int r = begin; r < end; ++r) {
+			int y = r % filled;
+			int z = r / filled;
+			transformLine(data + ((size_t)z * n + y) * n, inverse);
+		}
+	};
+	ThreadPool::forRange(pool, filled * filled, 64, rows);
+	// After that the y lines fill every x, but only z below `filled`, and
+	// after them the z lines fill everything
+	transformAxis(data, n, inverse, filled, pool);
+	transformAxis(data, n * n, inverse, n, pool);
+}
@@ -0,0 +1,41 @@
+#pragma once
+#ifndef _FFT_H_
+#define _FFT_H_
+
+#include <vector>
+#include <complex>
+
+class ThreadPool;
+
+// In-place 3D complex FFT on an n x n x n grid, n a power of two, stored
+// with x fastest: (x, y, z) is at (z * n + y) * n + x.
+//
+// Radix-2 on each line. The x lines are contiguous and are done in place;
+// y and z lines are copied a few at a time into a per-thread buffer, so the
+// reads stay (mostly) sequential. Lines are split over the pool.
+class FFT
+{
+public:
+	FFT();
+	virtual ~FFT();
+
+	void setSize(int n);
+	int getSize() const { return n; }
+
+	// Forward is sum_x f(x) e^(-2 pi i k x / n) along each axis. The inverse
+	// is not scaled by 1/n^3. If only coordinates below `filled` can be
+	// nonzero (a zero padded grid), the lines that are still all zeros are
+	// skipped.
+	void transform(std::complex<double> *data, bool inverse, ThreadPool *pool = 0, int filled = 0);
+
+private:
+	void transformLine(std::complex<double> *line, bool inverse) const;
+	void transformAxis(std::complex<double> *data, int stride, bool inverse, int filled, ThreadPool *pool);
+
+	int n;
+	std::vector<int> bitReverse;
+	std::vector< std::complex<double> > twiddles; // e^(-2 pi i k / n) for k < n/2
+	std::vector< std::vector< std::complex<double> > > buffers; // per thread
+};
+
+#endif
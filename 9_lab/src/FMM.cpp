@@ -0,0 +1,524 @@
+#include "FMM.h"
+#include "Bodies.h"
+#include "Gravity.h"
+#include "ThreadPool.h"
+
+#include <cmath>
+#include <algorithm>
+#include <functional>
+
+using namespace std;
+using namespace Eigen;
+
+// Cells with this many bodies or fewer aren't split any further
+#define LEAF_SIZE 128
+// Stops splitting bodies that sit on top of each other
+#define MAX_DEPTH 32
+// Coefficients of an expansion of order MAX_ORDER
+#define MAX_COEFFS ((FMM::MAX_ORDER + 1) * (FMM::MAX_ORDER + 2) * (FMM::MAX_ORDER + 3) / 6)
+
+static inline int octant(const Vector3d &x, const Vector3d &center)
+{
+	return (x(0) > center(0) ? 1 : 0) | (x(1) > center(1) ? 2 : 0) | (x(2) > center(2) ? 4 : 0);
+}
+
+FMM::FMM() :
+	order(0),
+	numCoeffs(0),
+	theta(0.5),
+	eps2(0.0),
+	numM2L(0),
+	numP2P(0)
+{
+	setOrder(4);
+}
+
+FMM::~FMM()
+{
+}
+
+void FMM::setOrder(int order)
+{
+	order = max(1, min(MAX_ORDER, order));
+	if(order != this->order) {
+		this->order = order;
+		buildTables();
+	}
+}
+
+void FMM::buildTables()
+{
+	int P = order + 1;
+	vector<int> lookup(P * P * P, -1);
+	auto at = [&](int a, int b, int c) { return lookup[(a * P + b) * P + c]; };
+
+	nx.clear(); ny.clear(); nz.clear();
+	degree.clear();
+	degreeEnd.clear();
+	for(int d = 0; d <= order; ++d) {
+		for(int a = d; a >= 0; --a) {
+			for(int b = d - a; b >= 0; --b) {
+				int c = d - a - b;
+				lookup[(a * P + b) * P + c] = (int)nx.size();
+				nx.push_back(a);
+				ny.push_back(b);
+				nz.push_back(c);
+				degree.push_back(d);
+			}
+		}
+		degreeEnd.push_back((int)nx.size());
+	}
+	numCoeffs = (int)nx.size();
+
+	dir.assign(numCoeffs, -1);
+	prev.assign(numCoeffs, -1);
+	prev2.assign(numCoeffs, -1);
+	dirN.assign(numCoeffs, 0);
+	for(int i = 1; i < numCoeffs; ++i) {
+		int a = nx[i], b = ny[i], c = nz[i];
+		if(a > 0) {
+			dir[i] = 0;
+			dirN[i] = a;
+			prev[i] = at(a - 1, b, c);
+			prev2[i] = a > 1 ? at(a - 2, b, c) : -1;
+		} else if(b > 0) {
+			dir[i] = 1;
+			dirN[i] = b;
+			prev[i] = at(a, b - 1, c);
+			prev2[i] = b > 1 ? at(a, b - 2, c) : -1;
+		} else {
+			dir[i] = 2;
+			dirN[i] = c;
+			prev[i] = at(a, b, c - 1);
+			prev2[i] = c > 1 ? at(a, b, c - 2) : -1;
+		}
+	}
+
+	shiftN.clear(); shiftK.clear(); shiftNK.clear();
+	m2lBegin.clear(); m2lNK.clear(); m2lSign.clear();
+	for(int n = 0; n < numCoeffs; ++n) {
+		for(int k = 0; k < numCoeffs; ++k) {
+			if(nx[k] <= nx[n] && ny[k] <= ny[n] && nz[k] <= nz[n]) {
+				shiftN.push_back(n);
+				shiftK.push_back(k);
+				shiftNK.push_back(at(nx[n] - nx[k], ny[n] - ny[k], nz[n] - nz[k]));
+			}
+		}
+	}
+	for(int k = 0; k < numCoeffs; ++k) {
+		m2lBegin.push_back((int)m2lNK.size());
+		for(int n = 0; n < degreeEnd[order - degree[k]]; ++n) {
+			m2lNK.push_back(at(nx[n] + nx[k], ny[n] + ny[k], nz[n] + nz[k]));
+		}
+		m2lSign.push_back(degree[k] % 2 == 0 ? -1.0 : 1.0);
+	}
+	m2lBegin.push_back((int)m2lNK.size());
+
+	gradX.clear(); gradY.clear(); gradZ.clear();
+	for(int k = 0; k < degreeEnd[order - 1]; ++k) {
+		gradX.push_back(at(nx[k] + 1, ny[k], nz[k]));
+		gradY.push_back(at(nx[k], ny[k] + 1, nz[k]));
+		gradZ.push_back(at(nx[k], ny[k], nz[k] + 1));
+	}
+}
+
+void FMM::powers(const Vector3d &d, int degree, double *out) const
+{
+	// d^n / n! = d^(n - e) / (n - e)! * d_e / n_e
+	out[0] = 1.0;
+	int end = degreeEnd[degree];
+	for(int i = 1; i < end; ++i) {
+		out[i] = out[prev[i]] * d(dir[i]) / dirN[i];
+	}
+}
+
+void FMM::derivatives(const Vector3d &r, double *D) const
+{
+	// McMurchie-Davidson style recurrence. For f(|r|^2), with
+	//    R[m][0] = 2^m f^(m)(|r|^2) = (-1)^m (2m-1)!! / (|r|^2 + e2)^(m + 1/2)
+	// every derivative comes from lower ones:
+	//    R[m][n + e] = r_e R[m+1][n] + n_e R[m+1][n - e]
+	// and D[n] = R[0][n].
+	double R[MAX_ORDER + 1][MAX_COEFFS];
+	double inv2 = 1.0 / (r.squaredNorm() + eps2);
+	double f = sqrt(inv2);
+	for(int m = 0; m <= order; ++m) {
+		R[m][0] = f;
+		f *= -(2 * m + 1) * inv2;
+	}
+	for(int i = 1; i < numCoeffs; ++i) {
+		double ri = r(dir[i]);
+		int p1 = prev[i];
+		int p2 = prev2[i];
+		double c = dirN[i] - 1;
+		for(int m = 0; m <= order - degree[i]; ++m) {
+			R[m][i] = ri * R[m+1][p1] + (p2 >= 0 ? c * R[m+1][p2] : 0.0);
+		}
+	}
+	for(int i = 0; i < numCoeffs; ++i) {
+		D[i] = R[0][i];
+	}
+}
+
+void FMM::P2M(int i)
+{
+	const Node &node = nodes[i];
+	double *M = &multipoles[i * numCoeffs];
+	double pw[MAX_COEFFS];
+	for(int k = node.begin; k < node.end; ++k) {
+		powers(position(k) - node.com, order, pw);
+		for(int c = 0; c < numCoeffs; ++c) {
+			M[c] += sortedM[k] * pw[c];
+		}
+	}
+}
+
+void FMM::M2M(int child, int parent)
+{
+	// M_n(parent) += sum over k <= n of M_k(child) d^(n-k) / (n-k)!
+	double pw[MAX_COEFFS];
+	powers(nodes[child].com - nodes[parent].com, order, pw);
+	const double *Mc = &multipoles[child * numCoeffs];
+	double *Mp = &multipoles[parent * numCoeffs];
+	int num = (int)shiftN.size();
+	for(int t = 0; t < num; ++t) {
+		Mp[shiftN[t]] += Mc[shiftK[t]] * pw[shiftNK[t]];
+	}
+}
+
+void FMM::M2L(int source, int target)
+{
+	// The potential is -1/r, so
+	// L_k(target) -= sum over n of (-1)^|n| M_n(source) D_(n+k)(target - source)
+	double D[MAX_COEFFS];
+	derivatives(nodes[target].com - nodes[source].com, D);
+	const double *M = &multipoles[source * numCoeffs];
+	double *L = &locals[target * numCoeffs];
+	double signedM[MAX_COEFFS];
+	for(int n = 0; n < numCoeffs; ++n) {
+		signedM[n] = m2lSign[n] * M[n];
+	}
+	// One sum per coefficient, so that the adds don't wait on each other
+	// through memory
+	const int *nk = &m2lNK[0];
+	for(int k = 0; k < numCoeffs; ++k) {
+		double sum = 0.0;
+		int num = m2lBegin[k+1] - m2lBegin[k];
+		for(int n = 0; n < num; ++n) {
+			sum += signedM[n] * D[*nk++];
+		}
+		L[k] += sum;
+	}
+}
+
+void FMM::L2L(int parent, int child)
+{
+	// L_k(child) += sum over n >= k of L_n(parent) d^(n-k) / (n-k)!
+	double pw[MAX_COEFFS];
+	powers(nodes[child].com - nodes[parent].com, order, pw);
+	const double *Lp = &locals[parent * numCoeffs];
+	double *Lc = &locals[child * numCoeffs];
+	int num = (int)shiftN.size();
+	for(int t = 0; t < num; ++t) {
+		Lc[shiftK[t]] += Lp[shiftN[t]] * pw[shiftNK[t]];
+	}
+}
+
+void FMM::L2P(int i)
+{
+	// The local expansion is the potential, so the acceleration is minus its
+	// gradient: dPhi/dx = sum over k of L_(k+e_x) d^k / k!
+	const Node &node = nodes[i];
+	const double *L = &locals[i * numCoeffs];
+	double pw[MAX_COEFFS];
+	int num = degreeEnd[order - 1];
+	for(int k = node.begin; k < node.end; ++k) {
+		powers(position(k) - node.com, order - 1, pw);
+		Vector3d g(0.0, 0.0, 0.0);
+		for(int c = 0; c < num; ++c) {
+			g(0) += L[gradX[c]] * pw[c];
+			g(1) += L[gradY[c]] * pw[c];
+			g(2) += L[gradZ[c]] * pw[c];
+		}
+		sortedAX[k] -= g(0);
+		sortedAY[k] -= g(1);
+		sortedAZ[k] -= g(2);
+	}
+}
+
+void FMM::P2P(int source, int target)
+{
+	const Node &s = nodes[source];
+	const Node &t = nodes[target];
+	pairAccelerations(&sortedX[0], &sortedY[0], &sortedZ[0], &sortedM[0], eps2,
+	                  t.begin, t.end, s.begin, s.end, &sortedAX[0], &sortedAY[0], &sortedAZ[0]);
+}
+
+void FMM::splitNode(int i, int count[8])
+{
+	// Counting sort of the node's bodies into its 8 octants
+	const Node &node = nodes[i];
+	for(int k = node.begin; k < node.end; ++k) {
+		count[octant(position(k), node.center)]++;
+	}
+	int next[8];
+	next[0] = node.begin;
+	for(int c = 1; c < 8; ++c) {
+		next[c] = next[c-1] + count[c-1];
+	}
+	for(int k = node.begin; k < node.end; ++k) {
+		int dst = next[octant(position(k), node.center)]++;
+		scratchX[dst] = sortedX[k];
+		scratchY[dst] = sortedY[k];
+		scratchZ[dst] = sortedZ[k];
+		scratchM[dst] = sortedM[k];
+		scratchOrder[dst] = bodyOrder[k];
+	}
+	copy(scratchX.begin() + node.begin, scratchX.begin() + node.end, sortedX.begin() + node.begin);
+	copy(scratchY.begin() + node.begin, scratchY.begin() + node.end, sortedY.begin() + node.begin);
+	copy(scratchZ.begin() + node.begin, scratchZ.begin() + node.end, sortedZ.begin() + node.begin);
+	copy(scratchM.begin() + node.begin, scratchM.begin() + node.end, sortedM.begin() + node.begin);
+	copy(scratchOrder.begin() + node.begin, scratchOrder.begin() + node.end, bodyOrder.begin() + node.begin);
+}
+
+void FMM::build(const Bodies &b, ThreadPool *pool)
+{
+	int n = b.size();
+	bodyOrder.resize(n);
+	for(int i = 0; i < n; ++i) {
+		bodyOrder[i] = i;
+	}
+	sortedX = b.x;
+	sortedY = b.y;
+	sortedZ = b.z;
+	sortedM = b.m;
+	scratchOrder.resize(n);
+	scratchX.resize(n);
+	scratchY.resize(n);
+	scratchZ.resize(n);
+	scratchM.resize(n);
+
+	Vector3d xmin = position(0);
+	Vector3d xmax = position(0);
+	for(int i = 1; i < n; ++i) {
+		xmin = xmin.cwiseMin(position(i));
+		xmax = xmax.cwiseMax(position(i));
+	}
+	Node root;
+	root.center = 0.5 * (xmin + xmax);
+	root.half = 0.5 * (xmax - xmin).maxCoeff() * (1.0 + 1e-9) + 1e-12;
+	root.begin = 0;
+	root.end = n;
+
+	// Breadth first, one level at a time, so that every level is a
+	// contiguous range of nodes and so are the children of any node. The
+	// nodes of a level own disjoint ranges of bodies, so they're split in
+	// parallel, and then their children are added.
+	nodes.clear();
+	nodes.push_back(root);
+	levelBegin.assign(1, 0);
+	vector<int> counts;
+	for(int depth = 0; ; ++depth) {
+		int lb = levelBegin.back();
+		int le = (int)nodes.size();
+		counts.assign((le - lb) * 8, 0);
+		if(depth < MAX_DEPTH) {
+			ThreadPool::forRange(pool, le - lb, 1, [&](int begin, int end, int thread) {
+				for(int i = lb + begin; i < lb + end; ++i) {
+					if(nodes[i].end - nodes[i].begin > LEAF_SIZE) {
+						splitNode(i, &counts[(i - lb) * 8]);
+					}
+				}
+			});
+		}
+		for(int i = lb; i < le; ++i) {
+			const int *count = &counts[(i - lb) * 8];
+			if(nodes[i].end - nodes[i].begin <= LEAF_SIZE || depth >= MAX_DEPTH) {
+				continue;
+			}
+			nodes[i].firstChild = (int)nodes.size();
+			double h = 0.5 * nodes[i].half;
+			int start = nodes[i].begin;
+			for(int c = 0; c < 8; ++c) {
+				if(count[c] == 0) {
+					continue;
+				}
+				Node child;
+				child.center = nodes[i].center + Vector3d(c & 1 ? h : -h, c & 2 ? h : -h, c & 4 ? h : -h);
+				child.half = h;
+				child.begin = start;
+				child.end = start + count[c];
+				start = child.end;
+				nodes.push_back(child);
+				nodes[i].numChildren++;
+			}
+		}
+		levelBegin.push_back(le);
+		if((int)nodes.size() == le) {
+			break;
+		}
+	}
+}
+
+void FMM::upward(ThreadPool *pool)
+{
+	int num_levels = (int)levelBegin.size() - 1;
+	for(int l = num_levels - 1; l >= 0; --l) {
+		int lb = levelBegin[l];
+		ThreadPool::forRange(pool, levelBegin[l+1] - lb, 16, [&](int begin, int end, int thread) {
+			for(int i = lb + begin; i < lb + end; ++i) {
+				Node &node = nodes[i];
+				Vector3d com(0.0, 0.0, 0.0);
+				double mass = 0.0;
+				if(node.firstChild < 0) {
+					for(int k = node.begin; k < node.end; ++k) {
+						com += sortedM[k] * position(k);
+						mass += sortedM[k];
+					}
+				} else {
+					for(int c = node.firstChild; c < node.firstChild + node.numChildren; ++c) {
+						com += nodes[c].mass * nodes[c].com;
+						mass += nodes[c].mass;
+					}
+				}
+				node.mass = mass;
+				node.com = mass > 0.0 ? Vector3d(com / mass) : node.center;
+
+				double rmax = 0.0;
+				if(node.firstChild < 0) {
+					for(int k = node.begin; k < node.end; ++k) {
+						rmax = max(rmax, (position(k) - node.com).norm());
+					}
+					node.rmax = rmax;
+					P2M(i);
+				} else {
+					for(int c = node.firstChild; c < node.firstChild + node.numChildren; ++c) {
+						rmax = max(rmax, (nodes[c].com - node.com).norm() + nodes[c].rmax);
+						M2M(c, i);
+					}
+					// Never more than the farthest corner of the cube
+					node.rmax = min(rmax, (node.com - node.center).norm() + sqrt(3.0) * node.half);
+				}
+			}
+		});
+	}
+}
+
+void FMM::interact(int target, vector<int> &sources, int depth, int taskDepth, vector<Task> *tasks, long long &m2l, long long &p2p)
+{
+	if(tasks && depth == taskDepth) {
+		Task task;
+		task.node = target;
+		task.sources = sources;
+		tasks->push_back(task);
+		return;
+	}
+	const Node &a = nodes[target];
+	bool a_leaf = a.firstChild < 0;
+	// Sources that are too close to this cell as a whole, for its children
+	vector<int> next;
+	// sources grows as big source cells get split
+	for(size_t k = 0; k < sources.size(); ++k) {
+		int source = sources[k];
+		const Node &s = nodes[source];
+		bool s_leaf = s.firstChild < 0;
+		if(source != target && a.rmax + s.rmax < theta * (a.com - s.com).norm()) {
+			M2L(source, target);
+			m2l++;
+		} else if(a_leaf && s_leaf) {
+			P2P(source, target);
+			p2p += (long long)(a.end - a.begin) * (s.end - s.begin);
+		} else if(a_leaf || (!s_leaf && s.rmax > a.rmax)) {
+			// Split the source
+			for(int c = s.firstChild; c < s.firstChild + s.numChildren; ++c) {
+				sources.push_back(c);
+			}
+		} else {
+			// Split the target
+			next.push_back(source);
+		}
+	}
+	if(!a_leaf) {
+		for(int c = a.firstChild; c < a.firstChild + a.numChildren; ++c) {
+			vector<int> child_sources = next;
+			interact(c, child_sources, depth + 1, taskDepth, tasks, m2l, p2p);
+		}
+	}
+}
+
+void FMM::downward(ThreadPool *pool)
+{
+	int num_levels = (int)levelBegin.size() - 1;
+	for(int l = 0; l < num_levels; ++l) {
+		int lb = levelBegin[l];
+		ThreadPool::forRange(pool, levelBegin[l+1] - lb, 16, [&](int begin, int end, int thread) {
+			for(int i = lb + begin; i < lb + end; ++i) {
+				const Node &node = nodes[i];
+				if(node.firstChild < 0) {
+					L2P(i);
+				}
+				for(int c = node.firstChild; c < node.firstChild + node.numChildren; ++c) {
+					L2L(i, c);
+				}
+			}
+		});
+	}
+}
+
+void FMM::computeAccelerations(const Bodies &b, double e2, double *ax, double *ay, double *az, ThreadPool *pool)
+{
+	int n = b.size();
+	numM2L = 0;
+	numP2P = 0;
+	if(n == 0) {
+		return;
+	}
+	eps2 = e2;
+	build(b, pool);
+	multipoles.assign(nodes.size() * numCoeffs, 0.0);
+	locals.assign(nodes.size() * numCoeffs, 0.0);
+	sortedAX.assign(n, 0.0);
+	sortedAY.assign(n, 0.0);
+	sortedAZ.assign(n, 0.0);
+	upward(pool);
+
+	// The top of the interaction pass is done here, until there are enough
+	// cells on a level to keep the threads busy. Each of those cells and its
+	// subtree is then finished on its own, and only writes to its subtree.
+	int num_levels = (int)levelBegin.size() - 1;
+	int task_depth = 0;
+	if(pool) {
+		while(task_depth < num_levels - 1 &&
+		      levelBegin[task_depth + 1] - levelBegin[task_depth] < 8 * pool->getNumThreads()) {
+			task_depth++;
+		}
+	}
+	vector<Task> tasks;
+	vector<int> sources(1, 0);
+	interact(0, sources, 0, pool ? task_depth : -1, pool ? &tasks : 0, numM2L, numP2P);
+	if(pool) {
+		vector<long long> m2l(pool->getNumThreads(), 0);
+		vector<long long> p2p(pool->getNumThreads(), 0);
+		pool->parallelForDynamic((int)tasks.size(), 1, [&](int begin, int end, int thread) {
+			long long my_m2l = 0, my_p2p = 0;
+			for(int t = begin; t < end; ++t) {
+				interact(tasks[t].node, tasks[t].sources, task_depth, -1, 0, my_m2l, my_p2p);
+			}
+			m2l[thread] += my_m2l;
+			p2p[thread] += my_p2p;
+		});
+		for(int t = 0; t < pool->getNumThreads(); ++t) {
+			numM2L += m2l[t];
+			numP2P += p2p[t];
+		}
+	}
+
+	downward(pool);
+
+	for(int k = 0; k < n; ++k) {
+		int i = bodyOrder[k];
+		ax[i] = sortedAX[k];
+		ay[i] = sortedAY[k];
+		az[i] = sortedAZ[k];
+	}
+}
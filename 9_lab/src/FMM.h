@@ -0,0 +1,140 @@
+#pragma once
+#ifndef _FMM_H_
+#define _FMM_H_
+
+#include <vector>
+
+#define EIGEN_DONT_ALIGN_STATICALLY
+#include <Eigen/Dense>
+
+class ThreadPool;
+struct Bodies;
+
+// Fast multipole method gravity, O(n).
+//
+// Like Barnes-Hut it builds an octree (adaptive: a cell is only split while
+// it has more than a leaf's worth of bodies), but instead of every body
+// walking the tree, whole cells interact with whole cells. Each cell gets a
+// multipole expansion of its own bodies (P2M, and M2M up the tree), every
+// pair of cells that are far enough apart turns one's multipoles into the
+// other's local expansion (M2L), and the local expansions are pushed down
+// the tree (L2L) and evaluated at the bodies (L2P). Cells that are too close
+// together for that, and are both leaves, do direct sum (P2P).
+//
+// The expansions are Cartesian Taylor series of the softened potential
+// -1/sqrt(r^2 + e2) up to a configurable order. Higher orders and smaller
+// theta are more accurate and slower.
+class FMM
+{
+public:
+	// Highest supported expansion order
+	static const int MAX_ORDER = 8;
+
+	FMM();
+	virtual ~FMM();
+
+	// 1 is monopole + dipole terms only, 4 is a good default
+	void setOrder(int order);
+	int getOrder() const { return order; }
+	// Two cells interact through their expansions when
+	// (radius A + radius B) < theta * distance
+	void setTheta(double theta) { this->theta = theta; }
+	double getTheta() const { return theta; }
+
+	// Sets a[i] to the acceleration of body i for G = 1, like the other
+	// solvers, and writes it to ax[i], ay[i] and az[i]. Every pass is split
+	// over the pool if there is one.
+	void computeAccelerations(const Bodies &b, double e2, double *ax, double *ay, double *az, ThreadPool *pool = 0);
+
+	int getNumNodes() const { return (int)nodes.size(); }
+	// Cell-cell and body-body interactions in the last computeAccelerations()
+	long long getNumM2L() const { return numM2L; }
+	long long getNumP2P() const { return numP2P; }
+
+private:
+	struct Node
+	{
+		Node() : center(0.0, 0.0, 0.0), half(0.0), com(0.0, 0.0, 0.0), mass(0.0), rmax(0.0), begin(0), end(0), firstChild(-1), numChildren(0)
+		{
+		}
+
+		Eigen::Vector3d center; // of the cube
+		double half;            // half the cube's side
+		Eigen::Vector3d com;    // center of mass, where the expansions are
+		double mass;
+		double rmax;            // distance from com to the farthest body
+		int begin;              // bodies in [begin, end) of the sorted arrays
+		int end;
+		int firstChild;         // children are contiguous, -1 for leaves
+		int numChildren;
+	};
+	// Part of the interaction pass that can run on its own: a cell and the
+	// cells it still has to interact with
+	struct Task
+	{
+		int node;
+		std::vector<int> sources;
+	};
+
+	void buildTables();
+	void build(const Bodies &b, ThreadPool *pool);
+	void splitNode(int i, int count[8]);
+	void upward(ThreadPool *pool);
+	void interact(int target, std::vector<int> &sources, int depth, int taskDepth, std::vector<Task> *tasks, long long &m2l, long long &p2p);
+	void downward(ThreadPool *pool);
+
+	// d^n / n! for every multi-index n up to degree
+	void powers(const Eigen::Vector3d &d, int degree, double *out) const;
+	// The derivatives of 1/sqrt(|r|^2 + e2) for every multi-index
+	void derivatives(const Eigen::Vector3d &r, double *D) const;
+	void P2M(int i);
+	void M2M(int child, int parent);
+	void M2L(int source, int target);
+	void L2L(int parent, int child);
+	void L2P(int i);
+	void P2P(int source, int target);
+	Eigen::Vector3d position(int k) const { return Eigen::Vector3d(sortedX[k], sortedY[k], sortedZ[k]); }
+
+	int order;
+	int numCoeffs;
+	double theta;
+	double eps2;
+
+	// Multi-indices n = (nx, ny, nz), sorted by degree nx + ny + nz
+	std::vector<int> nx, ny, nz;
+	std::vector<int> degree;
+	std::vector<int> degreeEnd;  // indices of degree <= d are [0, degreeEnd[d])
+	// To get index i from a lower one: i = prev[i] + e_dir, with prev2[i] =
+	// prev[i] - e_dir (or -1), and dirN[i] the component of i along dir
+	std::vector<int> dir;
+	std::vector<int> prev;
+	std::vector<int> prev2;
+	std::vector<int> dirN;
+	// (n, k, n - k) for every k <= n, to shift expansions
+	std::vector<int> shiftN, shiftK, shiftNK;
+	// For M2L: the terms of local coefficient k are [m2lBegin[k],
+	// m2lBegin[k+1]), one for each n with |n| + |k| <= order (in order, from
+	// n = 0), and m2lNK is n + k. m2lSign[n] is -(-1)^|n|.
+	std::vector<int> m2lBegin, m2lNK;
+	std::vector<double> m2lSign;
+	// k + e_x, k + e_y, k + e_z for k up to order-1, for the gradient
+	std::vector<int> gradX, gradY, gradZ;
+
+	std::vector<Node> nodes;
+	std::vector<int> levelBegin; // nodes at level l are [levelBegin[l], levelBegin[l+1])
+	std::vector<double> multipoles; // numCoeffs per node
+	std::vector<double> locals;
+
+	// The bodies sorted into tree order, in separate arrays for
+	// pairAccelerations(), and their accelerations
+	std::vector<int> bodyOrder;
+	std::vector<double> sortedX, sortedY, sortedZ, sortedM;
+	std::vector<double> sortedAX, sortedAY, sortedAZ;
+	std::vector<int> scratchOrder;
+	std::vector<double> scratchX, scratchY, scratchZ, scratchM;
+
+	long long numM2L;
+	long long numP2P;
+};
+
+#endif
@@ -0,0 +1,439 @@
+#include "Gravity.h"
+#include "Bodies.h"
+#include "ThreadPool.h"
+
+#include <cmath>
+#include <algorithm>
+
+// The AVX2 kernel is compiled for AVX2 on its own (with a target attribute)
+// and picked at run time, so the rest of the program doesn't need -mavx2.
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define GRAVITY_AVX2
+#include <immintrin.h>
+#endif
+
+using namespace std;
+
+// Bodies per block. x, y, z and m of a block take 8KB and its accumulators
+// 6KB, so the two blocks of a tile fit in L1 together.
+#define BLOCK_SIZE 256
+
+void directAccelerationsScalar(const Bodies &b, double e2, int begin, int end, double *ax, double *ay, double *az)
+{
+	int n = b.size();
+	if(begin >= end) {
+		return;
+	}
+	const double *x = &b.x[0];
+	const double *y = &b.y[0];
+	const double *z = &b.z[0];
+	const double *m = &b.m[0];
+	for(int i = begin; i < end; ++i) {
+		double xi = x[i], yi = y[i], zi = z[i];
+		double sx = 0.0, sy = 0.0, sz = 0.0;
+		for(int j = 0; j < n; ++j) {
+			if(j == i) {
+				continue;
+			}
+			double dx = x[j] - xi;
+			double dy = y[j] - yi;
+			double dz = z[j] - zi;
+			double inv = 1.0 / sqrt(dx*dx + dy*dy + dz*dz + e2);
+			double s = m[j] * inv * inv * inv;
+			sx += s * dx;
+			sy += s * dy;
+			sz += s * dz;
+		}
+		ax[i - begin] = sx;
+		ay[i - begin] = sy;
+		az[i - begin] = sz;
+	}
+}
+
+// One tile of the symmetric sum: every pair with i in [ib, ie) and j in
+// [jb, je), or only j > i when the two blocks are the same. Adds into the
+// (thread's own) accelerations ax, ay, az.
+static void tileScalar(const Bodies &b, double e2, int ib, int ie, int jb, int je, double *ax, double *ay, double *az)
+{
+	const double *x = &b.x[0];
+	const double *y = &b.y[0];
+	const double *z = &b.z[0];
+	const double *m = &b.m[0];
+	for(int i = ib; i < ie; ++i) {
+		double xi = x[i], yi = y[i], zi = z[i], mi = m[i];
+		double sx = 0.0, sy = 0.0, sz = 0.0;
+		for(int j = (ib == jb ? i + 1 : jb); j < je; ++j) {
+			double dx = x[j] - xi;
+			double dy = y[j] - yi;
+			double dz = z[j] - zi;
+			double inv = 1.0 / sqrt(dx*dx + dy*dy + dz*dz + e2);
+			double s = inv * inv * inv;
+			double sj = m[j] * s;
+			double si = mi * s;
+			sx += sj * dx;
+			sy += sj * dy;
+			sz += sj * dz;
+			ax[j] -= si * dx;
+			ay[j] -= si * dy;
+			az[j] -= si * dz;
+		}
+		ax[i] += sx;
+		ay[i] += sy;
+		az[i] += sz;
+	}
+}
+
+#ifdef GRAVITY_AVX2
+
+__attribute__((target("avx2,fma")))
+static inline double horizontalSum(__m256d v)
+{
+	__m128d lo = _mm_add_pd(_mm256_castpd256_pd128(v), _mm256_extractf128_pd(v, 1));
+	return _mm_cvtsd_f64(_mm_add_sd(lo, _mm_unpackhi_pd(lo, lo)));
+}
+
+__attribute__((target("avx2,fma")))
+static void directAccelerationsAVX2(const Bodies &b, double e2, int begin, int end, double *ax, double *ay, double *az)
+{
+	int n = b.size();
+	int n4 = n & ~3;
+	const double *x = &b.x[0];
+	const double *y = &b.y[0];
+	const double *z = &b.z[0];
+	const double *m = &b.m[0];
+	const __m256d zero = _mm256_setzero_pd();
+	const __m256d half = _mm256_set1_pd(0.5);
+	const __m256d three_halves = _mm256_set1_pd(1.5);
+	const __m256d ve2 = _mm256_set1_pd(e2);
+	for(int i = begin; i < end; ++i) {
+		__m256d xi = _mm256_set1_pd(x[i]);
+		__m256d yi = _mm256_set1_pd(y[i]);
+		__m256d zi = _mm256_set1_pd(z[i]);
+		__m256d sx = zero, sy = zero, sz = zero;
+		for(int j = 0; j < n4; j += 4) {
+			__m256d dx = _mm256_sub_pd(_mm256_loadu_pd(x + j), xi);
+			__m256d dy = _mm256_sub_pd(_mm256_loadu_pd(y + j), yi);
+			__m256d dz = _mm256_sub_pd(_mm256_loadu_pd(z + j), zi);
+			__m256d d2 = _mm256_fmadd_pd(dx, dx, _mm256_fmadd_pd(dy, dy, _mm256_mul_pd(dz, dz)));
+			__m256d r2 = _mm256_add_pd(d2, ve2);
+			// 12 bit estimate, then each Newton step y *= 1.5 - r2/2 y^2
+			// doubles the number of good bits
+			__m256d inv = _mm256_cvtps_pd(_mm_rsqrt_ps(_mm256_cvtpd_ps(r2)));
+			__m256d hr2 = _mm256_mul_pd(half, r2);
+			inv = _mm256_mul_pd(inv, _mm256_fnmadd_pd(hr2, _mm256_mul_pd(inv, inv), three_halves));
+			inv = _mm256_mul_pd(inv, _mm256_fnmadd_pd(hr2, _mm256_mul_pd(inv, inv), three_halves));
+			__m256d s = _mm256_mul_pd(_mm256_loadu_pd(m + j), _mm256_mul_pd(inv, _mm256_mul_pd(inv, inv)));
+			// Nothing from body i itself (or from one right on top of it
+			// when e2 is 0, which would be infinite)
+			s = _mm256_andnot_pd(_mm256_cmp_pd(d2, zero, _CMP_EQ_OQ), s);
+			sx = _mm256_fmadd_pd(s, dx, sx);
+			sy = _mm256_fmadd_pd(s, dy, sy);
+			sz = _mm256_fmadd_pd(s, dz, sz);
+		}
+		double tx = horizontalSum(sx);
+		double ty = horizontalSum(sy);
+		double tz = horizontalSum(sz);
+		for(int j = n4; j < n; ++j) {
+			if(j == i) {
+				continue;
+			}
+			double dx = x[j] - x[i];
+			double dy = y[j] - y[i];
+			double dz = z[j] - z[i];
+			double inv = 1.0 / sqrt(dx*dx + dy*dy + dz*dz + e2);
+			double s = m[j] * inv * inv * inv;
+			tx += s * dx;
+			ty += s * dy;
+			tz += s * dz;
+		}
+		ax[i - begin] = tx;
+		ay[i - begin] = ty;
+		az[i - begin] = tz;
+	}
+}
+
+__attribute__((target("avx2,fma")))
+static void tileAVX2(const Bodies &b, double e2, int ib, int ie, int jb, int je, double *ax, double *ay, double *az)
+{
+	const double *x = &b.x[0];
+	const double *y = &b.y[0];
+	const double *z = &b.z[0];
+	const double *m = &b.m[0];
+	const __m256d zero = _mm256_setzero_pd();
+	const __m256d half = _mm256_set1_pd(0.5);
+	const __m256d three_halves = _mm256_set1_pd(1.5);
+	const __m256d ve2 = _mm256_set1_pd(e2);
+	for(int i = ib; i < ie; ++i) {
+		__m256d xi = _mm256_set1_pd(x[i]);
+		__m256d yi = _mm256_set1_pd(y[i]);
+		__m256d zi = _mm256_set1_pd(z[i]);
+		__m256d mi = _mm256_set1_pd(m[i]);
+		__m256d sx = zero, sy = zero, sz = zero;
+		int j = (ib == jb ? i + 1 : jb);
+		for(; j + 4 <= je; j += 4) {
+			__m256d dx = _mm256_sub_pd(_mm256_loadu_pd(x + j), xi);
+			__m256d dy = _mm256_sub_pd(_mm256_loadu_pd(y + j), yi);
+			__m256d dz = _mm256_sub_pd(_mm256_loadu_pd(z + j), zi);
+			__m256d r2 = _mm256_add_pd(_mm256_fmadd_pd(dx, dx, _mm256_fmadd_pd(dy, dy, _mm256_mul_pd(dz, dz))), ve2);
+			__m256d inv = _mm256_cvtps_pd(_mm_rsqrt_ps(_mm256_cvtpd_ps(r2)));
+			__m256d hr2 = _mm256_mul_pd(half, r2);
+			inv = _mm256_mul_pd(inv, _mm256_fnmadd_pd(hr2, _mm256_mul_pd(inv, inv), three_halves));
+			inv = _mm256_mul_pd(inv, _mm256_fnmadd_pd(hr2, _mm256_mul_pd(inv, inv), three_halves));
+			__m256d s = _mm256_mul_pd(inv, _mm256_mul_pd(inv, inv));
+			__m256d sj = _mm256_mul_pd(_mm256_loadu_pd(m + j), s);
+			__m256d si = _mm256_mul_pd(mi, s);
+			sx = _mm256_fmadd_pd(sj, dx, sx);
+			sy = _mm256_fmadd_pd(sj, dy, sy);
+			sz = _mm256_fmadd_pd(sj, dz, sz);
+			_mm256_storeu_pd(ax + j, _mm256_fnmadd_pd(si, dx, _mm256_loadu_pd(ax + j)));
+			_mm256_storeu_pd(ay + j, _mm256_fnmadd_pd(si, dy, _mm256_loadu_pd(ay + j)));
+			_mm256_storeu_pd(az + j, _mm256_fnmadd_pd(si, dz, _mm256_loadu_pd(az + j)));
+		}
+		double tx = horizontalSum(sx);
+		double ty = horizontalSum(sy);
+		double tz = horizontalSum(sz);
+		for(; j < je; ++j) {
+			double dx = x[j] - x[i];
+			double dy = y[j] - y[i];
+			double dz = z[j] - z[i];
+			double inv = 1.0 / sqrt(dx*dx + dy*dy + dz*dz + e2);
+			double s = inv * inv * inv;
+			tx += m[j] * s * dx;
+			ty += m[j] * s * dy;
+			tz += m[j] * s * dz;
+			ax[j] -= m[i] * s * dx;
+			ay[j] -= m[i] * s * dy;
+			az[j] -= m[i] * s * dz;
+		}
+		ax[i] += tx;
+		ay[i] += ty;
+		az[i] += tz;
+	}
+}
+
+__attribute__((target("avx2,fma")))
+static void pairAccelerationsAVX2(const double *x, const double *y, const double *z, const double *m, double e2,
+                                  int ib, int ie, int jb, int je, double *ax, double *ay, double *az)
+{
+	const __m256d zero = _mm256_setzero_pd();
+	const __m256d half = _mm256_set1_pd(0.5);
+	const __m256d three_halves = _mm256_set1_pd(1.5);
+	const __m256d ve2 = _mm256_set1_pd(e2);
+	for(int i = ib; i < ie; ++i) {
+		__m256d xi = _mm256_set1_pd(x[i]);
+		__m256d yi = _mm256_set1_pd(y[i]);
+		__m256d zi = _mm256_set1_pd(z[i]);
+		__m256d sx = zero, sy = zero, sz = zero;
+		int j = jb;
+		for(; j + 4 <= je; j += 4) {
+			__m256d dx = _mm256_sub_pd(_mm256_loadu_pd(x + j), xi);
+			__m256d dy = _mm256_sub_pd(_mm256_loadu_pd(y + j), yi);
+			__m256d dz = _mm256_sub_pd(_mm256_loadu_pd(z + j), zi);
+			__m256d d2 = _mm256_fmadd_pd(dx, dx, _mm256_fmadd_pd(dy, dy, _mm256_mul_pd(dz, dz)));
+			__m256d r2 = _mm256_add_pd(d2, ve2);
+			__m256d inv = _mm256_cvtps_pd(_mm_rsqrt_ps(_mm256_cvtpd_ps(r2)));
+			__m256d hr2 = _mm256_mul_pd(half, r2);
+			inv = _mm256_mul_pd(inv, _mm256_fnmadd_pd(hr2, _mm256_mul_pd(inv, inv), three_halves));
+			inv = _mm256_mul_pd(inv, _mm256_fnmadd_pd(hr2, _mm256_mul_pd(inv, inv), three_halves));
+			__m256d s = _mm256_mul_pd(_mm256_loadu_pd(m + j), _mm256_mul_pd(inv, _mm256_mul_pd(inv, inv)));
+			s = _mm256_andnot_pd(_mm256_cmp_pd(d2, zero, _CMP_EQ_OQ), s);
+			sx = _mm256_fmadd_pd(s, dx, sx);
+			sy = _mm256_fmadd_pd(s, dy, sy);
+			sz = _mm256_fmadd_pd(s, dz, sz);
+		}
+		double tx = horizontalSum(sx);
+		double ty = horizontalSum(sy);
+		double tz = horizontalSum(sz);
+		for(; j < je; ++j) {
+			if(j == i) {
+				continue;
+			}
+			double dx = x[j] - x[i];
+			double dy = y[j] - y[i];
+			double dz = z[j] - z[i];
+			double inv = 1.0 / sqrt(dx*dx + dy*dy + dz*dz + e2);
+			double s = m[j] * inv * inv * inv;
+			tx += s * dx;
+			ty += s * dy;
+			tz += s * dz;
+		}
+		ax[i] += tx;
+		ay[i] += ty;
+		az[i] += tz;
+	}
+}
+
+bool haveAVX2()
+{
+	static bool have = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+	return have;
+}
+
+#else
+
+bool haveAVX2()
+{
+	return false;
+}
+
+#endif
+
+void directAccelerationsSIMD(const Bodies &b, double e2, int begin, int end, double *ax, double *ay, double *az)
+{
+#ifdef GRAVITY_AVX2
+	if(haveAVX2() && begin < end) {
+		directAccelerationsAVX2(b, e2, begin, end, ax, ay, az);
+		return;
+	}
+#endif
+	directAccelerationsScalar(b, e2, begin, end, ax, ay, az);
+}
+
+double potentialEnergy(const Bodies &b, double e2, ThreadPool *pool)
+{
+	int n = b.size();
+	const double *x = &b.x[0];
+	const double *y = &b.y[0];
+	const double *z = &b.z[0];
+	const double *m = &b.m[0];
+	int num_threads = pool ? pool->getNumThreads() : 1;
+	vector<double> sums(num_threads, 0.0);
+	auto rows = [&](int begin, int end, int thread) {
+		double sum = 0.0;
+		for(int i = begin; i < end; ++i) {
+			double row = 0.0;
+			for(int j = i + 1; j < n; ++j) {
+				double dx = x[j] - x[i];
+				double dy = y[j] - y[i];
+				double dz = z[j] - z[i];
+				row += m[j] / sqrt(dx*dx + dy*dy + dz*dz + e2);
+			}
+			sum -= m[i] * row;
+		}
+		sums[thread] += sum;
+	};
+	// Rows get shorter, so small chunks
+	ThreadPool::forRange(pool, n, 64, rows);
+	double total = 0.0;
+	for(double s : sums) {
+		total += s;
+	}
+	return total;
+}
+
+void pairAccelerations(const double *x, const double *y, const double *z, const double *m, double e2,
+                       int ib, int ie, int jb, int je, double *ax, double *ay, double *az)
+{
+#ifdef GRAVITY_AVX2
+	if(haveAVX2()) {
+		pairAccelerationsAVX2(x, y, z, m, e2, ib, ie, jb, je, ax, ay, az);
+		return;
+	}
+#endif
+	for(int i = ib; i < ie; ++i) {
+		double tx = 0.0, ty = 0.0, tz = 0.0;
+		for(int j = jb; j < je; ++j) {
+			if(j == i) {
+				continue;
+			}
+			double dx = x[j] - x[i];
+			double dy = y[j] - y[i];
+			double dz = z[j] - z[i];
+			double inv = 1.0 / sqrt(dx*dx + dy*dy + dz*dz + e2);
+			double s = m[j] * inv * inv * inv;
+			tx += s * dx;
+			ty += s * dy;
+			tz += s * dz;
+		}
+		ax[i] += tx;
+		ay[i] += ty;
+		az[i] += tz;
+	}
+}
+
+DirectSum::DirectSum() :
+	simd(true),
+	symmetric(true)
+{
+}
+
+DirectSum::~DirectSum()
+{
+}
+
+void DirectSum::computeAccelerations(const Bodies &b, double e2, double *ax, double *ay, double *az, ThreadPool *pool)
+{
+	int n = b.size();
+	if(!symmetric) {
+		auto rows = [&](int begin, int end, int thread) {
+			if(simd) {
+				directAccelerationsSIMD(b, e2, begin, end, ax + begin, ay + begin, az + begin);
+			} else {
+				directAccelerationsScalar(b, e2, begin, end, ax + begin, ay + begin, az + begin);
+			}
+		};
+		ThreadPool::forRange(pool, n, 0, rows);
+		return;
+	}
+
+	// The tiles of the upper triangle, row by row, so a thread's run of
+	// tiles keeps reusing the same i block
+	int num_blocks = (n + BLOCK_SIZE - 1) / BLOCK_SIZE;
+	vector< pair<int, int> > tiles;
+	for(int I = 0; I < num_blocks; ++I) {
+		for(int J = I; J < num_blocks; ++J) {
+			tiles.push_back(make_pair(I, J));
+		}
+	}
+	bool use_avx2 = simd && haveAVX2();
+	auto doTiles = [&](int begin, int end, double *tx, double *ty, double *tz) {
+		for(int k = begin; k < end; ++k) {
+			int ib = tiles[k].first * BLOCK_SIZE;
+			int jb = tiles[k].second * BLOCK_SIZE;
+			int ie = min(n, ib + BLOCK_SIZE);
+			int je = min(n, jb + BLOCK_SIZE);
+#ifdef GRAVITY_AVX2
+			if(use_avx2) {
+				tileAVX2(b, e2, ib, ie, jb, je, tx, ty, tz);
+				continue;
+			}
+#endif
+			tileScalar(b, e2, ib, ie, jb, je, tx, ty, tz);
+		}
+	};
+
+	int T = pool ? pool->getNumThreads() : 1;
+	if(T == 1) {
+		fill(ax, ax + n, 0.0);
+		fill(ay, ay + n, 0.0);
+		fill(az, az + n, 0.0);
+		doTiles(0, (int)tiles.size(), ax, ay, az);
+		return;
+	}
+
+	if((int)buffers.size() != T || (int)buffers[0].size() != 3 * n) {
+		buffers.assign(T, vector<double>(3 * n, 0.0));
+	}
+	// The split of the tiles only depends on the thread count, so the result
+	// is the same every time for a given number of threads
+	pool->parallelFor((int)tiles.size(), [&](int begin, int end, int thread) {
+		double *buf = &buffers[thread][0];
+		doTiles(begin, end, buf, buf + n, buf + 2 * n);
+	});
+	// Sum the threads' accelerations, and zero them for next time
+	pool->parallelFor(n, [&](int begin, int end, int thread) {
+		for(int i = begin; i < end; ++i) {
+			double sx = 0.0, sy = 0.0, sz = 0.0;
+			for(int t = 0; t < T; ++t) {
+				double *buf = &buffers[t][0];
+				sx += buf[i];
+				sy += buf[n + i];
+				sz += buf[2 * n + i];
+				buf[i] = buf[n + i] = buf[2 * n + i] = 0.0;
+			}
+			ax[i] = sx;
+			ay[i] = sy;
+			az[i] = sz;
+		}
+	});
+}
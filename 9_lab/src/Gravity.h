@@ -0,0 +1,73 @@
+#pragma once
+#ifndef _GRAVITY_H_
+#define _GRAVITY_H_
+
+#include <vector>
+
+struct Bodies;
+class ThreadPool;
+
+// Direct-sum gravity kernels, for G = 1. Each one sets
+//    a[i] = sum_j m_j (x_j - x_i) / (|x_j - x_i|^2 + e2)^(3/2)
+// for the bodies i in [begin, end), summing over all the other bodies, and
+// writes it to ax[i - begin], ay[i - begin], az[i - begin]. Different ranges
+// can be done on different threads.
+
+// Plain C++, one pair at a time.
+void directAccelerationsScalar(const Bodies &b, double e2, int begin, int end, double *ax, double *ay, double *az);
+
+// Four pairs at a time with AVX2. 1/sqrt comes from the single precision
+// rsqrt estimate and two Newton steps in double, which is about as accurate
+// as sqrt. Falls back to the scalar kernel if the CPU doesn't have AVX2.
+void directAccelerationsSIMD(const Bodies &b, double e2, int begin, int end, double *ax, double *ay, double *az);
+
+// Adds the pull of bodies [jb, je) on each body i in [ib, ie) to ax[i],
+// ay[i] and az[i], for bodies kept in plain x, y, z and m arrays (the two
+// ranges may be the same; a body doesn't pull on itself). AVX2 when the CPU
+// has it. For the near field of the tree codes.
+void pairAccelerations(const double *x, const double *y, const double *z, const double *m, double e2,
+                       int ib, int ie, int jb, int je, double *ax, double *ay, double *az);
+
+// Total potential energy for G = 1,
+//    -sum over pairs i < j of m_i m_j / sqrt(|x_j - x_i|^2 + e2)
+// by direct sum, for checking energy conservation.
+double potentialEnergy(const Bodies &b, double e2, ThreadPool *pool = 0);
+
+// Whether directAccelerationsSIMD() really uses AVX2 on this machine
+bool haveAVX2();
+
+// Direct sum for the whole system. By default it is symmetric: each
+// unordered pair is only visited once, and its force goes to both bodies
+// with opposite signs (Newton's third law), which halves the work.
+//
+// The bodies are cut into blocks small enough that two of them stay in L1,
+// and the work is done one pair of blocks (a tile) at a time. With a pool,
+// each thread adds into its own set of acceleration arrays and they are
+// summed at the end, so threads never write to the same memory.
+class DirectSum
+{
+public:
+	DirectSum();
+	virtual ~DirectSum();
+
+	// AVX2 kernels, when the CPU has them
+	void setSIMD(bool simd) { this->simd = simd; }
+	bool getSIMD() const { return simd; }
+	// Off means every body sums over all the others on its own (twice the
+	// pairs, but each body's sum is done in the same order on any number of
+	// threads)
+	void setSymmetric(bool symmetric) { this->symmetric = symmetric; }
+	bool getSymmetric() const { return symmetric; }
+
+	// Same accelerations as the kernels above, for all the bodies
+	void computeAccelerations(const Bodies &b, double e2, double *ax, double *ay, double *az, ThreadPool *pool = 0);
+
+private:
+	bool simd;
+	bool symmetric;
+	// Per-thread accumulators, 3n each (ax, then ay, then az). Kept zeroed
+	// between calls.
+	std::vector< std::vector<double> > buffers;
+};
+
+#endif
@@ -0,0 +1,173 @@
+#include "Integrator.h"
+#include "Bodies.h"
+#include "ThreadPool.h"
+
+#include <cmath>
+#include <algorithm>
+
+using namespace std;
+
+Integrator::Integrator() :
+	scheme(EULER),
+	maxLevel(6),
+	eta(0.02),
+	haveAccelerations(false),
+	numForces(0)
+{
+}
+
+Integrator::~Integrator()
+{
+}
+
+void Integrator::setScheme(Scheme scheme)
+{
+	this->scheme = scheme;
+	haveAccelerations = false;
+}
+
+void Integrator::restore(bool haveAccelerations, const vector<int> &level)
+{
+	this->haveAccelerations = haveAccelerations;
+	this->level = level;
+}
+
+vector<int> Integrator::getLevelCounts() const
+{
+	vector<int> counts(maxLevel + 1, 0);
+	for(int l : level) {
+		counts[min(l, maxLevel)]++;
+	}
+	return counts;
+}
+
+void Integrator::computeAll(Bodies &b, const ForceFunction &forces)
+{
+	numForces += forces(0);
+	haveAccelerations = true;
+}
+
+int Integrator::levelFor(const Bodies &b, int i, double h, double e2) const
+{
+	double a = sqrt(b.ax[i] * b.ax[i] + b.ay[i] * b.ay[i] + b.az[i] * b.az[i]);
+	if(e2 <= 0.0 || a <= 0.0) {
+		// Without softening there is no length scale to go by
+		return 0;
+	}
+	double dt = eta * sqrt(sqrt(e2) / a);
+	int l = 0;
+	while(l < maxLevel && h / (1 << l) > dt) {
+		l++;
+	}
+	return l;
+}
+
+void Integrator::kick(Bodies &b, const vector<int> &bodies, double dt, ThreadPool *pool)
+{
+	// Bodies on level l kick with dt / 2^l
+	auto work = [&](int begin, int end, int thread) {
+		for(int k = begin; k < end; ++k) {
+			int i = bodies[k];
+			double dti = dt / (1 << level[i]);
+			b.vx[i] += dti * b.ax[i];
+			b.vy[i] += dti * b.ay[i];
+			b.vz[i] += dti * b.az[i];
+		}
+	};
+	ThreadPool::forRange(pool, (int)bodies.size(), 0, work);
+}
+
+void Integrator::drift(Bodies &b, double dt, ThreadPool *pool)
+{
+	auto work = [&](int begin, int end, int thread) {
+		for(int i = begin; i < end; ++i) {
+			b.x[i] += dt * b.vx[i];
+			b.y[i] += dt * b.vy[i];
+			b.z[i] += dt * b.vz[i];
+		}
+	};
+	ThreadPool::forRange(pool, b.size(), 0, work);
+}
+
+void Integrator::step(Bodies &b, double h, double e2, const ForceFunction &forces, ThreadPool *pool)
+{
+	int n = b.size();
+	if(n == 0) {
+		return;
+	}
+	if(scheme == BLOCK) {
+		stepBlock(b, h, e2, forces, pool);
+		return;
+	}
+	// Everybody on level 0
+	level.assign(n, 0);
+	active.resize(n);
+	for(int i = 0; i < n; ++i) {
+		active[i] = i;
+	}
+	if(scheme == EULER) {
+		computeAll(b, forces);
+		kick(b, active, h, pool);
+		drift(b, h, pool);
+		haveAccelerations = false;
+	} else {
+		if(!haveAccelerations) {
+			computeAll(b, forces);
+		}
+		kick(b, active, 0.5 * h, pool);
+		drift(b, h, pool);
+		computeAll(b, forces);
+		kick(b, active, 0.5 * h, pool);
+	}
+}
+
+void Integrator::stepBlock(Bodies &b, double h, double e2, const ForceFunction &forces, ThreadPool *pool)
+{
+	int n = b.size();
+	if(!haveAccelerations || (int)level.size() != n) {
+		computeAll(b, forces);
+		level.resize(n);
+		for(int i = 0; i < n; ++i) {
+			level[i] = levelFor(b, i, h, e2);
+		}
+	}
+	int ticks = 1 << maxLevel;
+	double tick = h / ticks;
+	for(int s = 0; s < ticks; ++s) {
+		// Opening half kicks for the bodies whose steps start now
+		active.clear();
+		for(int i = 0; i < n; ++i) {
+			if(s % (1 << (maxLevel - level[i])) == 0) {
+				active.push_back(i);
+			}
+		}
+		kick(b, active, 0.5 * h, pool);
+
+		drift(b, tick, pool);
+
+		// New accelerations and closing half kicks for the ones whose steps
+		// end now
+		active.clear();
+		for(int i = 0; i < n; ++i) {
+			if((s + 1) % (1 << (maxLevel - level[i])) == 0) {
+				active.push_back(i);
+			}
+		}
+		// Most ticks end nobody's step
+		if(active.empty()) {
+			continue;
+		}
+		numForces += forces((int)active.size() == n ? 0 : &active);
+		kick(b, active, 0.5 * h, pool);
+
+		// Smaller steps any time, a bigger step only where it would end too
+		for(int i : active) {
+			int l = levelFor(b, i, h, e2);
+			if(l > level[i]) {
+				level[i] = l;
+			} else if(l < level[i] && (s + 1) % (1 << (maxLevel - level[i] + 1)) == 0) {
+				level[i]--;
+			}
+		}
+	}
+}
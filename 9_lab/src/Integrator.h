@@ -0,0 +1,91 @@
+#pragma once
+#ifndef _INTEGRATOR_H_
+#define _INTEGRATOR_H_
+
+#include <vector>
+#include <functional>
+
+class ThreadPool;
+struct Bodies;
+
+// Moves the bodies forward in time, given a way to compute accelerations.
+//
+// EULER is semi-implicit Euler (kick, then drift), first order.
+//
+// LEAPFROG is kick-drift-kick leapfrog (velocity Verlet): half a kick with
+// the old accelerations, a full drift, new accelerations, and the other
+// half kick. Second order and symplectic, for the same one force
+// calculation per step, since the accelerations are kept for the next step.
+//
+// BLOCK is leapfrog with hierarchical block time steps: body i steps with
+// h / 2^level[i], where the level comes from its acceleration,
+//    dt_i = eta * sqrt(softening / |a_i|),
+// so bodies on tight orbits take many small steps while the rest take few
+// big ones. Each step h is 2^maxLevel ticks. On every tick all the bodies
+// drift, but only the ones whose own step ends there get new accelerations
+// and kicks. A body can move to a smaller step whenever its step ends, and
+// to a bigger one when the bigger step would end there too. After step()
+// every body is at the same time again.
+class Integrator
+{
+public:
+	enum Scheme
+	{
+		EULER,
+		LEAPFROG,
+		BLOCK
+	};
+
+	// Must set b.ax, b.ay and b.az for G = 1 for the bodies in `active`, or
+	// for all of them when it is null. The others may be changed too.
+	// Returns how many bodies it really computed, which for solvers that
+	// always do everything is all of them.
+	typedef std::function<int(const std::vector<int> *active)> ForceFunction;
+
+	Integrator();
+	virtual ~Integrator();
+
+	void setScheme(Scheme scheme);
+	Scheme getScheme() const { return scheme; }
+	// Smallest block step is h / 2^maxLevel
+	void setMaxLevel(int maxLevel) { this->maxLevel = maxLevel; }
+	int getMaxLevel() const { return maxLevel; }
+	void setEta(double eta) { this->eta = eta; }
+	double getEta() const { return eta; }
+
+	// Advances the bodies by h
+	void step(Bodies &b, double h, double e2, const ForceFunction &forces, ThreadPool *pool = 0);
+	// Call when the bodies were changed outside of step(), so that the kept
+	// accelerations aren't used
+	void reset() { haveAccelerations = false; }
+
+	// What a snapshot needs to carry on exactly: whether b.ax etc. are for
+	// the current positions, and the block step levels
+	bool hasAccelerations() const { return haveAccelerations; }
+	const std::vector<int> &getLevels() const { return level; }
+	void restore(bool haveAccelerations, const std::vector<int> &level);
+
+	// Accelerations of single bodies computed so far, as the force function
+	// counted them
+	long long getNumForces() const { return numForces; }
+	// Bodies on each level after the last step (BLOCK only)
+	std::vector<int> getLevelCounts() const;
+
+private:
+	void computeAll(Bodies &b, const ForceFunction &forces);
+	int levelFor(const Bodies &b, int i, double h, double e2) const;
+	void kick(Bodies &b, const std::vector<int> &bodies, double h, ThreadPool *pool);
+	void drift(Bodies &b, double dt, ThreadPool *pool);
+	void stepBlock(Bodies &b, double h, double e2, const ForceFunction &forces, ThreadPool *pool);
+
+	Scheme scheme;
+	int maxLevel;
+	double eta;
+	// Whether b.ax etc. are for the current positions
+	bool haveAccelerations;
+	std::vector<int> level;
+	std::vector<int> active;
+	long long numForces;
+};
+
+#endif
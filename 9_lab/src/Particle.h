@@ -9,59 +9,33 @@
 #include <cmath>
 #include <limits>
 
-#define GLEW_STATIC
-#include <GL/glew.h>
-
 #define EIGEN_DONT_ALIGN_STATICALLY
 #include <Eigen/Dense>
 
 double randRange(double l, double h);
 double generateGaussianNoise(double mu, double sigma);
 
-class MatrixStack;
-class Program;
-class Texture;
+#include "Bodies.h"
 
+// One body of the simulation. The state itself lives in Bodies; a Particle
+// just knows which body it is. Drawing is done by ParticleRenderer.
 class Particle
 {
 public:
-	Particle();
+	Particle(const Bodies *bodies, int index);
 	virtual ~Particle();
 
-	// OpenGL methods
-	void init();
-	void draw(std::shared_ptr<Program> prog, std::shared_ptr<MatrixStack> MV) const;
-	
 	// Getters
-	double getMass() const { return m; }
-	const Eigen::Vector3d& getPosition() const { return x; }
-	const Eigen::Vector3d& getVelocity() const { return v; }
-	Eigen::Vector3f getColor() const { return color.segment<3>(0); }
-	float getRadius() const { return radius; }
-	
-	// Setters
-	void setMass(double m) { this->m = m; }
-	void setPosition(const Eigen::Vector3d x) { this->x = x; }
-	void setVelocity(const Eigen::Vector3d v) { this->v = v; }
-	void setColor(const Eigen::Vector3f &c) { color.segment<3>(0) = c; }
-	void setRadius(float r) { radius = r; }
+	int getIndex() const { return index; }
+	double getMass() const { return bodies->m[index]; }
+	Eigen::Vector3d getPosition() const { return bodies->getPosition(index); }
+	Eigen::Vector3d getVelocity() const { return bodies->getVelocity(index); }
+	Eigen::Vector3f getColor() const { return bodies->color[index]; }
+	float getRadius() const { return bodies->radius[index]; }
 	
 private:
-	// For physics
-	double m; // mass
-	Eigen::Vector3d x; // position
-	Eigen::Vector3d v; // velocity
-	Eigen::Vector3d a; // aceleration (force/mass)
-	
-	// For display only
-	float radius;
-	Eigen::Vector4f color;
-	std::vector<float> posBuf;
-	std::vector<float> texBuf;
-	std::vector<unsigned int> indBuf;
-	GLuint posBufID;
-	GLuint texBufID;
-	GLuint indBufID;
+	const Bodies *bodies;
+	int index;
 };
 
 #endif
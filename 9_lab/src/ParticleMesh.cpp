@@ -0,0 +1,257 @@
+#include "ParticleMesh.h"
+#include "Bodies.h"
+#include "ThreadPool.h"
+#include "Timer.h"
+
+#include <cmath>
+#include <chrono>
+#include <algorithm>
+#include <functional>
+
+using namespace std;
+using namespace Eigen;
+
+ParticleMesh::ParticleMesh() :
+	gridSize(64),
+	padding(true),
+	size(128),
+	origin(0.0, 0.0, 0.0),
+	cellSize(0.0),
+	depositSeconds(0.0),
+	fftSeconds(0.0),
+	interpolateSeconds(0.0)
+{
+	fill(greenKey, greenKey + 4, -1.0);
+}
+
+ParticleMesh::~ParticleMesh()
+{
+}
+
+void ParticleMesh::setGridSize(int g)
+{
+	gridSize = 4;
+	while(gridSize < g) {
+		gridSize *= 2;
+	}
+	size = padding ? 2 * gridSize : gridSize;
+	cellSize = 0.0;
+}
+
+void ParticleMesh::setPadding(bool padding)
+{
+	this->padding = padding;
+	setGridSize(gridSize);
+}
+
+void ParticleMesh::placeGrid(const Bodies &b)
+{
+	int n = b.size();
+	Vector3d xmin = b.getPosition(0);
+	Vector3d xmax = xmin;
+	for(int i = 1; i < n; ++i) {
+		Vector3d x = b.getPosition(i);
+		xmin = xmin.cwiseMin(x);
+		xmax = xmax.cwiseMax(x);
+	}
+	double extent = (xmax - xmin).maxCoeff();
+	if(extent <= 0.0) {
+		extent = 1.0;
+	}
+	// With padding the bodies stay a cell away from the edges of the
+	// gridSize^3 part of the grid, so that the gradients next to them only
+	// use nodes where the convolution is right. Periodic grids wrap.
+	int cells = padding ? gridSize - 2 : gridSize;
+	if(cellSize > 0.0) {
+		Vector3d lo = (xmin - origin) / cellSize;
+		Vector3d hi = (xmax - origin) / cellSize;
+		bool inside = lo.minCoeff() >= (padding ? 0.5 : 0.0) && hi.maxCoeff() <= cells + (padding ? 0.5 : 0.0);
+		if(inside && extent > 0.5 * cells * cellSize) {
+			return;
+		}
+	}
+	if(padding) {
+		// Some room to move before the grid has to be placed again
+		cellSize = 1.25 * extent / cells;
+		origin = 0.5 * (xmin + xmax) - Vector3d::Constant(0.5 * (gridSize - 1) * cellSize);
+	} else {
+		cellSize = extent / cells * (1.0 + 1e-9);
+		origin = xmin;
+	}
+}
+
+void ParticleMesh::buildGreen(double e2, ThreadPool *pool)
+{
+	double key[4] = {(double)size, cellSize, e2, padding ? 1.0 : 0.0};
+	if(equal(key, key + 4, greenKey)) {
+		return;
+	}
+	copy(key, key + 4, greenKey);
+	int half = size / 2;
+	int h1 = half + 1;
+	green.resize((size_t)h1 * h1 * h1);
+	double scale = 1.0 / ((double)size * size * size);
+	double h = cellSize;
+	if(padding) {
+		// Sampled in real space, with distances wrapped around the doubled
+		// grid, and transformed
+		ThreadPool::forRange(pool, size, 1, [&](int begin, int end, int thread) {
+			for(int k = begin; k < end; ++k) {
+				int dk = min(k, size - k);
+				for(int j = 0; j < size; ++j) {
+					int dj = min(j, size - j);
+					for(int i = 0; i < size; ++i) {
+						int di = min(i, size - i);
+						double r2 = h * h * (di * di + dj * dj + dk * dk) + e2;
+						// The value at 0 doesn't change any gradient
+						grid[index(i, j, k)] = r2 > 0.0 ? -1.0 / sqrt(r2) : -1.0 / h;
+					}
+				}
+			}
+		});
+		fft.transform(&grid[0], false, pool);
+		for(int k = 0; k <= half; ++k) {
+			for(int j = 0; j <= half; ++j) {
+				for(int i = 0; i <= half; ++i) {
+					green[((size_t)k * h1 + j) * h1 + i] = grid[index(i, j, k)].real() * scale;
+				}
+			}
+		}
+	} else {
+		// -4 pi / k^2, with the k^2 of the discrete Laplacian, and no k = 0
+		// term (the mean density is taken out)
+		for(int k = 0; k <= half; ++k) {
+			double sk = sin(M_PI * k / size);
+			for(int j = 0; j <= half; ++j) {
+				double sj = sin(M_PI * j / size);
+				for(int i = 0; i <= half; ++i) {
+					double si = sin(M_PI * i / size);
+					double s2 = si * si + sj * sj + sk * sk;
+					green[((size_t)k * h1 + j) * h1 + i] = s2 > 0.0 ? -M_PI / (h * s2) * scale : 0.0;
+				}
+			}
+		}
+	}
+}
+
+void ParticleMesh::deposit(const Bodies &b, ThreadPool *pool)
+{
+	int n = b.size();
+	int mask = size - 1;
+	ThreadPool::forRange(pool, size, 1, [&](int begin, int end, int thread) {
+		fill(grid.begin() + index(0, 0, begin), grid.begin() + index(0, 0, end), complex<double>(0.0, 0.0));
+	});
+
+	// Counting sort by plane
+	planeStart.assign(size + 1, 0);
+	planeOrder.resize(n);
+	vector<int> plane(n);
+	for(int i = 0; i < n; ++i) {
+		plane[i] = (int)floor((b.z[i] - origin(2)) / cellSize) & mask;
+		planeStart[plane[i] + 1]++;
+	}
+	for(int k = 0; k < size; ++k) {
+		planeStart[k+1] += planeStart[k];
+	}
+	vector<int> next(planeStart.begin(), planeStart.end() - 1);
+	for(int i = 0; i < n; ++i) {
+		planeOrder[next[plane[i]]++] = i;
+	}
+
+	// A body in plane k writes to planes k and k + 1, so all the even planes
+	// can go at once, and then all the odd ones
+	for(int parity = 0; parity < 2; ++parity) {
+		ThreadPool::forRange(pool, size / 2, 1, [&](int begin, int end, int thread) {
+			for(int p = begin; p < end; ++p) {
+				int k = 2 * p + parity;
+				for(int s = planeStart[k]; s < planeStart[k+1]; ++s) {
+					int i = planeOrder[s];
+					Vector3d u = (b.getPosition(i) - origin) / cellSize;
+					Vector3d f(floor(u(0)), floor(u(1)), floor(u(2)));
+					Vector3d w = u - f;
+					int x0 = (int)f(0) & mask, y0 = (int)f(1) & mask, z0 = (int)f(2) & mask;
+					int x1 = (x0 + 1) & mask, y1 = (y0 + 1) & mask, z1 = (z0 + 1) & mask;
+					double m = b.m[i];
+					grid[index(x0, y0, z0)] += m * (1 - w(0)) * (1 - w(1)) * (1 - w(2));
+					grid[index(x1, y0, z0)] += m * w(0) * (1 - w(1)) * (1 - w(2));
+					grid[index(x0, y1, z0)] += m * (1 - w(0)) * w(1) * (1 - w(2));
+					grid[index(x1, y1, z0)] += m * w(0) * w(1) * (1 - w(2));
+					grid[index(x0, y0, z1)] += m * (1 - w(0)) * (1 - w(1)) * w(2);
+					grid[index(x1, y0, z1)] += m * w(0) * (1 - w(1)) * w(2);
+					grid[index(x0, y1, z1)] += m * (1 - w(0)) * w(1) * w(2);
+					grid[index(x1, y1, z1)] += m * w(0) * w(1) * w(2);
+				}
+			}
+		});
+	}
+}
+
+void ParticleMesh::interpolate(const Bodies &b, double *ax, double *ay, double *az, ThreadPool *pool)
+{
+	int n = b.size();
+	int mask = size - 1;
+	double scale = -0.5 / cellSize;
+	auto phi = [&](int x, int y, int z) { return grid[index(x & mask, y & mask, z & mask)].real(); };
+	auto work = [&](int begin, int end, int thread) {
+		for(int i = begin; i < end; ++i) {
+			Vector3d u = (b.getPosition(i) - origin) / cellSize;
+			Vector3d f(floor(u(0)), floor(u(1)), floor(u(2)));
+			Vector3d w = u - f;
+			int x0 = (int)f(0), y0 = (int)f(1), z0 = (int)f(2);
+			Vector3d a(0.0, 0.0, 0.0);
+			for(int c = 0; c < 8; ++c) {
+				int dx = c & 1, dy = (c >> 1) & 1, dz = (c >> 2) & 1;
+				int x = x0 + dx, y = y0 + dy, z = z0 + dz;
+				double weight = (dx ? w(0) : 1 - w(0)) * (dy ? w(1) : 1 - w(1)) * (dz ? w(2) : 1 - w(2));
+				// -grad phi at the node, by central differences
+				a(0) += weight * (phi(x + 1, y, z) - phi(x - 1, y, z));
+				a(1) += weight * (phi(x, y + 1, z) - phi(x, y - 1, z));
+				a(2) += weight * (phi(x, y, z + 1) - phi(x, y, z - 1));
+			}
+			ax[i] = scale * a(0);
+			ay[i] = scale * a(1);
+			az[i] = scale * a(2);
+		}
+	};
+	ThreadPool::forRange(pool, n, 0, work);
+}
+
+void ParticleMesh::computeAccelerations(const Bodies &b, double e2, double *ax, double *ay, double *az, ThreadPool *pool)
+{
+	if(b.size() == 0) {
+		return;
+	}
+	fft.setSize(size);
+	grid.resize((size_t)size * size * size);
+	placeGrid(b);
+	buildGreen(e2, pool);
+	auto start = chrono::steady_clock::now();
+	deposit(b, pool);
+	depositSeconds = secondsSince(start);
+
+	start = chrono::steady_clock::now();
+	fft.transform(&grid[0], false, pool, padding ? gridSize : size);
+	int half = size / 2;
+	int h1 = half + 1;
+	ThreadPool::forRange(pool, size, 1, [&](int begin, int end, int thread) {
+		for(int k = begin; k < end; ++k) {
+			int gk = min(k, size - k);
+			for(int j = 0; j < size; ++j) {
+				const double *row = &green[((size_t)gk * h1 + min(j, size - j)) * h1];
+				complex<double> *g = &grid[index(0, j, k)];
+				for(int i = 0; i <= half; ++i) {
+					g[i] *= row[i];
+				}
+				for(int i = half + 1; i < size; ++i) {
+					g[i] *= row[size - i];
+				}
+			}
+		}
+	});
+	fft.transform(&grid[0], true, pool);
+	fftSeconds = secondsSince(start);
+
+	start = chrono::steady_clock::now();
+	interpolate(b, ax, ay, az, pool);
+	interpolateSeconds = secondsSince(start);
+}
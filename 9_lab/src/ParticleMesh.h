@@ -0,0 +1,91 @@
+#pragma once
+#ifndef _PARTICLEMESH_H_
+#define _PARTICLEMESH_H_
+
+#include <vector>
+#include <complex>
+
+#define EIGEN_DONT_ALIGN_STATICALLY
+#include <Eigen/Dense>
+
+#include "FFT.h"
+
+class ThreadPool;
+struct Bodies;
+
+// Particle-mesh gravity, O(n + g^3 log g) for a g^3 grid.
+//
+// The masses are spread onto a grid with cloud-in-cell (each body goes to
+// the 8 nodes around it, weighted by how close it is), the potential comes
+// from convolving that with the Green's function using FFTs, and the
+// acceleration is the potential's central difference gradient, read back
+// at each body with the same cloud-in-cell weights. Forces on scales of a
+// few cells and below are smoothed away, so it is meant for large, roughly
+// uniform distributions, not close encounters.
+//
+// With padding (the default) the grid is doubled in each direction and
+// filled with zeros, so the cyclic FFT convolution gives the potential of
+// an isolated system, with the softened -1/sqrt(r^2 + e2) kernel, like the
+// other solvers. Without padding the box is periodic (each body also feels
+// the images of every body in the neighbouring boxes), the mean density is
+// taken out, and there is no softening beyond the grid's own.
+class ParticleMesh
+{
+public:
+	ParticleMesh();
+	virtual ~ParticleMesh();
+
+	// Grid nodes along each side, rounded up to a power of two
+	void setGridSize(int g);
+	int getGridSize() const { return gridSize; }
+	void setPadding(bool padding);
+	bool getPadding() const { return padding; }
+
+	// Sets a[i] to the acceleration of body i for G = 1, like the other
+	// solvers, and writes it to ax[i], ay[i] and az[i].
+	void computeAccelerations(const Bodies &b, double e2, double *ax, double *ay, double *az, ThreadPool *pool = 0);
+
+	// Distance between grid nodes in the last computeAccelerations()
+	double getCellSize() const { return cellSize; }
+	// Time spent in the last computeAccelerations(): spreading the masses,
+	// the FFTs and the convolution, and reading the forces back
+	double getDepositSeconds() const { return depositSeconds; }
+	double getFFTSeconds() const { return fftSeconds; }
+	double getInterpolateSeconds() const { return interpolateSeconds; }
+
+private:
+	void placeGrid(const Bodies &b);
+	void buildGreen(double e2, ThreadPool *pool);
+	void deposit(const Bodies &b, ThreadPool *pool);
+	void interpolate(const Bodies &b, double *ax, double *ay, double *az, ThreadPool *pool);
+	size_t index(int x, int y, int z) const { return ((size_t)z * size + y) * size + x; }
+
+	int gridSize;
+	bool padding;
+	int size; // of the FFT grid, gridSize or 2 * gridSize with padding
+	FFT fft;
+
+	// Grid node (i, j, k) is at origin + cellSize * (i, j, k). Kept from step
+	// to step while the bodies still fit, so the Green's function doesn't
+	// have to be recomputed.
+	Eigen::Vector3d origin;
+	double cellSize;
+
+	// The transformed Green's function, scaled by 1/size^3 for the inverse
+	// FFT. It is real and even along each axis, so only (size/2 + 1)^3 of it
+	// is kept. greenKey is what it was computed for.
+	std::vector<double> green;
+	double greenKey[4];
+
+	std::vector< std::complex<double> > grid;
+	// The bodies sorted by the z of their lower cloud-in-cell node, so that
+	// bodies in different planes can be deposited in parallel
+	std::vector<int> planeStart;
+	std::vector<int> planeOrder;
+
+	double depositSeconds;
+	double fftSeconds;
+	double interpolateSeconds;
+};
+
+#endif
@@ -0,0 +1,148 @@
+#include "ParticleRenderer.h"
+#include "Bodies.h"
+#include "GLSL.h"
+#include "Program.h"
+#include "Texture.h"
+#include "ThreadPool.h"
+
+#include <iostream>
+
+using namespace std;
+using namespace Eigen;
+
+ParticleRenderer::ParticleRenderer() :
+	quadBufID(0),
+	instanceBufID(0),
+	instanced(false),
+	numInstances(0),
+	drawCalls(0)
+{
+}
+
+ParticleRenderer::~ParticleRenderer()
+{
+	if(quadBufID) {
+		glDeleteBuffers(1, &quadBufID);
+	}
+	if(instanceBufID) {
+		glDeleteBuffers(1, &instanceBufID);
+	}
+}
+
+void ParticleRenderer::init(const string &resourceDir)
+{
+	prog = make_shared<Program>();
+	prog->setVerbose(true); // Set this to true when debugging.
+	prog->setShaderNames(resourceDir + "particle_vert.glsl", resourceDir + "particle_frag.glsl");
+	prog->init();
+	prog->addUniform("P");
+	prog->addUniform("MV");
+	prog->addAttribute("vertPos");
+	prog->addAttribute("vertTex");
+	prog->addAttribute("instPosRadius");
+	prog->addAttribute("instColor");
+	prog->addUniform("alphaTexture");
+
+	texture = make_shared<Texture>();
+	texture->setFilename(resourceDir + "alpha.jpg");
+	texture->init();
+
+	// A unit quad as a triangle strip: x, y, z, then u, v
+	float quad[] = {
+		-1.0f, -1.0f, 0.0f, 0.0f, 0.0f,
+		 1.0f, -1.0f, 0.0f, 1.0f, 0.0f,
+		-1.0f,  1.0f, 0.0f, 0.0f, 1.0f,
+		 1.0f,  1.0f, 0.0f, 1.0f, 1.0f,
+	};
+	glGenBuffers(1, &quadBufID);
+	glBindBuffer(GL_ARRAY_BUFFER, quadBufID);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(quad), quad, GL_STATIC_DRAW);
+	glGenBuffers(1, &instanceBufID);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	instanced = glVertexAttribDivisor && glDrawArraysInstanced;
+	if(!instanced) {
+		cerr << "Instanced drawing isn't supported, drawing one particle at a time" << endl;
+	}
+	GLSL::checkError(GET_FILE_LINE);
+}
+
+void ParticleRenderer::update(const Bodies &b, const vector<size_t> &order, ThreadPool *pool)
+{
+	numInstances = (int)order.size();
+	instanceData.resize(numInstances * FLOATS_PER_INSTANCE);
+	auto pack = [&](int begin, int end, int thread) {
+		for(int k = begin; k < end; ++k) {
+			size_t i = order[k];
+			float *d = &instanceData[k * FLOATS_PER_INSTANCE];
+			d[0] = (float)b.x[i];
+			d[1] = (float)b.y[i];
+			d[2] = (float)b.z[i];
+			d[3] = b.radius[i];
+			d[4] = b.color[i](0);
+			d[5] = b.color[i](1);
+			d[6] = b.color[i](2);
+			d[7] = 1.0f;
+		}
+	};
+	ThreadPool::forRange(pool, numInstances, 0, pack);
+}
+
+void ParticleRenderer::draw(const Matrix4f &P, const Matrix4f &MV)
+{
+	drawCalls = 0;
+	if(!prog || numInstances == 0) {
+		return;
+	}
+	prog->bind();
+	texture->bind(prog->getUniform("alphaTexture"), 0);
+	glUniformMatrix4fv(prog->getUniform("P"), 1, GL_FALSE, P.data());
+	glUniformMatrix4fv(prog->getUniform("MV"), 1, GL_FALSE, MV.data());
+
+	GLint h_pos = prog->getAttribute("vertPos");
+	GLint h_tex = prog->getAttribute("vertTex");
+	GLint h_posr = prog->getAttribute("instPosRadius");
+	GLint h_color = prog->getAttribute("instColor");
+	glBindBuffer(GL_ARRAY_BUFFER, quadBufID);
+	GLSL::enableVertexAttribArray(h_pos);
+	glVertexAttribPointer(h_pos, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(float), 0);
+	GLSL::enableVertexAttribArray(h_tex);
+	glVertexAttribPointer(h_tex, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (const void *)(3 * sizeof(float)));
+
+	if(instanced) {
+		// Orphan last frame's buffer so the driver doesn't have to wait for it
+		const int stride = FLOATS_PER_INSTANCE * sizeof(float);
+		glBindBuffer(GL_ARRAY_BUFFER, instanceBufID);
+		glBufferData(GL_ARRAY_BUFFER, instanceData.size() * sizeof(float), 0, GL_STREAM_DRAW);
+		glBufferSubData(GL_ARRAY_BUFFER, 0, instanceData.size() * sizeof(float), &instanceData[0]);
+		GLSL::enableVertexAttribArray(h_posr);
+		glVertexAttribPointer(h_posr, 4, GL_FLOAT, GL_FALSE, stride, 0);
+		glVertexAttribDivisor(h_posr, 1);
+		GLSL::enableVertexAttribArray(h_color);
+		glVertexAttribPointer(h_color, 4, GL_FLOAT, GL_FALSE, stride, (const void *)(4 * sizeof(float)));
+		glVertexAttribDivisor(h_color, 1);
+
+		glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, numInstances);
+		drawCalls = 1;
+
+		// Leave the divisors how everyone else expects them
+		glVertexAttribDivisor(h_posr, 0);
+		glVertexAttribDivisor(h_color, 0);
+		GLSL::disableVertexAttribArray(h_color);
+		GLSL::disableVertexAttribArray(h_posr);
+	} else {
+		for(int k = 0; k < numInstances; ++k) {
+			glVertexAttrib4fv(h_posr, &instanceData[k * FLOATS_PER_INSTANCE]);
+			glVertexAttrib4fv(h_color, &instanceData[k * FLOATS_PER_INSTANCE + 4]);
+			glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+		}
+		drawCalls = numInstances;
+	}
+
+	GLSL::disableVertexAttribArray(h_tex);
+	GLSL::disableVertexAttribArray(h_pos);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	texture->unbind(0);
+	prog->unbind();
+	GLSL::checkError(GET_FILE_LINE);
+}
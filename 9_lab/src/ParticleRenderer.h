@@ -0,0 +1,63 @@
+#pragma once
+#ifndef _PARTICLERENDERER_H_
+#define _PARTICLERENDERER_H_
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#define GLEW_STATIC
+#include <GL/glew.h>
+
+#define EIGEN_DONT_ALIGN_STATICALLY
+#include <Eigen/Dense>
+
+class Program;
+class Texture;
+class ThreadPool;
+struct Bodies;
+
+// Draws all the particles as camera-facing textured quads with a single
+// instanced draw call. Every frame each particle's position, radius and
+// color are packed into one instance buffer, in back to front order, and
+// streamed to the GPU; the quad itself never changes.
+//
+// If the driver can't do instancing, the same shader is used with one draw
+// per particle, setting the per-particle attributes as constants.
+class ParticleRenderer
+{
+public:
+	// Position and radius, then rgba
+	static const int FLOATS_PER_INSTANCE = 8;
+
+	ParticleRenderer();
+	virtual ~ParticleRenderer();
+
+	// Loads the shader and texture and makes the buffers. Needs a GL context.
+	void init(const std::string &resourceDir);
+
+	// Packs the bodies in `order` (first is drawn first) into the instance
+	// data. No GL, so it can be timed without a window.
+	void update(const Bodies &b, const std::vector<size_t> &order, ThreadPool *pool = 0);
+	int getNumInstances() const { return numInstances; }
+	const std::vector<float> &getInstanceData() const { return instanceData; }
+
+	// Uploads the instance data and draws it
+	void draw(const Eigen::Matrix4f &P, const Eigen::Matrix4f &MV);
+	// Draw calls made by the last draw()
+	int getDrawCalls() const { return drawCalls; }
+	bool isInstanced() const { return instanced; }
+
+private:
+	std::shared_ptr<Program> prog;
+	std::shared_ptr<Texture> texture;
+	GLuint quadBufID;
+	GLuint instanceBufID;
+	bool instanced;
+
+	int numInstances;
+	std::vector<float> instanceData;
+	int drawCalls;
+};
+
+#endif
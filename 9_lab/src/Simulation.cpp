@@ -0,0 +1,380 @@
+#include "Simulation.h"
+#include "ThreadPool.h"
+
+#include <cmath>
+#include <fstream>
+#include <random>
+#include <algorithm>
+
+using namespace std;
+using namespace Eigen;
+
+bool parseSolver(const string &name, Solver &solver)
+{
+	if(name == "direct") {
+		solver = SOLVER_DIRECT;
+	} else if(name == "bh") {
+		solver = SOLVER_BARNES_HUT;
+	} else if(name == "fmm") {
+		solver = SOLVER_FMM;
+	} else if(name == "pm") {
+		solver = SOLVER_PM;
+	} else {
+		return false;
+	}
+	return true;
+}
+
+bool parseScheme(const string &name, Integrator::Scheme &scheme)
+{
+	if(name == "euler") {
+		scheme = Integrator::EULER;
+	} else if(name == "leapfrog") {
+		scheme = Integrator::LEAPFROG;
+	} else if(name == "block") {
+		scheme = Integrator::BLOCK;
+	} else {
+		return false;
+	}
+	return true;
+}
+
+bool parseModel(const string &name, Model &model)
+{
+	if(name == "uniform") {
+		model = MODEL_UNIFORM;
+	} else if(name == "plummer") {
+		model = MODEL_PLUMMER;
+	} else if(name == "disk") {
+		model = MODEL_DISK;
+	} else if(name == "collision") {
+		model = MODEL_COLLISION;
+	} else {
+		return false;
+	}
+	return true;
+}
+
+const char *schemeName(Integrator::Scheme scheme)
+{
+	switch(scheme) {
+		case Integrator::LEAPFROG: return "leapfrog";
+		case Integrator::BLOCK: return "block";
+		default: return "euler";
+	}
+}
+
+const char *modelName(Model model)
+{
+	switch(model) {
+		case MODEL_PLUMMER: return "plummer";
+		case MODEL_DISK: return "disk";
+		case MODEL_COLLISION: return "collision";
+		default: return "uniform";
+	}
+}
+
+// A direction uniformly over the sphere
+static Vector3d randomDirection(mt19937 &rng)
+{
+	uniform_real_distribution<double> unit(-1.0, 1.0);
+	double z = unit(rng);
+	double phi = M_PI * unit(rng);
+	double s = sqrt(max(0.0, 1.0 - z * z));
+	return Vector3d(s * cos(phi), s * sin(phi), z);
+}
+
+// Moves the bodies from `first` on so that their center of mass is at rest
+// at the origin
+static void centerOfMassFrame(Bodies &b, int first)
+{
+	double mass = 0.0;
+	Vector3d x(0.0, 0.0, 0.0), v(0.0, 0.0, 0.0);
+	for(int i = first; i < b.size(); ++i) {
+		mass += b.m[i];
+		x += b.m[i] * b.getPosition(i);
+		v += b.m[i] * b.getVelocity(i);
+	}
+	if(mass <= 0.0) {
+		return;
+	}
+	x /= mass;
+	v /= mass;
+	for(int i = first; i < b.size(); ++i) {
+		b.x[i] -= x(0); b.y[i] -= x(1); b.z[i] -= x(2);
+		b.vx[i] -= v(0); b.vy[i] -= v(1); b.vz[i] -= v(2);
+	}
+}
+
+static void addPlummer(Bodies &b, mt19937 &rng, int n)
+{
+	uniform_real_distribution<double> unit(0.0, 1.0);
+	uniform_real_distribution<float> shade(0.0f, 0.3f);
+	uniform_real_distribution<float> size(0.1f, 0.3f);
+	int first = b.size();
+	for(int i = 0; i < n; ++i) {
+		// Radius from the inverse of the cumulative mass
+		double r;
+		do {
+			r = 1.0 / sqrt(pow(unit(rng), -2.0 / 3.0) - 1.0);
+		} while(!(r <= 10.0));
+		// Speed as a fraction q of the escape speed, by rejection from
+		// q^2 (1 - q^2)^(7/2)
+		double q, g;
+		do {
+			q = unit(rng);
+			g = 0.1 * unit(rng);
+		} while(g > q * q * pow(1.0 - q * q, 3.5));
+		double speed = q * sqrt(2.0) * pow(1.0 + r * r, -0.25);
+		Vector3f c(1.0f, 0.8f + shade(rng) * 0.5f, 0.5f + shade(rng));
+		b.add(1.0 / n, r * randomDirection(rng), speed * randomDirection(rng), c, size(rng));
+	}
+	centerOfMassFrame(b, first);
+}
+
+static void addDisk(Bodies &b, mt19937 &rng, int n, double mass, double e2, const Vector3d &center,
+                    const Vector3d &velocity, const Matrix3d &rotation, const Vector3f &color)
+{
+	uniform_real_distribution<double> unit(0.0, 1.0);
+	normal_distribution<double> gauss(0.0, 1.0);
+	uniform_real_distribution<float> shade(-0.15f, 0.15f);
+	uniform_real_distribution<float> size(0.1f, 0.3f);
+	int first = b.size();
+	for(int i = 0; i < n; ++i) {
+		// R e^-R is a gamma distribution, the sum of two exponentials
+		double R;
+		do {
+			R = -log(unit(rng)) - log(unit(rng));
+		} while(!(R <= 10.0));
+		double u = min(max(unit(rng), 1e-9), 1.0 - 1e-9);
+		double z = 0.1 * atanh(2.0 * u - 1.0);
+		double theta = 2.0 * M_PI * unit(rng);
+		double enclosed = mass * (1.0 - (1.0 + R) * exp(-R));
+		double vc = sqrt(enclosed * R * R / pow(R * R + e2, 1.5));
+		Vector3d x(R * cos(theta), R * sin(theta), z);
+		Vector3d v(-vc * sin(theta), vc * cos(theta), 0.0);
+		v += 0.1 * vc * Vector3d(gauss(rng), gauss(rng), gauss(rng));
+		Vector3f c = (color + Vector3f(shade(rng), shade(rng), shade(rng))).cwiseMax(0.0f).cwiseMin(1.0f);
+		b.add(mass / n, x, v, c, size(rng));
+	}
+	centerOfMassFrame(b, first);
+	for(int i = first; i < b.size(); ++i) {
+		Vector3d x = center + rotation * b.getPosition(i);
+		Vector3d v = velocity + rotation * b.getVelocity(i);
+		b.x[i] = x(0); b.y[i] = x(1); b.z[i] = x(2);
+		b.vx[i] = v(0); b.vy[i] = v(1); b.vz[i] = v(2);
+	}
+}
+
+Simulation::Simulation() :
+	t(0.0),
+	h(1.0),
+	e2(0.0),
+	solver(SOLVER_DIRECT),
+	merging(false),
+	merged(0),
+	interactions(0)
+{
+}
+
+Simulation::~Simulation()
+{
+}
+
+int Simulation::computeForces(const vector<int> *active, ThreadPool *pool)
+{
+	Bodies &b = bodies;
+	long long n = b.size();
+	if(solver == SOLVER_BARNES_HUT) {
+		barnesHut.computeAccelerations(b, e2, &b.ax[0], &b.ay[0], &b.az[0], pool, active);
+		interactions += barnesHut.getNumInteractions();
+	} else if(solver == SOLVER_FMM) {
+		fmm.computeAccelerations(b, e2, &b.ax[0], &b.ay[0], &b.az[0], pool);
+		interactions += fmm.getNumM2L() + fmm.getNumP2P();
+		return (int)n;
+	} else if(solver == SOLVER_PM) {
+		particleMesh.computeAccelerations(b, e2, &b.ax[0], &b.ay[0], &b.az[0], pool);
+		return (int)n;
+	} else if(active) {
+		auto work = [&](int begin, int end, int thread) {
+			for(int k = begin; k < end; ++k) {
+				int i = (*active)[k];
+				if(directSum.getSIMD()) {
+					directAccelerationsSIMD(b, e2, i, i + 1, &b.ax[i], &b.ay[i], &b.az[i]);
+				} else {
+					directAccelerationsScalar(b, e2, i, i + 1, &b.ax[i], &b.ay[i], &b.az[i]);
+				}
+			}
+		};
+		ThreadPool::forRange(pool, (int)active->size(), 16, work);
+		interactions += (long long)active->size() * (n - 1);
+	} else {
+		directSum.computeAccelerations(b, e2, &b.ax[0], &b.ay[0], &b.az[0], pool);
+		// Every ordered pair, however many the kernel visits
+		interactions += n * (n - 1);
+	}
+	return active ? (int)active->size() : (int)n;
+}
+
+void Simulation::step(ThreadPool *pool)
+{
+	integrator.step(bodies, h, e2, [this, pool](const vector<int> *active) { return computeForces(active, pool); }, pool);
+	t += h;
+	if(merging) {
+		int m = collisions.merge(bodies, pool);
+		if(m > 0) {
+			// The merged bodies' accelerations are only averages
+			merged += m;
+			integrator.reset();
+		}
+	}
+}
+
+double Simulation::energy(ThreadPool *pool) const
+{
+	double kinetic = 0.0;
+	for(int i = 0; i < bodies.size(); ++i) {
+		kinetic += 0.5 * bodies.m[i] * bodies.getVelocity(i).squaredNorm();
+	}
+	return kinetic + potentialEnergy(bodies, e2, pool);
+}
+
+const char *Simulation::solverName() const
+{
+	switch(solver) {
+		case SOLVER_BARNES_HUT: return "Barnes-Hut";
+		case SOLVER_FMM: return "FMM";
+		case SOLVER_PM: return "particle mesh";
+		default: return "direct sum";
+	}
+}
+
+void Simulation::createUniform(int n, unsigned seed)
+{
+	mt19937 rng(seed);
+	uniform_real_distribution<double> unit(-1.0, 1.0);
+	uniform_real_distribution<float> shade(0.5f, 1.0f);
+	uniform_real_distribution<float> size(0.1f, 0.3f);
+	bodies.clear();
+	bodies.reserve(n);
+	t = 0.0;
+	h = 1e-3;
+	e2 = 1e-4;
+	for(int i = 0; i < n; ++i) {
+		Vector3d x(unit(rng), unit(rng), unit(rng));
+		Vector3d v(unit(rng), unit(rng), unit(rng));
+		Vector3f c(shade(rng), shade(rng), shade(rng));
+		bodies.add(1.0 / n, x, v, c, size(rng));
+	}
+	integrator.reset();
+}
+
+void Simulation::create(Model model, int n, unsigned seed)
+{
+	if(model == MODEL_UNIFORM) {
+		createUniform(n, seed);
+		return;
+	}
+	mt19937 rng(seed);
+	bodies.clear();
+	bodies.reserve(n);
+	t = 0.0;
+	h = 1e-3;
+	e2 = 1e-4;
+	if(model == MODEL_PLUMMER) {
+		addPlummer(bodies, rng, n);
+	} else if(model == MODEL_DISK) {
+		addDisk(bodies, rng, n, 1.0, e2, Vector3d::Zero(), Vector3d::Zero(), Matrix3d::Identity(), Vector3f(0.6f, 0.75f, 1.0f));
+	} else {
+		// Together they would be just unbound at this distance if they were
+		// points, so they fall in, pass through and come back
+		double d = 6.0;
+		double speed = 0.5 * sqrt(2.0 / d);
+		Matrix3d tilt = AngleAxisd(M_PI / 4.0, Vector3d::UnitX()).toRotationMatrix();
+		addDisk(bodies, rng, n / 2, 0.5, e2, Vector3d(-0.5 * d, -0.5, 0.0), Vector3d(speed, 0.0, 0.0),
+		        Matrix3d::Identity(), Vector3f(0.6f, 0.75f, 1.0f));
+		addDisk(bodies, rng, n - n / 2, 0.5, e2, Vector3d(0.5 * d, 0.5, 0.0), Vector3d(-speed, 0.0, 0.0),
+		        tilt, Vector3f(1.0f, 0.7f, 0.45f));
+	}
+	integrator.reset();
+}
+
+bool Simulation::loadText(const string &filename)
+{
+	ifstream in(filename);
+	if(!in.good()) {
+		return false;
+	}
+	int n;
+	in >> n >> h >> e2;
+	bodies.clear();
+	bodies.reserve(max(n, 0));
+	for(int i = 0; i < n && in.good(); ++i) {
+		double mass, radius;
+		Vector3d position, velocity;
+		Vector3f color;
+		in >> mass;
+		in >> position(0) >> position(1) >> position(2);
+		in >> velocity(0) >> velocity(1) >> velocity(2);
+		in >> color(0) >> color(1) >> color(2);
+		in >> radius;
+		if(!in.fail()) {
+			bodies.add(mass, position, velocity, color, radius);
+		}
+	}
+	t = 0.0;
+	integrator.reset();
+	return !in.fail() && bodies.size() == n;
+}
+
+bool Simulation::saveText(const string &filename) const
+{
+	ofstream out(filename);
+	if(!out.good()) {
+		return false;
+	}
+	// Enough digits to read back the same doubles
+	out.precision(17);
+	out << bodies.size() << " " << h << " " << e2 << "\n";
+	for(int i = 0; i < bodies.size(); ++i) {
+		const Vector3f &color = bodies.color[i];
+		out << bodies.m[i] << " "
+		    << bodies.x[i] << " " << bodies.y[i] << " " << bodies.z[i] << " "
+		    << bodies.vx[i] << " " << bodies.vy[i] << " " << bodies.vz[i] << " "
+		    << color(0) << " " << color(1) << " " << color(2) << " "
+		    << bodies.radius[i] << "\n";
+	}
+	return out.good();
+}
+
+Snapshot Simulation::takeSnapshot() const
+{
+	Snapshot s;
+	s.t = t;
+	s.h = h;
+	s.e2 = e2;
+	s.solver = solver;
+	s.scheme = integrator.getScheme();
+	s.bodies = bodies;
+	s.haveAccelerations = integrator.hasAccelerations();
+	if((int)integrator.getLevels().size() == bodies.size()) {
+		s.levels = integrator.getLevels();
+	}
+	return s;
+}
+
+void Simulation::restore(Snapshot &&s)
+{
+	t = s.t;
+	h = s.h;
+	e2 = s.e2;
+	if(s.solver >= SOLVER_DIRECT && s.solver <= SOLVER_PM) {
+		solver = (Solver)s.solver;
+	}
+	// Before the integrator's state, which setScheme() clears
+	if(s.scheme >= Integrator::EULER && s.scheme <= Integrator::BLOCK) {
+		integrator.setScheme((Integrator::Scheme)s.scheme);
+	}
+	bodies = move(s.bodies);
+	integrator.restore(s.haveAccelerations, s.levels);
+}
@@ -0,0 +1,113 @@
+#pragma once
+#ifndef _SIMULATION_H_
+#define _SIMULATION_H_
+
+#include <string>
+#include <vector>
+
+#include "Bodies.h"
+#include "BarnesHut.h"
+#include "FMM.h"
+#include "Gravity.h"
+#include "Integrator.h"
+#include "ParticleMesh.h"
+#include "Snapshot.h"
+#include "Collisions.h"
+
+class ThreadPool;
+
+// Which force calculation Simulation::step() uses
+enum Solver
+{
+	SOLVER_DIRECT,     // every pair, O(n^2)
+	SOLVER_BARNES_HUT, // octree, O(n log n)
+	SOLVER_FMM,        // fast multipole method, O(n)
+	SOLVER_PM          // particle mesh, O(n + g^3 log g)
+};
+
+// Initial conditions Simulation::create() can make
+enum Model
+{
+	MODEL_UNIFORM,
+	MODEL_PLUMMER,
+	MODEL_DISK,
+	MODEL_COLLISION
+};
+
+// "direct", "bh", "fmm" or "pm", "euler", "leapfrog" or "block", and
+// "uniform", "plummer", "disk" or "collision", as on the command line.
+// Return false, leaving the value alone, for anything else.
+bool parseSolver(const std::string &name, Solver &solver);
+bool parseScheme(const std::string &name, Integrator::Scheme &scheme);
+bool parseModel(const std::string &name, Model &model);
+const char *schemeName(Integrator::Scheme scheme);
+const char *modelName(Model model);
+
+// One N-body system with its own solvers and integrator, so that several
+// can be stepped at the same time on different threads. Like Bodies,
+// everything is public; set the solver and integrator options directly.
+class Simulation
+{
+public:
+	Simulation();
+	virtual ~Simulation();
+
+	// Accelerations for G = 1 into bodies.ax/ay/az, for the bodies in active
+	// (or all of them). Barnes-Hut and direct sum only do the active ones,
+	// the FMM and particle mesh always do everything.
+	// Returns how many bodies got new accelerations.
+	int computeForces(const std::vector<int> *active, ThreadPool *pool = 0);
+	// Advances everything by h, then merges the bodies that touch if
+	// merging is on
+	void step(ThreadPool *pool = 0);
+	// Kinetic plus potential energy, for G = 1. The potential is a direct sum.
+	double energy(ThreadPool *pool = 0) const;
+	const char *solverName() const;
+
+	// n bodies in a 2x2x2 cube with random velocities, all with the same
+	// mass and 1 in total, h = 1e-3 and e2 = 1e-4. The same seed gives the
+	// same bodies.
+	void createUniform(int n, unsigned seed);
+	// Like createUniform(), n bodies of total mass 1 from one of:
+	//    UNIFORM: createUniform()
+	//    PLUMMER: a Plummer sphere with scale radius 1, cut off at 10, in
+	//       equilibrium (Aarseth, Henon and Wielen 1974)
+	//    DISK: an exponential disk with scale length 1 and a sech^2 profile
+	//       0.1 thick, cut off at 10, on circular orbits for its enclosed mass
+	//       (taken as spherical) with 10% random velocities
+	//    COLLISION: two such disks of half the mass, 6 apart, tilted to each
+	//       other and falling together slightly off center
+	void create(Model model, int n, unsigned seed);
+
+	// The text format, a line with <n> <h> <e2> and then one line per body:
+	// <mass> <position> <velocity> <color> <radius>. Returns false if the
+	// file can't be opened or ends early.
+	bool loadText(const std::string &filename);
+	bool saveText(const std::string &filename) const;
+
+	// The whole state, with the solver, scheme and integrator's, for a
+	// binary snapshot. Restoring sets the solver and scheme the snapshot
+	// was taken with, when it says.
+	Snapshot takeSnapshot() const;
+	void restore(Snapshot &&s);
+
+	// The energy's direct sum is only practical up to about this many bodies
+	static const int MAX_ENERGY_BODIES = 100000;
+
+	Bodies bodies;
+	double t, h, e2;
+	Solver solver;
+	BarnesHut barnesHut;
+	DirectSum directSum;
+	FMM fmm;
+	ParticleMesh particleMesh;
+	Integrator integrator;
+	bool merging;
+	Collisions collisions;
+	long long merged; // bodies merged away so far
+	// Body-body and body-cell interactions in all the computeForces() so
+	// far (none are counted for the particle mesh)
+	long long interactions;
+};
+
+#endif
@@ -0,0 +1,243 @@
+#include "Snapshot.h"
+
+#include <iostream>
+#include <cstring>
+#include <cstdint>
+#include <cerrno>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+using namespace std;
+using namespace Eigen;
+
+namespace {
+
+const char MAGIC[8] = {'N', 'B', 'O', 'D', 'Y', 'S', 'N', 'P'};
+const uint32_t BYTE_ORDER_MARK = 0x01020304;
+// Header flags
+const uint32_t HAVE_ACCELERATIONS = 1;
+const uint32_t HAVE_LEVELS = 2;
+
+struct Header
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t byteOrder;
+	uint64_t n;
+	double t, h, e2;
+	uint32_t flags;
+	int16_t solver; // both 0 in version 1 files
+	int16_t scheme;
+	uint64_t reserved;
+};
+static_assert(sizeof(Header) == 64, "snapshot header must be 64 bytes");
+static_assert(sizeof(Vector3f) == 3 * sizeof(float), "colors must be packed");
+
+// The arrays in file order
+struct Section
+{
+	const void *data;
+	size_t bytes;
+};
+
+vector<Section> sectionsOf(const Snapshot &s)
+{
+	const Bodies &b = s.bodies;
+	size_t n = b.size();
+	const vector<double> *doubles[] = {&b.m, &b.x, &b.y, &b.z, &b.vx, &b.vy, &b.vz, &b.ax, &b.ay, &b.az};
+	vector<Section> sections;
+	for(const vector<double> *d : doubles) {
+		sections.push_back({d->data(), n * sizeof(double)});
+	}
+	sections.push_back({b.radius.data(), n * sizeof(float)});
+	sections.push_back({b.color.data(), n * sizeof(Vector3f)});
+	if(!s.levels.empty()) {
+		sections.push_back({s.levels.data(), n * sizeof(int)});
+	}
+	return sections;
+}
+
+bool writeAll(int fd, const void *data, size_t bytes)
+{
+	const char *p = (const char *)data;
+	while(bytes > 0) {
+		// Linux writes at most about 2 GB at a time
+		ssize_t w = ::write(fd, p, min(bytes, (size_t)1 << 30));
+		if(w < 0) {
+			if(errno == EINTR) {
+				continue;
+			}
+			return false;
+		}
+		p += w;
+		bytes -= w;
+	}
+	return true;
+}
+
+}
+
+Snapshot::Snapshot() :
+	t(0.0),
+	h(0.0),
+	e2(0.0),
+	solver(-1),
+	scheme(-1),
+	haveAccelerations(false)
+{
+}
+
+bool isSnapshot(const string &filename)
+{
+	int fd = open(filename.c_str(), O_RDONLY);
+	if(fd < 0) {
+		return false;
+	}
+	char magic[sizeof(MAGIC)];
+	bool yes = read(fd, magic, sizeof(magic)) == (ssize_t)sizeof(magic) && memcmp(magic, MAGIC, sizeof(MAGIC)) == 0;
+	close(fd);
+	return yes;
+}
+
+bool writeSnapshot(const string &filename, const Snapshot &s)
+{
+	const Bodies &b = s.bodies;
+	if(!s.levels.empty() && (int)s.levels.size() != b.size()) {
+		cerr << "Snapshot has " << s.levels.size() << " levels for " << b.size() << " bodies" << endl;
+		return false;
+	}
+	Header header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, MAGIC, sizeof(MAGIC));
+	header.version = Snapshot::VERSION;
+	header.byteOrder = BYTE_ORDER_MARK;
+	header.n = b.size();
+	header.t = s.t;
+	header.h = s.h;
+	header.e2 = s.e2;
+	header.solver = (int16_t)s.solver;
+	header.scheme = (int16_t)s.scheme;
+	header.flags = (s.haveAccelerations ? HAVE_ACCELERATIONS : 0) | (s.levels.empty() ? 0 : HAVE_LEVELS);
+
+	string tmp = filename + ".tmp";
+	int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if(fd < 0) {
+		cerr << "Could not open " << tmp << ": " << strerror(errno) << endl;
+		return false;
+	}
+	bool ok = writeAll(fd, &header, sizeof(header));
+	for(const Section &a : sectionsOf(s)) {
+		ok = ok && writeAll(fd, a.data, a.bytes);
+	}
+	// On disk before it takes the old one's place
+	ok = ok && fsync(fd) == 0;
+	ok = close(fd) == 0 && ok;
+	if(!ok || rename(tmp.c_str(), filename.c_str()) != 0) {
+		cerr << "Could not write " << filename << ": " << strerror(errno) << endl;
+		unlink(tmp.c_str());
+		return false;
+	}
+	return true;
+}
+
+bool readSnapshot(const string &filename, Snapshot &s)
+{
+	int fd = open(filename.c_str(), O_RDONLY);
+	if(fd < 0) {
+		cerr << "Cannot read " << filename << ": " << strerror(errno) << endl;
+		return false;
+	}
+	struct stat st;
+	if(fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(Header)) {
+		cerr << filename << " is not a snapshot" << endl;
+		close(fd);
+		return false;
+	}
+	size_t size = st.st_size;
+	void *map = mmap(0, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(map == MAP_FAILED) {
+		cerr << "Cannot map " << filename << ": " << strerror(errno) << endl;
+		return false;
+	}
+	madvise(map, size, MADV_SEQUENTIAL);
+
+	const char *p = (const char *)map;
+	Header header;
+	memcpy(&header, p, sizeof(header));
+	size_t n = header.n;
+	size_t perBody = 10 * sizeof(double) + sizeof(float) + sizeof(Vector3f) + ((header.flags & HAVE_LEVELS) ? sizeof(int) : 0);
+	const char *error = 0;
+	if(memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0) {
+		error = "is not a snapshot";
+	} else if(header.byteOrder != BYTE_ORDER_MARK) {
+		error = "was written with the other byte order";
+	} else if(header.version != 1 && header.version != Snapshot::VERSION) {
+		error = "is a snapshot version this program doesn't know";
+	} else if(n > (size - sizeof(Header)) / perBody || size != sizeof(Header) + n * perBody) {
+		error = "is truncated or corrupt";
+	}
+	if(error) {
+		cerr << filename << " " << error << endl;
+		munmap(map, size);
+		return false;
+	}
+
+	s.t = header.t;
+	s.h = header.h;
+	s.e2 = header.e2;
+	s.solver = header.version >= 2 ? header.solver : -1;
+	s.scheme = header.version >= 2 ? header.scheme : -1;
+	s.haveAccelerations = (header.flags & HAVE_ACCELERATIONS) != 0;
+	Bodies &b = s.bodies;
+	vector<double> *doubles[] = {&b.m, &b.x, &b.y, &b.z, &b.vx, &b.vy, &b.vz, &b.ax, &b.ay, &b.az};
+	p += sizeof(Header);
+	for(vector<double> *d : doubles) {
+		d->resize(n);
+		memcpy(d->data(), p, n * sizeof(double));
+		p += n * sizeof(double);
+	}
+	b.radius.resize(n);
+	memcpy(b.radius.data(), p, n * sizeof(float));
+	p += n * sizeof(float);
+	b.color.resize(n);
+	memcpy((void *)b.color.data(), p, n * sizeof(Vector3f));
+	p += n * sizeof(Vector3f);
+	s.levels.clear();
+	if(header.flags & HAVE_LEVELS) {
+		s.levels.resize(n);
+		memcpy(s.levels.data(), p, n * sizeof(int));
+	}
+	munmap(map, size);
+	return true;
+}
+
+SnapshotWriter::SnapshotWriter() :
+	ok(true)
+{
+}
+
+SnapshotWriter::~SnapshotWriter()
+{
+	wait();
+}
+
+void SnapshotWriter::write(const string &filename, Snapshot &&s)
+{
+	wait();
+	pending = move(s);
+	thread = std::thread([this, filename]() {
+		ok = writeSnapshot(filename, pending);
+	});
+}
+
+bool SnapshotWriter::wait()
+{
+	if(thread.joinable()) {
+		thread.join();
+	}
+	return ok;
+}
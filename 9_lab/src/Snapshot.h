@@ -0,0 +1,70 @@
+#pragma once
+#ifndef _SNAPSHOT_H_
+#define _SNAPSHOT_H_
+
+#include <string>
+#include <vector>
+#include <thread>
+
+#include "Bodies.h"
+
+// Everything needed to carry on a run where it stopped: the bodies, the
+// time, step and softening, the solver and integration scheme, and the
+// integrator's state (whether the accelerations in the bodies are for their
+// positions, and the block step levels), so that a restarted run takes
+// exactly the same steps. The particle mesh solver places its grid afresh
+// after a restart, so its runs only carry on approximately.
+//
+// On disk it is a 64 byte header followed by the arrays, each n long and in
+// native byte order: m, x, y, z, vx, vy, vz, ax, ay, az as doubles, radius
+// and color (3 per body) as floats, then the levels as ints if there are
+// any. The header has a magic string, a format version and a byte order
+// mark, so foreign files are refused instead of misread. Version 1 files,
+// from before the solver and scheme were kept, are still read.
+struct Snapshot
+{
+	static const unsigned VERSION = 2;
+
+	double t, h, e2;
+	int solver; // a Solver, or -1 if the file didn't say
+	int scheme; // an Integrator::Scheme, or -1 if the file didn't say
+	Bodies bodies;
+	bool haveAccelerations;
+	std::vector<int> levels; // empty, or one per body
+
+	Snapshot();
+};
+
+// Whether the file starts like a snapshot (of any version)
+bool isSnapshot(const std::string &filename);
+
+// Writes to filename.tmp and renames it over filename once it is all on
+// disk, so a crash leaves either the old snapshot or the new one, never half
+// of one. Returns false, and prints why, on failure.
+bool writeSnapshot(const std::string &filename, const Snapshot &s);
+
+// Maps the file and copies the arrays out of it. Returns false, and prints
+// why, if the file can't be read or isn't a snapshot of a version this
+// program knows.
+bool readSnapshot(const std::string &filename, Snapshot &s);
+
+// Writes snapshots on a background thread, so a run only stops for as long
+// as it takes to copy its state. A write waits for the one before it.
+class SnapshotWriter
+{
+public:
+	SnapshotWriter();
+	virtual ~SnapshotWriter();
+
+	// Takes the snapshot over and starts writing it
+	void write(const std::string &filename, Snapshot &&s);
+	// Blocks until the last write is done. Returns whether it succeeded.
+	bool wait();
+
+private:
+	std::thread thread;
+	Snapshot pending;
+	bool ok;
+};
+
+#endif
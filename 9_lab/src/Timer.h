@@ -0,0 +1,13 @@
+#pragma once
+#ifndef _TIMER_H_
+#define _TIMER_H_
+
+#include <chrono>
+
+// Wall clock seconds since start, for timing the parts of a step
+inline double secondsSince(std::chrono::steady_clock::time_point start)
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+#endif
@@ -1,7 +1,11 @@
 #include <stdlib.h>
+#include <stdio.h>
 #include <iostream>
 #include <fstream>
+#include <sstream>
 #include <vector>
+#include <chrono>
+#include <algorithm>
 
 #define GLEW_STATIC
 #include <GL/glew.h>
@@ -13,6 +17,20 @@
 #include "MatrixStack.h"
 #include "Particle.h"
 #include "Texture.h"
+#include "BarnesHut.h"
+#include "ThreadPool.h"
+#include "Timer.h"
+#include "Bodies.h"
+#include "Gravity.h"
+#include "FMM.h"
+#include "ParticleMesh.h"
+#include "Integrator.h"
+#include "ParticleRenderer.h"
+#include "DepthSorter.h"
+#include "Snapshot.h"
+#include "Simulation.h"
+#include "Ensemble.h"
+#include "Benchmark.h"
 
 using namespace std;
 using namespace Eigen;
@@ -23,11 +41,14 @@ GLFWwindow *window; // Main application window
 string RESOURCE_DIR = ""; // Where the resources are loaded from
 
 shared_ptr<Program> progSimple;
-shared_ptr<Program> prog;
 shared_ptr<Camera> camera;
-vector< shared_ptr<Particle> > particles;
-shared_ptr<Texture> texture;
-double t, h, e2;
+Simulation sim; // the bodies, solvers and integrator
+vector< shared_ptr<Particle> > particles; // views of the bodies, for drawing
+ParticleRenderer renderer; // draws all the particles in one call
+DepthSorter depthSorter; // back to front order for the renderer
+shared_ptr<ThreadPool> pool; // the simulation's worker threads
+bool quiet = false; // headless: don't print every particle at the end
+SnapshotWriter snapshotWriter; // checkpoints in the background
 
 static void error_callback(int error, const char *description)
 {
@@ -70,6 +91,35 @@ void mouse_button_callback(GLFWwindow* window, int button, int action, int mods)
 	}
 }
 
+/* Frames drawn, and the CPU time spent sorting, packing and submitting the
+ *  particles. With 'f' toggled on, the averages are printed every couple of
+ *  seconds. */
+struct FrameStats {
+   int frames;
+   double submitSeconds;
+   int drawCalls;
+   chrono::steady_clock::time_point start;
+   
+   FrameStats() : frames(0), submitSeconds(0), drawCalls(0), start(chrono::steady_clock::now()) {}
+   
+   void add(double submit_seconds, int draw_calls)
+   {
+      frames++;
+      submitSeconds += submit_seconds;
+      drawCalls = draw_calls;
+      double elapsed = secondsSince(start);
+      if (elapsed < 2.0) {
+         return;
+      }
+      if (keyToggles[(unsigned)'f']) {
+         printf("%d particles: %d draw call%s, %.3f ms CPU submit, %.2f ms/frame\n", (int)sim.bodies.size(),
+                drawCalls, drawCalls == 1 ? "" : "s", submitSeconds / frames * 1e3, elapsed / frames * 1e3);
+      }
+      *this = FrameStats();
+   }
+};
+FrameStats frameStats;
+
 static void initGL()
 {
 	GLSL::checkVersion();
@@ -89,27 +139,12 @@ static void initGL()
 	progSimple->addUniform("P");
 	progSimple->addUniform("MV");
 	
-	prog = make_shared<Program>();
-	prog->setVerbose(true); // Set this to true when debugging.
-	prog->setShaderNames(RESOURCE_DIR + "particle_vert.glsl", RESOURCE_DIR + "particle_frag.glsl");
-	prog->init();
-	prog->addUniform("P");
-	prog->addUniform("MV");
-	prog->addAttribute("vertPos");
-	prog->addAttribute("vertTex");
-	prog->addUniform("radius");
-	prog->addUniform("alphaTexture");
-	prog->addUniform("color");
-	
-	texture = make_shared<Texture>();
-	texture->setFilename(RESOURCE_DIR + "alpha.jpg");
-	texture->init();
+	renderer.init(RESOURCE_DIR);
 	
 	camera = make_shared<Camera>();
 	
-	// Initialize OpenGL for particles.
-	for(auto p : particles) {
-		p->init();
+	for(int i = 0; i < sim.bodies.size(); ++i) {
+		particles.push_back(make_shared<Particle>(&sim.bodies, i));
 	}
 	
 	// If there were any OpenGL errors, this will print something.
@@ -118,35 +153,6 @@ static void initGL()
 	GLSL::checkError(GET_FILE_LINE);
 }
 
-// Sort particles by their z values in camera space
-class ParticleSorter {
-public:
-	bool operator()(size_t i0, size_t i1) const
-	{
-		// Particle positions in world space
-		const Vector3d &x0 = particles[i0]->getPosition();
-		const Vector3d &x1 = particles[i1]->getPosition();
-		// Particle positions in camera space
-		float z0 = V.row(2) * Vector4f(x0(0), x0(1), x0(2), 1.0f);
-		float z1 = V.row(2) * Vector4f(x1(0), x1(1), x1(2), 1.0f);
-		return z0 < z1;
-	}
-	
-	Matrix4f V; // current view matrix
-};
-ParticleSorter sorter;
-
-// http://stackoverflow.com/questions/1577475/c-sorting-and-keeping-track-of-indexes
-template <typename T>
-vector<size_t> sortIndices(const vector<T> &v) {
-	// initialize original index locations
-	vector<size_t> idx(v.size());
-	for (size_t i = 0; i != idx.size(); ++i) idx[i] = i;
-	// sort indexes based on comparing values in v
-	sort(idx.begin(), idx.end(), sorter);
-	return idx;
-}
-
 void renderGL()
 {
 	// Get current frame buffer size.
@@ -179,21 +185,14 @@ void renderGL()
 	camera->applyProjectionMatrix(P);
 	MV->pushMatrix();
 	camera->applyViewMatrix(MV);
-	// Set view matrix for the sorter
-	sorter.V = MV->topMatrix();
-	
 	// Draw particles
-	prog->bind();
-	texture->bind(prog->getUniform("alphaTexture"), 0);
-	glUniformMatrix4fv(prog->getUniform("P"), 1, GL_FALSE, P->topMatrix().data());
+	auto submit_start = chrono::steady_clock::now();
 	// Sort particles by Z for transparency rendering.
 	// Since we don't want to modify the contents of the vector, we compute the
-	// sorted indices and traverse the particles in this sorted order.
-	for(auto i : sortIndices(particles)) {
-		particles[i]->draw(prog, MV);
-	}
-	texture->unbind(0);
-	prog->unbind();
+	// sorted indices and draw the particles in this sorted order.
+	renderer.update(sim.bodies, depthSorter.sort(sim.bodies, MV->topMatrix(), pool.get()), pool.get());
+	renderer.draw(P->topMatrix(), MV->topMatrix());
+	frameStats.add(secondsSince(submit_start), renderer.getDrawCalls());
 	
 	//////////////////////////////////////////////////////
 	// Cleanup
@@ -208,190 +207,744 @@ void renderGL()
 
 void saveParticles(const char *filename)
 {
-	ofstream out(filename);
-	if(!out.good()) {
-		cout << "Could not open " << filename << endl;
+	if(!sim.saveText(filename)) {
+		cout << "Could not write " << filename << endl;
 		return;
 	}
-	
-	// 1st line:
-	// <n> <h> <e2>
-	out << particles.size() << " " << h << " " << " " << e2 << endl;
-
-	// Rest of the lines:
-	// <mass> <position> <velocity> <color> <radius>
-	
-	//
-	// IMPLEMENT ME
-	//
-	
-	out.close();
 	cout << "Wrote galaxy to " << filename << endl;
 }
 
 void loadParticles(const char *filename)
 {
-	ifstream in;
-	in.open(filename);
-	if(!in.good()) {
+	if(!sim.loadText(filename)) {
 		cout << "Cannot read " << filename << endl;
 		return;
 	}
+	cout << "Loaded galaxy from " << filename << endl;
+}
 
-	// 1st line:
-	// <n> <h> <e2>
-	int n;
-	in >> n;
-	in >> h;
-	in >> e2;
-
-	// Rest of the lines:
-	// <mass> <position> <velocity> <color> <radius>
-   double mass, radius;
-   double x, y, z;
-   float  xf, yf, zf;
-   Vector3d position;
-   Vector3d velocity;
-   Vector3f color;
-   
-	
-   for (int ndx = 0; ndx < n; ndx++) {
-      in >> mass;
-      
-      // parse position
-      in >> x;
-      in >> y;
-      in >> z;
-      position << x, y, z;
-      
-      // parse velocity
-      in >> x;
-      in >> y;
-      in >> z;
-      velocity << x, y, z;
-      
-      // parse color
-      in >> xf;
-      in >> yf;
-      in >> zf;
-      color << xf, yf, zf;
-      
-      in >> radius;
-      auto p = make_shared<Particle>();
-      p->setMass(mass);
-      p->setPosition(position);
-      p->setVelocity(velocity);
-      p->setColor(color);
-      p->setRadius(radius);
-      
-      particles.push_back(p);
+/* Picks up a run from a binary snapshot */
+bool loadSnapshot(const char *filename)
+{
+   auto start = chrono::steady_clock::now();
+   Snapshot snap;
+   if (!readSnapshot(filename, snap)) {
+      return false;
+   }
+   Solver asked_solver = sim.solver;
+   Integrator::Scheme asked_scheme = sim.integrator.getScheme();
+   sim.restore(move(snap));
+   cout << "Loaded snapshot of " << sim.bodies.size() << " bodies at t = " << sim.t
+        << " from " << filename << " in " << secondsSince(start) << " s" << endl;
+   if (sim.solver != asked_solver || sim.integrator.getScheme() != asked_scheme) {
+      cout << "Carrying on with the snapshot's " << sim.solverName() << " and "
+           << schemeName(sim.integrator.getScheme()) << ", not the ones asked for" << endl;
    }
+   return true;
+}
 
-	in.close();
-	cout << "Loaded galaxy from " << filename << endl;
+Vector3f randomColor()
+{
+   return Vector3f(randRange(0.5, 1.0), randRange(0.5, 1.0), randRange(0.5, 1.0));
 }
 
 void createParticles()
 {
 	srand(0);
-	t = 0.0;
-	h = 1.0;
-   e2 = 1e-4;
+	sim.t = 0.0;
+	sim.h = 1.0;
+   sim.e2 = 1e-4;
    
    double r = 1.0;
    double a = 2.0;
    
-   auto heavy = make_shared<Particle>();
-   heavy->setMass(1e-3);
-   heavy->setPosition(Vector3d(0, 0, 0));
-   heavy->setVelocity(Vector3d(0, 0, 0));
-   
-   double y = sqrt(heavy->getMass() * (2/r - 1/a));
+   double heavy_mass = 1e-3;
+   sim.bodies.add(heavy_mass, Vector3d(0, 0, 0), Vector3d(0, 0, 0), randomColor(), randRange(0.1, 0.3));
    
-   auto light = make_shared<Particle>();
-   light->setMass(1e-6);
-   light->setPosition(Vector3d(r, 0, 0));
-   light->setVelocity(Vector3d(0, y, 0));
+   double y = sqrt(heavy_mass * (2/r - 1/a));
    
-   particles.push_back(heavy);
-   particles.push_back(light);
+   sim.bodies.add(1e-6, Vector3d(r, 0, 0), Vector3d(0, y, 0), randomColor(), randRange(0.1, 0.3));
 }
 
-#define G 1.0f
-
-/** TODO: PARALLELIZE */
 void stepParticles()
 {
-   // Stores the components of each particle's summed forces
-   vector<Vector3d> forces;
+   sim.step(pool.get());
+   if (particles.size() > (size_t)sim.bodies.size()) {
+      // Bodies were merged; the views of the ones at the end go
+      particles.resize(sim.bodies.size());
+   }
+}
+
+/* Relative errors of ax/ay/az against exact at the sampled particles, sorted */
+vector<double> sortedErrors(const vector<int> &sample, const vector<Vector3d> &exact,
+                            const vector<double> &ax, const vector<double> &ay, const vector<double> &az)
+{
+   vector<double> errors;
+   for (size_t k = 0; k < sample.size(); k++) {
+      double norm = exact[k].norm();
+      Vector3d a(ax[sample[k]], ay[sample[k]], az[sample[k]]);
+      errors.push_back(norm > 0 ? (a - exact[k]).norm() / norm : 0.0);
+   }
+   sort(errors.begin(), errors.end());
+   return errors;
+}
+
+/* Barnes-Hut against direct sum on the current particles, for a few opening
+ *  angles, and then the FMM for a few orders and opening angles. The direct
+ *  sum is only done for (up to) 1000 of the particles. */
+void reportAccuracy()
+{
+   int n = sim.bodies.size();
+   if (n == 0) {
+      cout << "No bodies to check" << endl;
+      return;
+   }
+   int stride = max(1, n / 1000);
    
-   for (int ndx = 0; ndx < particles.size(); ndx++) {
-      Vector3d curr_force(0, 0, 0);
-      forces.push_back(curr_force);
-      
-      // Compute forces from every other particle
-      for (int other_ndx = 0; other_ndx < particles.size(); other_ndx++) {
-         if (other_ndx == ndx) {
-            continue; // Don't influence yourself, you'll go blind
+   vector<int> sample;
+   vector<Vector3d> exact;
+   for (int ndx = 0; ndx < n; ndx += stride) {
+      Vector3d a;
+      directAccelerationsScalar(sim.bodies, sim.e2, ndx, ndx + 1, &a(0), &a(1), &a(2));
+      sample.push_back(ndx);
+      exact.push_back(a);
+   }
+   vector<double> ax(n), ay(n), az(n);
+   
+   cout << "Barnes-Hut vs direct sum, " << n << " bodies (" << sample.size() << " checked)" << endl;
+   cout << "theta     ms/step   interactions/body   rel. error: median       99%        max" << endl;
+   double thetas[] = {0.2, 0.35, 0.5, 0.7, 1.0};
+   double old_theta = sim.barnesHut.getTheta();
+   for (double theta : thetas) {
+      sim.barnesHut.setTheta(theta);
+      auto start = chrono::steady_clock::now();
+      sim.barnesHut.computeAccelerations(sim.bodies, sim.e2, &ax[0], &ay[0], &az[0], pool.get());
+      double ms = secondsSince(start) * 1e3;
+      vector<double> errors = sortedErrors(sample, exact, ax, ay, az);
+      printf("%5.2f %11.2f %19.0f %20.2e %10.2e %10.2e\n", theta, ms,
+             (double)sim.barnesHut.getNumInteractions() / n,
+             errors[errors.size() / 2], errors[errors.size() * 99 / 100], errors.back());
+   }
+   sim.barnesHut.setTheta(old_theta);
+   
+   cout << "FMM vs direct sum" << endl;
+   cout << "order theta     ms/step   M2L/body   P2P/body   rel. error: median       99%        max" << endl;
+   int orders[] = {1, 2, 4, 6, 8};
+   double fmm_thetas[] = {0.35, 0.5, 0.7};
+   int old_order = sim.fmm.getOrder();
+   old_theta = sim.fmm.getTheta();
+   for (int order : orders) {
+      for (double theta : fmm_thetas) {
+         sim.fmm.setOrder(order);
+         sim.fmm.setTheta(theta);
+         auto start = chrono::steady_clock::now();
+         sim.fmm.computeAccelerations(sim.bodies, sim.e2, &ax[0], &ay[0], &az[0], pool.get());
+         double ms = secondsSince(start) * 1e3;
+         vector<double> errors = sortedErrors(sample, exact, ax, ay, az);
+         printf("%5d %5.2f %11.2f %10.1f %10.0f %20.2e %10.2e %10.2e\n", order, theta, ms,
+                (double)sim.fmm.getNumM2L() / n, (double)sim.fmm.getNumP2P() / n,
+                errors[errors.size() / 2], errors[errors.size() * 99 / 100], errors.back());
+      }
+   }
+   sim.fmm.setOrder(old_order);
+   sim.fmm.setTheta(old_theta);
+}
+
+/* Particle mesh against direct sum on the current particles, for a few grid
+ *  sizes, with and without padding. The times are the second of two calls,
+ *  once the Green's function is set up. Without padding the box is periodic
+ *  and direct sum isn't, so there are only times. */
+void reportMesh()
+{
+   int n = sim.bodies.size();
+   if (n == 0) {
+      cout << "No bodies to check" << endl;
+      return;
+   }
+   int stride = max(1, n / 1000);
+   
+   vector<int> sample;
+   vector<Vector3d> exact;
+   for (int ndx = 0; ndx < n; ndx += stride) {
+      Vector3d a;
+      directAccelerationsScalar(sim.bodies, sim.e2, ndx, ndx + 1, &a(0), &a(1), &a(2));
+      sample.push_back(ndx);
+      exact.push_back(a);
+   }
+   vector<double> ax(n), ay(n), az(n);
+   
+   cout << "Particle mesh vs direct sum, " << n << " bodies (" << sample.size() << " checked)" << endl;
+   cout << "grid padding      cell     ms/step  deposit      FFT   interp.   rel. error: median       99%        max" << endl;
+   int grids[] = {16, 32, 64, 128};
+   for (int padding = 1; padding >= 0; padding--) {
+      for (int g : grids) {
+         ParticleMesh mesh;
+         mesh.setPadding(padding);
+         mesh.setGridSize(g);
+         mesh.computeAccelerations(sim.bodies, sim.e2, &ax[0], &ay[0], &az[0], pool.get());
+         auto start = chrono::steady_clock::now();
+         mesh.computeAccelerations(sim.bodies, sim.e2, &ax[0], &ay[0], &az[0], pool.get());
+         double ms = secondsSince(start) * 1e3;
+         printf("%4d %7s %9.4f %11.2f %8.2f %8.2f %9.2f", g, padding ? "yes" : "no",
+                mesh.getCellSize(), ms, mesh.getDepositSeconds() * 1e3, mesh.getFFTSeconds() * 1e3,
+                mesh.getInterpolateSeconds() * 1e3);
+         if (padding) {
+            vector<double> errors = sortedErrors(sample, exact, ax, ay, az);
+            printf(" %20.2e %10.2e %10.2e\n", errors[errors.size() / 2], errors[errors.size() * 99 / 100], errors.back());
+         }
+         else {
+            printf("\n");
+         }
+      }
+   }
+}
+
+/* CPU side of drawing 1k to 1M random particles: sorting them back to front
+ *  and packing the instance buffer, which is one draw call whatever the
+ *  count (it used to be one per particle). The sort is timed from scratch,
+ *  and with the camera turning a little each frame, when the last order is
+ *  reused. Needs no window, so the GL calls themselves aren't timed here;
+ *  toggle 'f' in the viewer for those. */
+float depthIn(const Matrix4f &V, size_t i)
+{
+   return V(2, 0) * (float)sim.bodies.x[i] + V(2, 1) * (float)sim.bodies.y[i] + V(2, 2) * (float)sim.bodies.z[i] + V(2, 3);
+}
+
+void reportRendering()
+{
+   int sizes[] = {1000, 10000, 100000, 1000000};
+   cout << "particles  radix ms  coherent ms    pack ms   draw calls (was)" << endl;
+   for (int n : sizes) {
+      sim.bodies.clear();
+      particles.clear();
+      sim.createUniform(n, 0);
+      for (int i = 0; i < n; i++) {
+         particles.push_back(make_shared<Particle>(&sim.bodies, i));
+      }
+      // Enough frames that the small counts take a measurable time
+      int frames = max(3, 100000 / n);
+      DepthSorter fresh, coherent;
+      fresh.setCoherence(0.0f);
+      ParticleRenderer packer;
+      double radix_s = 0, coherent_s = 0, pack_s = 0;
+      int reused = 0;
+      bool sorted = true;
+      for (int f = 0; f < frames; f++) {
+         // Looking at the origin from 5 units away, turning 0.01 degrees a frame
+         Matrix4f V = Matrix4f::Identity();
+         V.topLeftCorner<3,3>() = AngleAxisf(f * 0.01f * (float)M_PI / 180.0f, Vector3f::UnitY()).toRotationMatrix();
+         V(2, 3) = -5.0f;
+         auto start = chrono::steady_clock::now();
+         fresh.sort(sim.bodies, V, pool.get());
+         radix_s += secondsSince(start);
+         start = chrono::steady_clock::now();
+         const vector<size_t> &order = coherent.sort(sim.bodies, V, pool.get());
+         coherent_s += secondsSince(start);
+         reused += coherent.wasIncremental();
+         // Ties can come out in either order, so check the depths
+         for (size_t k = 0; k < order.size(); k++) {
+            sorted = sorted && depthIn(V, order[k]) == depthIn(V, fresh.getOrder()[k]);
          }
-         
-         double mi = particles[ndx]->getMass();
-         double mj = particles[other_ndx]->getMass();
-         
-         Vector3d diff = particles[other_ndx]->getPosition() - particles[ndx]->getPosition();
-         
-         // this is the scalar junk underneath the 'Gmimj' term
-         double scalar_divisor = pow ( diff.norm() * diff.norm() + e2, 3.0/2.0);
-         
-         Vector3d curr_result = G * mi * mj / scalar_divisor * diff;
-         forces[ndx] += curr_result;
+         start = chrono::steady_clock::now();
+         packer.update(sim.bodies, order, pool.get());
+         pack_s += secondsSince(start);
       }
+      printf("%9d %9.3f %12.3f %10.3f %12d (%d)   reused %d/%d frames%s\n", n, radix_s / frames * 1e3,
+             coherent_s / frames * 1e3, pack_s / frames * 1e3, 1, n, reused, frames,
+             sorted ? "" : ", ORDERS DIFFER");
+   }
+}
+
+/* Kinetic plus potential energy, for G = 1 */
+double totalEnergy()
+{
+   return sim.energy(pool.get());
+}
+
+/* Each integrator from the current state for the same physical time,
+ *  steps * h: wall time, accelerations computed per body, and how much the
+ *  total energy drifted. Leapfrog is also run with the block scheme's
+ *  smallest step for everyone, which is what a single global step would
+ *  need to be as fine as the block scheme where it matters. */
+void reportIntegrators(int steps)
+{
+   int n = sim.bodies.size();
+   Bodies start_state = sim.bodies;
+   double start_h = sim.h;
+   double e0 = totalEnergy();
+   int levels = sim.integrator.getMaxLevel();
+   Integrator::Scheme old_scheme = sim.integrator.getScheme();
+   
+   cout << n << " bodies, " << sim.solverName() << ", t = " << steps * sim.h << " (" << steps << " steps of " << sim.h << ")" << endl;
+   cout << "integrator           step          wall s   forces/body      |dE/E|" << endl;
+   struct Run {
+      const char *name;
+      Integrator::Scheme scheme;
+      int substeps;
+   };
+   Run runs[] = {
+      {"Euler", Integrator::EULER, 1},
+      {"leapfrog", Integrator::LEAPFROG, 1},
+      {"leapfrog", Integrator::LEAPFROG, 1 << levels},
+      {"block leapfrog", Integrator::BLOCK, 1},
+   };
+   for (const Run &run : runs) {
+      sim.bodies = start_state;
+      sim.h = start_h / run.substeps;
+      sim.integrator.setScheme(run.scheme);
+      long long forces = sim.integrator.getNumForces();
+      auto start = chrono::steady_clock::now();
+      // The integrator on its own, so merging doesn't change what is compared
+      auto accelerations = [](const vector<int> *active) { return sim.computeForces(active, pool.get()); };
+      for (int k = 0; k < steps * run.substeps; k++) {
+         sim.integrator.step(sim.bodies, sim.h, sim.e2, accelerations, pool.get());
+      }
+      double seconds = secondsSince(start);
+      double drift = fabs((totalEnergy() - e0) / e0);
+      char step[32];
+      if (run.scheme == Integrator::BLOCK) {
+         snprintf(step, sizeof(step), "h/1..h/%d", 1 << levels);
+      }
+      else {
+         snprintf(step, sizeof(step), run.substeps > 1 ? "h/%d" : "h", run.substeps);
+      }
+      printf("%-15s %10s %14.3f %13.1f %11.2e\n", run.name, step, seconds,
+             (double)(sim.integrator.getNumForces() - forces) / n, drift);
+   }
+   cout << "bodies per block level (h/2^level):";
+   for (int count : sim.integrator.getLevelCounts()) {
+      cout << " " << count;
+   }
+   cout << endl;
+   sim.bodies = start_state;
+   sim.h = start_h;
+   sim.integrator.setScheme(old_scheme);
+}
+
+/* Strong scaling: the same steps with 1, 2, 4, ... threads up to max_threads,
+ *  each from the same starting state. Also checks that every thread count
+ *  ends up with the same positions as 1 thread. */
+void reportScaling(int steps, int max_threads)
+{
+   int n = sim.bodies.size();
+   Bodies start_state = sim.bodies;
+   
+   vector<int> thread_counts;
+   for (int T = 1; T < max_threads; T *= 2) {
+      thread_counts.push_back(T);
    }
+   thread_counts.push_back(max_threads);
    
-   // Apply forces to particles
-   for (int ndx = 0; ndx < particles.size(); ndx++) {
-      // Update velocity
-      double h_m_inverse = h * 1/particles[ndx]->getMass();
-      Vector3d new_velocity = particles[ndx]->getVelocity() + h_m_inverse * forces[ndx];
+   cout << n << " bodies, " << steps << " steps, " << sim.solverName() << endl;
+   cout << "threads    s/step   speedup   efficiency   max |x - x(1 thread)|" << endl;
+   vector<Vector3d> x1(n);
+   double base = 0;
+   for (int T : thread_counts) {
+      sim.bodies = start_state;
+      sim.integrator.reset();
+      pool = make_shared<ThreadPool>(T);
+      auto start = chrono::steady_clock::now();
+      for (int k = 0; k < steps; k++) {
+         stepParticles();
+      }
+      double per_step = secondsSince(start) / steps;
       
-      particles[ndx]->setVelocity(new_velocity);
+      double diff = 0;
+      for (int ndx = 0; ndx < n; ndx++) {
+         if (T == 1) {
+            x1[ndx] = sim.bodies.getPosition(ndx);
+         }
+         diff = max(diff, (sim.bodies.getPosition(ndx) - x1[ndx]).norm());
+      }
+      if (T == 1) {
+         base = per_step;
+      }
+      printf("%7d %9.4f %9.2f %11.0f%% %23.3g\n", T, per_step, base / per_step, 100 * base / per_step / T, diff);
+   }
+}
+
+/* Pair interactions per second of the direct-sum variants on one thread,
+ *  and how far their answers are from the plain scalar loop. The symmetric
+ *  ones count each pair they visit twice, since it moves both bodies. */
+void reportKernels()
+{
+   int n = sim.bodies.size();
+   vector<double> ax[4], ay[4], az[4];
+   const char *names[4] = {"scalar", "SIMD", "symmetric scalar", "symmetric SIMD"};
+   cout << "Direct sum, " << n << " bodies, 1 thread"
+        << (haveAVX2() ? "" : " (no AVX2, SIMD is scalar)") << endl;
+   double base_rate = 0;
+   for (int k = 0; k < 4; k++) {
+      ax[k].resize(n);
+      ay[k].resize(n);
+      az[k].resize(n);
+      DirectSum kernel;
+      kernel.setSIMD(k % 2 == 1);
+      kernel.setSymmetric(k >= 2);
+      auto start = chrono::steady_clock::now();
+      kernel.computeAccelerations(sim.bodies, sim.e2, &ax[k][0], &ay[k][0], &az[k][0]);
+      double rate = (double)n * (n - 1) / secondsSince(start);
+      if (k == 0) {
+         base_rate = rate;
+      }
       
-      // Update position
-      Vector3d new_position = particles[ndx]->getPosition() + h * new_velocity;
-      particles[ndx]->setPosition(new_position);
+      double max_error = 0;
+      for (int i = 0; i < n; i++) {
+         Vector3d a0(ax[0][i], ay[0][i], az[0][i]);
+         Vector3d a1(ax[k][i], ay[k][i], az[k][i]);
+         if (a0.norm() > 0) {
+            max_error = max(max_error, (a1 - a0).norm() / a0.norm());
+         }
+      }
+      printf("%18s: %9.1f M pairs/s %6.2fx, max relative difference %.2g\n",
+             names[k], rate * 1e-6, rate / base_rate, max_error);
    }
 }
 
+/* Finding and merging touching bodies in the two-disk collision, 100k to 1M
+ *  bodies, with contact at --merge's scale (or 0.001) times the radii. The
+ *  first pass merges; the second only finds what is left touching, which is
+ *  what most steps cost. Mass and momentum should come out the same. */
+void reportCollisions()
+{
+   int sizes[] = {100000, 300000, 1000000};
+   double scale = sim.merging ? sim.collisions.getScale() : 0.001;
+   cout << "contact at " << scale << " x (r_i + r_j), " << pool->getNumThreads() << " threads" << endl;
+   cout << "   bodies    pairs   merged   detect ms    merge ms   again ms   |dm|      |dp|/|p|" << endl;
+   for (int n : sizes) {
+      Simulation s;
+      s.create(MODEL_COLLISION, n, 1);
+      s.collisions.setScale(scale);
+      double m0 = 0;
+      Vector3d p0(0, 0, 0);
+      for (int ndx = 0; ndx < s.bodies.size(); ndx++) {
+         m0 += s.bodies.m[ndx];
+         p0 += s.bodies.m[ndx] * s.bodies.getVelocity(ndx);
+      }
+      int merged = s.collisions.merge(s.bodies, pool.get());
+      int pairs = s.collisions.getNumPairs();
+      double detect = s.collisions.getDetectSeconds();
+      double merge = s.collisions.getMergeSeconds();
+      s.collisions.merge(s.bodies, pool.get());
+      double again = s.collisions.getDetectSeconds() + s.collisions.getMergeSeconds();
+      double m1 = 0;
+      Vector3d p1(0, 0, 0);
+      double p_scale = 0;
+      for (int ndx = 0; ndx < s.bodies.size(); ndx++) {
+         m1 += s.bodies.m[ndx];
+         p1 += s.bodies.m[ndx] * s.bodies.getVelocity(ndx);
+         p_scale += s.bodies.m[ndx] * s.bodies.getVelocity(ndx).norm();
+      }
+      printf("%9d %8d %8d %11.2f %11.2f %10.2f   %-9.2g %.2g\n", n, pairs, merged, detect * 1e3, merge * 1e3,
+             again * 1e3, fabs(m1 - m0), (p1 - p0).norm() / p_scale);
+   }
+}
+
+/* Every run in the manifest, side by side on the pool, with the results in
+ *  one file. */
+bool runEnsemble(const char *manifest_file, string results_file, int steps)
+{
+   Ensemble ensemble;
+   if (steps > 0) {
+      ensemble.setDefaultSteps(steps);
+   }
+   if (!ensemble.readManifest(manifest_file)) {
+      return false;
+   }
+   if (results_file.empty()) {
+      results_file = manifest_file + string(".csv");
+   }
+   cout << "Running " << ensemble.getRuns().size() << " simulations on " << pool->getNumThreads() << " threads" << endl;
+   ensemble.run(pool.get());
+   double body_steps = 0;
+   int failed = 0;
+   for (const EnsembleRun &r : ensemble.getRuns()) {
+      if (r.error.empty()) {
+         body_steps += (double)r.n * r.steps;
+      } else {
+         cout << r.name << ": " << r.error << endl;
+         failed++;
+      }
+   }
+   double seconds = ensemble.getSeconds();
+   cout << seconds << " s, " << ensemble.getRuns().size() / seconds << " runs/s, "
+        << body_steps / seconds << " body steps/s";
+   if (failed > 0) {
+      cout << ", " << failed << " failed";
+   }
+   cout << endl;
+   if (!ensemble.writeResults(results_file)) {
+      return false;
+   }
+   cout << "Wrote results to " << results_file << endl;
+   return true;
+}
+
+void printUsage()
+{
+   cout << "Usage: Lab09 <RESOURCE_DIR> <(OPTIONAL) INPUT FILE> [options]" << endl;
+   cout << "   or: Lab09 <#steps>       <(OPTIONAL) INPUT FILE> [options]" << endl;
+   cout << "Options:" << endl;
+   cout << "   --solver direct|bh|fmm|pm force calculation (default direct)" << endl;
+   cout << "   --theta <theta>      Barnes-Hut and FMM opening angle (default 0.5)" << endl;
+   cout << "   --order <p>          FMM expansion order, 1 to 8 (default 4)" << endl;
+   cout << "   --grid <g>           particle mesh nodes per side, a power of two (default 64)" << endl;
+   cout << "   --padding on|off     particle mesh: isolated (on, default) or periodic box" << endl;
+   cout << "   --uniform <n>        n random bodies instead of an input file" << endl;
+   cout << "   --plummer <n>        n bodies in a Plummer sphere instead" << endl;
+   cout << "   --disk <n>           n bodies in an exponential disk instead" << endl;
+   cout << "   --collision <n>      two disks of n/2 bodies about to collide instead" << endl;
+   cout << "   --accuracy           compare Barnes-Hut and FMM to direct sum before running" << endl;
+   cout << "   --threads <n>        worker threads (default: one per core)" << endl;
+   cout << "   --scaling            time the steps with 1, 2, 4, ... threads instead" << endl;
+   cout << "   --scalar             direct sum without the AVX2 kernels" << endl;
+   cout << "   --naive              direct sum over every ordered pair instead of half" << endl;
+   cout << "   --kernels            compare the direct-sum kernels before running" << endl;
+   cout << "   --mesh               compare particle mesh grid sizes to direct sum before running" << endl;
+   cout << "   --integrator euler|leapfrog|block  time stepping (default euler)" << endl;
+   cout << "   --levels <n>         block steps go down to h/2^n (default 6)" << endl;
+   cout << "   --eta <eta>          block step accuracy, dt = eta sqrt(softening/|a|) (default 0.02)" << endl;
+   cout << "   --integrators        compare the integrators over the same time instead" << endl;
+   cout << "   --render             time sorting and packing 1k to 1M particles for drawing instead" << endl;
+   cout << "   --checkpoint <file>  write a binary snapshot at the end of the run" << endl;
+   cout << "   --every <k>          and every k steps along the way, in the background" << endl;
+   cout << "   --save <file>        write the particles as text at the end of the run" << endl;
+   cout << "   --ensemble <file>    run every simulation in a manifest instead, <#steps> each by default" << endl;
+   cout << "   --results <file>     where the ensemble's results go (default <manifest>.csv)" << endl;
+   cout << "   --bench <file>       time every model, size, solver and thread count, <#steps> each, to JSON" << endl;
+   cout << "   --sizes <n,n,...>    benchmark body counts (default 1000,10000,100000)" << endl;
+   cout << "   --models <m,m,...>   benchmark models: plummer,disk,collision,uniform (default the first three)" << endl;
+   cout << "   --merge <s>          merge bodies closer than s times the sum of their radii after each step" << endl;
+   cout << "   --collisions         time finding and merging touching bodies at 100k to 1M instead" << endl;
+   cout << "   --quiet              don't print the particles at the end" << endl;
+   cout << "A binary snapshot can be given as the input file to carry on where it stopped." << endl;
+}
+
 int main(int argc, char **argv)
 {
-	if(argc != 2 && argc != 3) {
+	if(argc < 2) {
 		// Wrong number of arguments
-		cout << "Usage: Lab09 <RESOURCE_DIR> <(OPTIONAL) INPUT FILE>" << endl;
-		cout << "   or: Lab09 <#steps>       <(OPTIONAL) INPUT FILE>" << endl;
+		printUsage();
 		exit(0);
 	}
+	// Anything after the (optional) input file is an option
+	int argi = 2;
+	const char *input_file = 0;
+	if(argc > 2 && argv[2][0] != '-') {
+		input_file = argv[2];
+		argi = 3;
+	}
+	int uniform_n = 0;
+	int num_threads = 0;
+	bool accuracy = false;
+	bool scaling = false;
+	bool kernels = false;
+	bool mesh = false;
+	bool integrators = false;
+	bool render = false;
+	const char *checkpoint_file = 0;
+	int checkpoint_every = 0;
+	const char *save_file = 0;
+	const char *manifest_file = 0;
+	string results_file;
+	const char *bench_file = 0;
+	bool collisions = false;
+	Benchmark benchmark;
+	Model model = MODEL_UNIFORM;
+	for(; argi < argc; ++argi) {
+		string opt = argv[argi];
+		bool has_value = argi + 1 < argc;
+		if(opt == "--solver" && has_value) {
+			if(!parseSolver(argv[++argi], sim.solver)) {
+				cout << "Unknown solver " << argv[argi] << endl;
+				printUsage();
+				return 1;
+			}
+		} else if(opt == "--theta" && has_value) {
+			double theta = atof(argv[++argi]);
+			sim.barnesHut.setTheta(theta);
+			sim.fmm.setTheta(theta);
+		} else if(opt == "--order" && has_value) {
+			sim.fmm.setOrder(atoi(argv[++argi]));
+		} else if(opt == "--grid" && has_value) {
+			sim.particleMesh.setGridSize(atoi(argv[++argi]));
+		} else if(opt == "--padding" && has_value) {
+			sim.particleMesh.setPadding(string(argv[++argi]) != "off");
+		} else if(opt == "--uniform" && has_value) {
+			uniform_n = atoi(argv[++argi]);
+			model = MODEL_UNIFORM;
+		} else if((opt == "--plummer" || opt == "--disk" || opt == "--collision") && has_value) {
+			parseModel(opt.substr(2), model);
+			uniform_n = atoi(argv[++argi]);
+		} else if(opt == "--threads" && has_value) {
+			num_threads = atoi(argv[++argi]);
+		} else if(opt == "--accuracy") {
+			accuracy = true;
+		} else if(opt == "--scaling") {
+			scaling = true;
+		} else if(opt == "--scalar") {
+			sim.directSum.setSIMD(false);
+		} else if(opt == "--naive") {
+			sim.directSum.setSymmetric(false);
+		} else if(opt == "--kernels") {
+			kernels = true;
+		} else if(opt == "--mesh") {
+			mesh = true;
+		} else if(opt == "--integrator" && has_value) {
+			Integrator::Scheme scheme = Integrator::EULER;
+			if(!parseScheme(argv[++argi], scheme)) {
+				cout << "Unknown integrator " << argv[argi] << endl;
+				printUsage();
+				return 1;
+			}
+			sim.integrator.setScheme(scheme);
+			benchmark.setScheme(scheme);
+		} else if(opt == "--levels" && has_value) {
+			sim.integrator.setMaxLevel(max(0, min(20, atoi(argv[++argi]))));
+		} else if(opt == "--eta" && has_value) {
+			sim.integrator.setEta(atof(argv[++argi]));
+		} else if(opt == "--integrators") {
+			integrators = true;
+		} else if(opt == "--render") {
+			render = true;
+		} else if(opt == "--checkpoint" && has_value) {
+			checkpoint_file = argv[++argi];
+		} else if(opt == "--every" && has_value) {
+			checkpoint_every = atoi(argv[++argi]);
+		} else if(opt == "--save" && has_value) {
+			save_file = argv[++argi];
+		} else if(opt == "--ensemble" && has_value) {
+			manifest_file = argv[++argi];
+		} else if(opt == "--results" && has_value) {
+			results_file = argv[++argi];
+		} else if(opt == "--merge" && has_value) {
+			sim.merging = true;
+			sim.collisions.setScale(atof(argv[++argi]));
+		} else if(opt == "--collisions") {
+			collisions = true;
+		} else if(opt == "--bench" && has_value) {
+			bench_file = argv[++argi];
+		} else if(opt == "--sizes" && has_value) {
+			stringstream list(argv[++argi]);
+			vector<int> sizes;
+			for(string item; getline(list, item, ',');) {
+				sizes.push_back(atoi(item.c_str()));
+			}
+			benchmark.setSizes(sizes);
+		} else if(opt == "--models" && has_value) {
+			stringstream list(argv[++argi]);
+			vector<Model> models;
+			for(string item; getline(list, item, ',');) {
+				Model m;
+				if(!parseModel(item, m)) {
+					cout << "Unknown model " << item << endl;
+					printUsage();
+					return 1;
+				}
+				models.push_back(m);
+			}
+			benchmark.setModels(models);
+		} else if(opt == "--quiet") {
+			quiet = true;
+		} else {
+			// Also where a trailing option that takes a value ends up
+			cout << "Unknown option, or no value for it: " << opt << endl;
+			printUsage();
+			return 1;
+		}
+	}
+	pool = make_shared<ThreadPool>(num_threads);
+	if(manifest_file) {
+		return runEnsemble(manifest_file, results_file, atoi(argv[1])) ? 0 : 1;
+	}
+	if(collisions) {
+		reportCollisions();
+		return 0;
+	}
+	if(bench_file) {
+		benchmark.setSteps(max(1, atoi(argv[1])));
+		benchmark.setMaxThreads(num_threads > 0 ? num_threads : (int)thread::hardware_concurrency());
+		benchmark.run();
+		if(!benchmark.writeJSON(bench_file)) {
+			return 1;
+		}
+		cout << "Wrote " << benchmark.getResults().size() << " runs to " << bench_file << endl;
+		return 0;
+	}
 	// Create the particles...
-	if(argc == 2) {
+	if(uniform_n > 0) {
+		// ... randomly
+		sim.create(model, uniform_n, 0);
+	} else if(!input_file) {
 		// ... without input file
 		createParticles();
+	} else if(isSnapshot(input_file)) {
+		// ... from where an earlier run stopped
+		if(!loadSnapshot(input_file)) {
+			return 1;
+		}
 	} else {
 		// ... with input file
-		loadParticles(argv[2]);
+		loadParticles(input_file);
+	}
+	if(kernels) {
+		reportKernels();
+	}
+	if(accuracy) {
+		reportAccuracy();
+	}
+	if(mesh) {
+		reportMesh();
+	}
+	if(render) {
+		reportRendering();
+		return 0;
 	}
 	try {
 		// Try parsing `steps`
 		int steps = stoi(argv[1]);
 		// Success!
-		cout << "Running without OpenGL for " << steps << " steps" << endl;
+		if(scaling) {
+			reportScaling(steps, num_threads > 0 ? num_threads : (int)thread::hardware_concurrency());
+			return 0;
+		}
+		if(integrators) {
+			reportIntegrators(steps);
+			return 0;
+		}
+		cout << "Running without OpenGL for " << steps << " steps (" << pool->getNumThreads() << " threads)" << endl;
 		// Run without OpenGL
+		auto start = chrono::steady_clock::now();
 		for(int k = 0; k < steps; ++k) {
 			stepParticles();
+			if(checkpoint_file && checkpoint_every > 0 && (k + 1) % checkpoint_every == 0 && k + 1 < steps) {
+				snapshotWriter.write(checkpoint_file, sim.takeSnapshot());
+			}
+		}
+		double seconds = secondsSince(start);
+		cout << sim.bodies.size() << " bodies, " << sim.solverName()
+		     << ": " << seconds << " s, " << steps / seconds << " steps/s" << endl;
+		if(sim.merging) {
+			cout << sim.merged << " bodies merged away" << endl;
+		}
+		if(checkpoint_file) {
+			start = chrono::steady_clock::now();
+			snapshotWriter.write(checkpoint_file, sim.takeSnapshot());
+			if(snapshotWriter.wait()) {
+				cout << "Wrote snapshot at t = " << sim.t << " to " << checkpoint_file
+				     << " in " << secondsSince(start) << " s" << endl;
+			}
+		}
+		if(save_file) {
+			saveParticles(save_file);
 		}
       
-      cout << "Particle positions: " << endl;
-      for (int ndx = 0; ndx < particles.size(); ndx++) {
-         Vector3d posn = particles[ndx]->getPosition();
-         cout << ndx << ": " << "(" << posn.x() << ", " << posn.y() << ", " << posn.z() << ")" << endl;
+      if (!quiet) {
+         cout << "Particle positions: " << endl;
+         for (int ndx = 0; ndx < sim.bodies.size(); ndx++) {
+            Vector3d posn = sim.bodies.getPosition(ndx);
+            cout << ndx << ": " << "(" << posn.x() << ", " << posn.y() << ", " << posn.z() << ")" << endl;
+         }
       }
       
 	} catch(const invalid_argument& ia) {
@@ -449,6 +1002,6 @@ int main(int argc, char **argv)
 		glfwDestroyWindow(window);
 		glfwTerminate();
 	}
-	cout << "Elapsed time: " << (t*3.261539827498732e6) << " years" << endl;
+	cout << "Elapsed time: " << (sim.t*3.261539827498732e6) << " years" << endl;
 	return 0;
 }
@@ -0,0 +1,20 @@
+uniform vec3 UaColor;
+uniform vec3 UdColor;
+varying vec3 vH;
+varying vec3 vNor;
+varying vec3 vLight;
+varying vec3 vTint;
+
+void main()
+{
+   vec3 newH = normalize(vH);
+   vec3 newNor = normalize(vNor);
+   vec3 newLight = normalize(vLight);
+   vec3 ambient = UaColor * vTint;
+   vec3 diffuse = UdColor * vTint;
+   
+   vec3 lDiffuseColor = vec3(1.0, 1.0, 1.0) * max(0.0, dot(newNor, newLight)) * diffuse;
+   vec3 lAmbientColor = vec3(1.0, 1.0, 1.0) * ambient;
+   vec3 lSpecularColor = vec3(1.0, 1.0, 1.0) * diffuse * max(0.0, dot(newNor, newH));
+   gl_FragColor = vec4(lDiffuseColor + lAmbientColor + lSpecularColor, 1.0);
+}
@@ -0,0 +1,48 @@
+attribute vec3 aPosition;
+attribute vec3 aNormal;
+
+// Per helicopter
+attribute mat4 aModel;
+attribute vec4 aTint; // rgb scales the part colors, a is the propellor phase in seconds
+
+uniform mat4 uProjMatrix;
+uniform mat4 uViewMatrix;
+uniform float uTime;
+uniform float uSpinRate; // radians per second, 0 for parts that don't spin
+uniform vec3 uSpinAxis;
+uniform vec3 uSpinPivot;
+
+varying vec3 vNor;
+varying vec3 vLight;
+varying vec3 vH;
+varying vec3 vTint;
+
+// Rodrigues' rotation about a unit axis
+vec3 rotate(vec3 v, vec3 axis, float angle)
+{
+   float c = cos(angle);
+   float s = sin(angle);
+   return v * c + cross(axis, v) * s + axis * dot(axis, v) * (1.0 - c);
+}
+
+void main()
+{
+   float angle = uSpinRate * (uTime + aTint.a);
+   vec3 pos = uSpinPivot + rotate(aPosition - uSpinPivot, uSpinAxis, angle);
+   vec3 nor = rotate(aNormal, uSpinAxis, angle);
+   
+   mat4 MV = uViewMatrix * aModel;
+   gl_Position = uProjMatrix * MV * vec4(pos, 1.0);
+   
+   vec3 newPos = normalize(vec3(MV * vec4(pos, 0.0)));
+   vec3 newNorm = normalize(vec3(MV * vec4(nor, 0.0)));
+   vec3 newLight = normalize(vec3(0.0, 0.5, 0.0));
+   
+   vec3 V = normalize(vec3(0.0, 0.0, 0.0) - newPos);
+   vec3 H = normalize(newLight + V);
+   
+   vNor = newNorm;
+   vLight = newLight;
+   vH = H;
+   vTint = aTint.rgb;
+}
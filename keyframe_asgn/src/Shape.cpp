@@ -77,6 +77,16 @@ void Shape::init()
 }
 
 void Shape::draw(const shared_ptr<Program> prog) const
+{
+	drawElements(prog, 0);
+}
+
+void Shape::drawInstanced(const shared_ptr<Program> prog, int count) const
+{
+	drawElements(prog, count);
+}
+
+void Shape::drawElements(const shared_ptr<Program> prog, int instances) const
 {
 	// Bind position buffer
 	int h_pos = prog->getAttribute("aPosition");
@@ -104,7 +114,11 @@ void Shape::draw(const shared_ptr<Program> prog) const
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, eleBufID);
 	
 	// Draw
-	glDrawElements(GL_TRIANGLES, (int)eleBuf.size(), GL_UNSIGNED_INT, (const void *)0);
+	if(instances > 0) {
+		glDrawElementsInstanced(GL_TRIANGLES, (int)eleBuf.size(), GL_UNSIGNED_INT, (const void *)0, instances);
+	} else {
+		glDrawElements(GL_TRIANGLES, (int)eleBuf.size(), GL_UNSIGNED_INT, (const void *)0);
+	}
 	
 	// Disable and unbind
 	if(h_tex != -1) {
@@ -16,8 +16,13 @@ public:
 	void loadMesh(const std::string &meshName);
 	void init();
 	void draw(const std::shared_ptr<Program> prog) const;
+	// Draws count instances with one call. Per-instance attributes (with
+	// glVertexAttribDivisor) are up to the caller.
+	void drawInstanced(const std::shared_ptr<Program> prog, int count) const;
 	
 private:
+	void drawElements(const std::shared_ptr<Program> prog, int instances) const;
+	
 	std::vector<unsigned int> eleBuf;
 	std::vector<float> posBuf;
 	std::vector<float> norBuf;
@@ -0,0 +1,108 @@
+#include "ThreadPool.h"
+
+#include <atomic>
+#include <algorithm>
+
+using namespace std;
+
+ThreadPool::ThreadPool(int nthreads) :
+	nthreads(nthreads),
+	generation(0),
+	pending(0),
+	quit(false)
+{
+	if(this->nthreads <= 0) {
+		this->nthreads = max(1, (int)thread::hardware_concurrency());
+	}
+	// Thread 0 is the caller, so we only need nthreads-1 workers.
+	for(int t = 1; t < this->nthreads; ++t) {
+		workers.push_back(thread(&ThreadPool::workerLoop, this, t));
+	}
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		lock_guard<mutex> lock(mtx);
+		quit = true;
+	}
+	startCond.notify_all();
+	for(auto &w : workers) {
+		w.join();
+	}
+}
+
+void ThreadPool::workerLoop(int thread)
+{
+	unsigned seen = 0;
+	while(true) {
+		function<void(int)> myJob;
+		{
+			unique_lock<mutex> lock(mtx);
+			startCond.wait(lock, [&]{ return quit || generation != seen; });
+			if(quit) {
+				return;
+			}
+			seen = generation;
+			myJob = job;
+		}
+		myJob(thread);
+		{
+			lock_guard<mutex> lock(mtx);
+			if(--pending == 0) {
+				doneCond.notify_one();
+			}
+		}
+	}
+}
+
+void ThreadPool::dispatch(const function<void(int)> &job)
+{
+	if(nthreads == 1) {
+		job(0);
+		return;
+	}
+	{
+		lock_guard<mutex> lock(mtx);
+		this->job = job;
+		pending = nthreads - 1;
+		++generation;
+	}
+	startCond.notify_all();
+	job(0);
+	unique_lock<mutex> lock(mtx);
+	doneCond.wait(lock, [&]{ return pending == 0; });
+}
+
+void ThreadPool::parallelFor(int n, const function<void(int, int, int)> &fn)
+{
+	if(n <= 0) {
+		return;
+	}
+	int T = nthreads;
+	dispatch([&](int t) {
+		int begin = (int)((long long)n * t / T);
+		int end = (int)((long long)n * (t + 1) / T);
+		if(begin < end) {
+			fn(begin, end, t);
+		}
+	});
+}
+
+void ThreadPool::parallelForDynamic(int n, int grain, const function<void(int, int, int)> &fn)
+{
+	if(n <= 0) {
+		return;
+	}
+	grain = max(1, grain);
+	atomic<int> next(0);
+	dispatch([&](int t) {
+		while(true) {
+			int begin = next.fetch_add(grain);
+			if(begin >= n) {
+				break;
+			}
+			fn(begin, min(n, begin + grain), t);
+		}
+	});
+}
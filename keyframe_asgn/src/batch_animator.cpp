@@ -0,0 +1,91 @@
+//
+//  batch_animator.cpp
+//  Asgn1
+//
+
+#include "batch_animator.hpp"
+#include "ThreadPool.h"
+
+#include <cmath>
+
+using namespace std;
+using namespace Eigen;
+
+// Objects per chunk handed to a thread. Big enough that grabbing a chunk
+//  is nothing next to evaluating it.
+#define GRAIN 1024
+
+int BatchAnimator::addPath(const Spline& spline, float tolerance, ThreadPool *pool) {
+   Path path;
+   path.spline = spline;
+   vector<pair<float,float> > usTable;
+   path.length = buildTable(&usTable, spline, tolerance, pool);
+   // 8 times the exact table's entries keeps it about as accurate
+   path.s2u.build(usTable, 8 * (int)usTable.size());
+   paths.push_back(path);
+   return (int)paths.size() - 1;
+}
+
+int BatchAnimator::addObject(int path, float offset, float speed) {
+   path_id.push_back(path);
+   this->speed.push_back(speed);
+   time_offset.push_back(speed != 0.0f ? offset / speed : 0.0f);
+   return (int)path_id.size() - 1;
+}
+
+void BatchAnimator::evaluateRange(int begin, int end, double t, float *transforms, int stride) const {
+   for (int i = begin; i < end; i++) {
+      const Path& path = paths[path_id[i]];
+      
+      // Distance along the path, wrapped around to loop
+      double s = fmod((t + time_offset[i]) * speed[i], (double)path.length);
+      if (s < 0.0) {
+         s += path.length;
+      }
+      float u = path.s2u.lookup((float)s);
+      Vector3f pos = path.spline.evaluate(u);
+      Vector3f forward = path.spline.evaluateDerivative(u);
+      if (forward.squaredNorm() < 1e-12f) {
+         // Stopped for an instant (a cusp, or control points on top of each
+         // other), but the points just before and after still say which way
+         const float du = 1e-3f;
+         forward = path.spline.evaluate(min(u + du, (float)path.spline.getNumSegments())) -
+                   path.spline.evaluate(max(u - du, 0.0f));
+      }
+      
+      Map<Matrix4f> M(transforms + (size_t)i * stride);
+      M.block<3, 1>(0, 3) = pos;
+      M.row(3) << 0.0f, 0.0f, 0.0f, 1.0f;
+      if (forward.squaredNorm() < 1e-12f) {
+         // Nowhere to point (a path that is a single point), so it keeps
+         // the model's own orientation
+         M.block<3, 3>(0, 0).setIdentity();
+         continue;
+      }
+      
+      // Nose (-x) along the path, +y as up as it can be
+      Vector3f x_axis = -forward.normalized();
+      Vector3f z_axis = x_axis.cross(Vector3f(0.0f, 1.0f, 0.0f));
+      if (z_axis.squaredNorm() < 1e-8f) {
+         // Going straight up or down, any z will do
+         z_axis << 0.0f, 0.0f, 1.0f;
+      }
+      z_axis.normalize();
+      Vector3f y_axis = z_axis.cross(x_axis);
+      
+      M.block<3, 1>(0, 0) = x_axis;
+      M.block<3, 1>(0, 1) = y_axis;
+      M.block<3, 1>(0, 2) = z_axis;
+   }
+}
+
+void BatchAnimator::evaluate(double t, float *transforms, int stride, ThreadPool *pool) const {
+   int n = getNumObjects();
+   if (!pool || pool->getNumThreads() == 1) {
+      evaluateRange(0, n, t, transforms, stride);
+      return;
+   }
+   pool->parallelForDynamic((n + GRAIN - 1) / GRAIN, 1, [&](int begin, int end, int thread) {
+      evaluateRange(begin * GRAIN, min(n, end * GRAIN), t, transforms, stride);
+   });
+}
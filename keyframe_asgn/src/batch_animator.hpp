@@ -0,0 +1,58 @@
+//
+//  batch_animator.hpp
+//  Asgn1
+//
+//  Moves lots of objects along splines at once. Every object follows one of
+//  the paths at constant speed (by arc length), starting from its own
+//  offset, and faces along the path. The per-object data is kept as
+//  separate arrays, and evaluating is split across a thread pool.
+//
+
+#ifndef batch_animator_hpp
+#define batch_animator_hpp
+
+#define EIGEN_DONT_ALIGN_STATICALLY
+
+#include <vector>
+#include <Eigen/Dense>
+
+#include "spline.hpp"
+#include "util.hpp"
+
+class ThreadPool;
+
+class BatchAnimator {
+public:
+   /* Adds a path and returns its id. Objects loop over the path from u = 0
+    *  up to the start of its last segment, same as the main helicopter. */
+   int addPath(const Spline& spline, float tolerance = 1e-3f, ThreadPool *pool = 0);
+   int getNumPaths() const { return (int)paths.size(); }
+   float getPathLength(int path) const { return paths[path].length; }
+   
+   /* offset is how far along the path (in arc length) the object is at t = 0,
+    *  and speed is in arc length per second. */
+   int addObject(int path, float offset, float speed);
+   int getNumObjects() const { return (int)path_id.size(); }
+   
+   /* Writes every object's model matrix (column major) at time t to
+    *  transforms + i * stride. Objects face along their path with +y up.
+    *  The helicopter's nose is -x, so that's the direction of travel. */
+   void evaluate(double t, float *transforms, int stride, ThreadPool *pool = 0) const;
+   /* Just objects [begin, end), on this thread */
+   void evaluateRange(int begin, int end, double t, float *transforms, int stride) const;
+   
+private:
+   struct Path {
+      Spline spline;
+      UniformS2U s2u;
+      float length;
+   };
+   std::vector<Path> paths;
+   
+   // Per object
+   std::vector<int> path_id;
+   std::vector<float> time_offset; // in seconds, so it doesn't care about speed
+   std::vector<float> speed;
+};
+
+#endif /* batch_animator_hpp */
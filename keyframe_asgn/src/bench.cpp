@@ -0,0 +1,632 @@
+//
+//  bench.cpp
+//  Asgn1
+//
+//  Headless microbenchmarks. Each one prints its own little report.
+//
+
+#include "bench.hpp"
+#include "util.hpp"
+#include "spline.hpp"
+#include "helicopter.hpp"
+#include "fleet.hpp"
+#include "MatrixStack.h"
+#include "scene_graph.hpp"
+#include "track.hpp"
+#include "batch_animator.hpp"
+#include "ThreadPool.h"
+
+#include <iostream>
+#include <vector>
+#include <chrono>
+#include <cstdlib>
+#include <algorithm>
+
+using namespace std;
+using namespace Eigen;
+
+/* The old linear-scan s2u, for comparison */
+static float s2uLinear(const vector<pair<float,float> > &usTable, float s) {
+   for (size_t i = 1; i < usTable.size(); i++) {
+      if (s < usTable[i].second) {
+         float alpha = (s - usTable[i-1].second) / (usTable[i].second - usTable[i-1].second);
+         return (1.0f - alpha) * usTable[i-1].first + alpha * usTable[i].first;
+      }
+   }
+   return 0.0f;
+}
+
+/* Arc-length inversion: linear scan vs binary search vs uniform table */
+static void benchS2U(const string &resource_dir) {
+   const int sizes[] = { 10, 1000, 100000 };
+   const int num_queries = 1 << 20;
+   srand(0);
+
+   for (int size : sizes) {
+      // A made-up table: u evenly spaced, s growing by uneven amounts
+      vector<pair<float,float> > table;
+      float s = 0.0f;
+      for (int i = 0; i < size; i++) {
+         table.push_back(make_pair(10.0f * i / (size - 1), s));
+         s += 0.5f + rand() / (float)RAND_MAX;
+      }
+      float s_max = table.back().second;
+
+      vector<float> queries(num_queries);
+      for (float &q : queries) {
+         q = s_max * rand() / ((float)RAND_MAX + 1.0f);
+      }
+
+      // Keep the linear scan to ~10^8 steps or the big table takes forever
+      int linear_queries = min(num_queries, 100000000 / size);
+      float sum = 0.0f;
+      auto start = chrono::steady_clock::now();
+      for (int i = 0; i < linear_queries; i++) {
+         sum += s2uLinear(table, queries[i]);
+      }
+      double linear_ms = millisSince(start);
+
+      start = chrono::steady_clock::now();
+      for (int i = 0; i < num_queries; i++) {
+         sum += s2u(table, queries[i]);
+      }
+      double binary_ms = millisSince(start);
+
+      UniformS2U uniform;
+      uniform.build(table, 8 * size);
+      start = chrono::steady_clock::now();
+      for (int i = 0; i < num_queries; i++) {
+         sum += uniform.lookup(queries[i]);
+      }
+      double uniform_ms = millisSince(start);
+
+      cout << size << " entries: "
+           << linear_queries / linear_ms * 1e-3 << " M/s linear, "
+           << num_queries / binary_ms * 1e-3 << " M/s binary, "
+           << num_queries / uniform_ms * 1e-3 << " M/s uniform "
+           << "(" << uniform.size() << " entries, max u error " << uniform.maxError(table, 16) << ")"
+           << (sum == 0.0f ? " " : "") << endl;
+   }
+}
+
+/* Spline position + tangent: rebuilding G and multiplying through Bcr for
+ *  every sample (what render used to do) vs the precomputed coefficients,
+ *  one sample at a time and in a batch. */
+static void benchSpline(const string &resource_dir) {
+   const int num_cps = 9;
+   const int num_samples = 1 << 20;
+   srand(0);
+   
+   Matrix4f Bcr;
+   Bcr << 0.0f, -1.0f,  2.0f, -1.0f,
+          2.0f,  0.0f, -5.0f,  3.0f,
+          0.0f,  1.0f,  4.0f, -3.0f,
+          0.0f,  0.0f, -1.0f,  1.0f;
+   Bcr *= 0.5;
+   vector<Vector3f> cps;
+   for (int i = 0; i < num_cps; i++) {
+      cps.push_back(Vector3f::Random() * 5.0f);
+   }
+   Spline spline;
+   spline.setControlPoints(cps, Bcr);
+   
+   vector<float> us(num_samples);
+   for (float &u : us) {
+      u = spline.getNumSegments() * (rand() / ((float)RAND_MAX + 1.0f));
+   }
+   vector<Vector3f> old_pos(num_samples), old_tan(num_samples);
+   vector<Vector3f> pos(num_samples), tan(num_samples);
+   
+   auto start = chrono::steady_clock::now();
+   for (int j = 0; j < num_samples; j++) {
+      int k = (int)us[j];
+      float u = us[j] - k;
+      MatrixXf G(3, 4);
+      for (int i = 0; i < 4; i++) {
+         G.block<3, 1>(0, i) = cps[i + k];
+      }
+      Vector4f u_vec(1, u, u*u, u*u*u);
+      Vector4f d_u_vec(0, 1, 2*u, 3*u*u);
+      old_pos[j] = G * Bcr * u_vec;
+      old_tan[j] = G * Bcr * d_u_vec;
+   }
+   double old_ms = millisSince(start);
+   
+   start = chrono::steady_clock::now();
+   for (int j = 0; j < num_samples; j++) {
+      pos[j] = spline.evaluate(us[j]);
+      tan[j] = spline.evaluateDerivative(us[j]);
+   }
+   double scalar_ms = millisSince(start);
+   
+   start = chrono::steady_clock::now();
+   spline.evaluate(&us[0], num_samples, &pos[0]);
+   spline.evaluateDerivative(&us[0], num_samples, &tan[0]);
+   double batch_ms = millisSince(start);
+   
+   float max_err = 0.0f;
+   for (int j = 0; j < num_samples; j++) {
+      max_err = max(max_err, (pos[j] - old_pos[j]).norm());
+      max_err = max(max_err, (tan[j] - old_tan[j]).norm());
+   }
+   
+   cout << num_samples << " samples (position + tangent): "
+        << num_samples / old_ms * 1e-3 << " M/s rebuilding G, "
+        << num_samples / scalar_ms * 1e-3 << " M/s precomputed, "
+        << num_samples / batch_ms * 1e-3 << " M/s batch "
+        << "(max difference " << max_err << ")" << endl;
+}
+
+/* CPU side of drawing a fleet: the per-part matrix stack work drawHelicopter
+ *  does for every helicopter vs packing the fleet's instance buffer. No GL,
+ *  so the GL calls are counted rather than timed. */
+static void benchFleet(const string &resource_dir) {
+   const int sizes[] = { 10, 1000, 50000 };
+   const double t = 1.234;
+   srand(0);
+   
+   for (int n : sizes) {
+      vector<Vector3f> pos(n);
+      vector<Quaternionf> rot(n);
+      for (int i = 0; i < n; i++) {
+         pos[i] = Vector3f::Random() * 100.0f;
+         rot[i] = Quaternionf(Vector4f::Random()).normalized();
+      }
+      // Enough frames that the small fleets take a measurable time
+      int frames = max(1, 1000000 / n);
+      
+      MatrixStack MV;
+      Matrix4f sink = Matrix4f::Zero();
+      auto start = chrono::steady_clock::now();
+      for (int f = 0; f < frames; f++) {
+         for (int i = 0; i < n; i++) {
+            for (int part = 0; part < NUM_HELICOPTER_PARTS; part++) {
+               MV.pushMatrix();
+               applyHelicopterPartTransform(part, pos[i], rot[i], t, &MV);
+               sink += MV.topMatrix();
+               MV.popMatrix();
+            }
+         }
+      }
+      double old_ms = millisSince(start) / frames;
+      
+      HelicopterFleet fleet;
+      fleet.resize(n);
+      start = chrono::steady_clock::now();
+      for (int f = 0; f < frames; f++) {
+         for (int i = 0; i < n; i++) {
+            fleet.setTransform(i, pos[i], rot[i]);
+         }
+      }
+      double fleet_ms = millisSince(start) / frames;
+      
+      // drawHelicopter: 2 colors, MV and a draw per part. The fleet: 2 colors,
+      //  3 spin uniforms and a draw per part, plus P, V and the time.
+      int old_calls = n * NUM_HELICOPTER_PARTS * 4;
+      int fleet_calls = 3 + NUM_HELICOPTER_PARTS * 6;
+      cout << n << " helicopters: drawHelicopter " << old_ms << " ms, "
+           << n * NUM_HELICOPTER_PARTS << " draw calls, " << old_calls << " uniform+draw calls | fleet "
+           << fleet_ms << " ms, " << fleet.getDrawCalls() << " draw calls, " << fleet_calls << " uniform+draw calls"
+           << (sink.sum() == 0.0f ? " " : "") << endl;
+   }
+}
+
+/* Helicopter part transforms: the matrix stack chain per part vs a scene
+ *  graph, with everything moving, only the propellors spinning, and only a
+ *  few helicopters moving. */
+static void benchScene(const string &resource_dir) {
+   const int n = 10000;
+   const int frames = 20;
+   const double t = 1.234;
+   srand(0);
+   
+   vector<Vector3f> pos(n);
+   vector<Quaternionf> rot(n);
+   for (int i = 0; i < n; i++) {
+      pos[i] = Vector3f::Random() * 100.0f;
+      rot[i] = Quaternionf(Vector4f::Random()).normalized();
+   }
+   
+   vector<Matrix4f> old_world(n * NUM_HELICOPTER_PARTS);
+   MatrixStack MV;
+   auto start = chrono::steady_clock::now();
+   for (int f = 0; f < frames; f++) {
+      for (int i = 0; i < n; i++) {
+         for (int part = 0; part < NUM_HELICOPTER_PARTS; part++) {
+            MV.pushMatrix();
+            applyHelicopterPartTransform(part, pos[i], rot[i], t, &MV);
+            old_world[i * NUM_HELICOPTER_PARTS + part] = MV.topMatrix();
+            MV.popMatrix();
+         }
+      }
+   }
+   double old_ms = millisSince(start) / frames;
+   
+   SceneGraph graph;
+   vector<HelicopterNodes> nodes(n);
+   for (int i = 0; i < n; i++) {
+      nodes[i] = addHelicopterNodes(&graph);
+   }
+   graph.update();
+   
+   // Everything moves
+   start = chrono::steady_clock::now();
+   for (int f = 0; f < frames; f++) {
+      for (int i = 0; i < n; i++) {
+         setHelicopterPose(&graph, nodes[i], pos[i], rot[i]);
+         setHelicopterPropSpin(&graph, nodes[i], t);
+      }
+      graph.update();
+   }
+   double all_ms = millisSince(start) / frames;
+   int all_count = graph.getLastUpdateCount();
+   
+   float max_err = 0.0f;
+   for (int i = 0; i < n; i++) {
+      for (int part = 0; part < NUM_HELICOPTER_PARTS; part++) {
+         Matrix4f diff = graph.getWorld(nodes[i].parts[part]) - old_world[i * NUM_HELICOPTER_PARTS + part];
+         max_err = max(max_err, diff.cwiseAbs().maxCoeff());
+      }
+   }
+   
+   // Hovering: only the propellors
+   start = chrono::steady_clock::now();
+   for (int f = 0; f < frames; f++) {
+      for (int i = 0; i < n; i++) {
+         setHelicopterPropSpin(&graph, nodes[i], t);
+      }
+      graph.update();
+   }
+   double props_ms = millisSince(start) / frames;
+   int props_count = graph.getLastUpdateCount();
+   
+   // 1% of them move, propellors stopped
+   start = chrono::steady_clock::now();
+   for (int f = 0; f < frames; f++) {
+      for (int i = 0; i < n; i += 100) {
+         setHelicopterPose(&graph, nodes[(i + f) % n], pos[i], rot[i]);
+      }
+      graph.update();
+   }
+   double few_ms = millisSince(start) / frames;
+   int few_count = graph.getLastUpdateCount();
+   
+   cout << n << " helicopters (" << graph.size() << " nodes), ms per frame:" << endl;
+   cout << "  matrix stack per part:   " << old_ms << endl;
+   cout << "  graph, everything moves: " << all_ms << " (" << all_count << " nodes updated, max difference " << max_err << ")" << endl;
+   cout << "  graph, props only:       " << props_ms << " (" << props_count << " nodes updated)" << endl;
+   cout << "  graph, 1% moving:        " << few_ms << " (" << few_count << " nodes updated)" << endl;
+}
+
+template <typename T>
+static float maxDifference(const vector<T> &a, const vector<T> &b) {
+   const int floats = sizeof(T) / sizeof(float);
+   float diff = 0.0f;
+   for (size_t i = 0; i < a.size(); i++) {
+      for (int j = 0; j < floats; j++) {
+         diff = max(diff, fabs(((const float *)&a[i])[j] - ((const float *)&b[i])[j]));
+      }
+   }
+   return diff;
+}
+
+/* Plays every track at 60fps three ways: a Track and a TrackSampler each,
+ *  a TrackSet with its cursors, and a TrackSet searching every time */
+template <typename T>
+static void playTracks(const char *name, const vector<Track<T> > &tracks, TrackSet<T> &set, float duration) {
+   const int frames = (int)(duration * 60.0f);
+   int n = (int)tracks.size();
+   vector<TrackSampler<T> > samplers(n);
+   for (int i = 0; i < n; i++) {
+      samplers[i].setTrack(&tracks[i]);
+   }
+   vector<T> a(n), b(n), c(n);
+   double sampler_ms = 0.0, set_ms = 0.0, search_ms = 0.0;
+   float diff = 0.0f;
+   
+   for (int f = 0; f < frames; f++) {
+      float t = f / 60.0f;
+      auto start = chrono::steady_clock::now();
+      for (int i = 0; i < n; i++) {
+         a[i] = samplers[i].sample(t);
+      }
+      sampler_ms += millisSince(start);
+      
+      start = chrono::steady_clock::now();
+      set.sampleAll(t, &b[0]);
+      set_ms += millisSince(start);
+      
+      start = chrono::steady_clock::now();
+      for (int i = 0; i < n; i++) {
+         c[i] = set.sample(i, t);
+      }
+      search_ms += millisSince(start);
+      
+      diff = max(diff, max(maxDifference(a, b), maxDifference(a, c)));
+   }
+   cout << n << " " << name << " tracks, ms per frame: "
+        << sampler_ms / frames << " Track + TrackSampler, "
+        << set_ms / frames << " TrackSet, "
+        << search_ms / frames << " TrackSet searching "
+        << "(max difference " << diff << ")" << endl;
+}
+
+/* 100k tracks of each type, 16 keys each at random times */
+static void benchTracks(const string &resource_dir) {
+   const int num_tracks = 100000;
+   const int num_keys = 16;
+   const float duration = 2.0f;
+   srand(0);
+   
+   vector<float> key_times(num_keys);
+   vector<FloatTrack> floats(num_tracks);
+   vector<Vector3Track> vectors(num_tracks);
+   vector<QuaternionTrack> quats(num_tracks);
+   FloatTrackSet float_set;
+   Vector3TrackSet vector_set;
+   QuaternionTrackSet quat_set;
+   float_set.reserve(num_tracks * num_keys);
+   vector_set.reserve(num_tracks * num_keys);
+   quat_set.reserve(num_tracks * num_keys);
+   for (int i = 0; i < num_tracks; i++) {
+      float_set.addTrack();
+      vector_set.addTrack();
+      quat_set.addTrack();
+      // Uneven spacing, from 0 to duration
+      float t = 0.0f;
+      for (int k = 0; k < num_keys; k++) {
+         key_times[k] = t;
+         t += 0.2f + rand() / (float)RAND_MAX;
+      }
+      for (int k = 0; k < num_keys; k++) {
+         float time = key_times[k] * duration / key_times.back();
+         float x = rand() / (float)RAND_MAX;
+         Vector3f v = Vector3f::Random();
+         Quaternionf q = Quaternionf(Vector4f::Random()).normalized();
+         // Floats get a mix of step, linear and Catmull-Rom
+         floats[i].addKey(time, x, (Interpolation)(k % 3));
+         float_set.addKey(time, x, (Interpolation)(k % 3));
+         vectors[i].addKey(time, v, INTERP_CATMULL_ROM);
+         vector_set.addKey(time, v, INTERP_CATMULL_ROM);
+         quats[i].addKey(time, q, INTERP_SQUAD);
+         quat_set.addKey(time, q, INTERP_SQUAD);
+      }
+   }
+   
+   playTracks("float", floats, float_set, duration);
+   playTracks("Vector3f", vectors, vector_set, duration);
+   playTracks("Quaternionf (squad)", quats, quat_set, duration);
+}
+
+/* Lots of objects on a handful of paths, evaluated with 1, 2, 4... threads
+ *  up to the number of cores (and at least 4, to see the overhead on small
+ *  machines) */
+static void benchBatch(const string &resource_dir) {
+   const int num_paths = 8;
+   const int sizes[] = { 10000, 100000 };
+   const int frames = 20;
+   srand(0);
+   
+   Matrix4f Bcr;
+   Bcr << 0.0f, -1.0f,  2.0f, -1.0f,
+          2.0f,  0.0f, -5.0f,  3.0f,
+          0.0f,  1.0f,  4.0f, -3.0f,
+          0.0f,  0.0f, -1.0f,  1.0f;
+   Bcr *= 0.5;
+   
+   vector<int> thread_counts;
+   int cores = max(1, (int)thread::hardware_concurrency());
+   for (int threads = 1; threads < max(cores, 4); threads *= 2) {
+      thread_counts.push_back(threads);
+   }
+   thread_counts.push_back(max(cores, 4));
+   
+   for (int n : sizes) {
+      BatchAnimator animator;
+      for (int p = 0; p < num_paths; p++) {
+         vector<Vector3f> cps;
+         for (int i = 0; i < 12; i++) {
+            cps.push_back(Vector3f::Random() * 10.0f);
+         }
+         Spline spline;
+         spline.setControlPoints(cps, Bcr);
+         animator.addPath(spline);
+      }
+      for (int i = 0; i < n; i++) {
+         int path = rand() % num_paths;
+         animator.addObject(path, animator.getPathLength(path) * rand() / (float)RAND_MAX, 1.0f + rand() / (float)RAND_MAX);
+      }
+      
+      vector<float> reference(n * 16), transforms(n * 16);
+      animator.evaluate(1.0, &reference[0], 16);
+      
+      double one_thread_ms = 0.0;
+      for (int threads : thread_counts) {
+         ThreadPool pool(threads);
+         auto start = chrono::steady_clock::now();
+         for (int f = 0; f < frames; f++) {
+            animator.evaluate(1.0 + f / 60.0, &transforms[0], 16, &pool);
+         }
+         double ms = millisSince(start) / frames;
+         if (threads == 1) {
+            one_thread_ms = ms;
+         }
+         
+         // Same answers no matter how it's split up
+         animator.evaluate(1.0, &transforms[0], 16, &pool);
+         bool same = transforms == reference;
+         
+         cout << n << " objects, " << threads << " thread(s): " << ms << " ms/frame, "
+              << n / ms * 1e-3 << " M objects/s, " << one_thread_ms / ms << "x"
+              << (same ? "" : " (RESULTS DIFFER)") << endl;
+      }
+   }
+}
+
+/* Rotation keyframes the way render used to do them: Catmull-Rom on the
+ *  coefficients through a 4x4 G matrix, then renormalize */
+static Quaternionf catmullRomRotation(const vector<Quaternionf> &keys, const Matrix4f &Bcr, float u) {
+   float k = 0;
+   while (u > 1) {
+      u--;
+      k++;
+   }
+   Matrix4f G_quads;
+   for (int i = 0; i < 4; i++) {
+      G_quads.block<4, 1>(0, i) = keys[i + k].coeffs();
+   }
+   Vector4f uVec(1.0f, u, u*u, u*u*u);
+   Quaternionf q;
+   q.coeffs() = G_quads * (Bcr * uVec);
+   return q.normalized();
+}
+
+/* Same, with the MatrixXf render had before the Spline came along */
+static Quaternionf catmullRomRotationXf(const vector<Quaternionf> &keys, const Matrix4f &Bcr, float u) {
+   float k = 0;
+   while (u > 1) {
+      u--;
+      k++;
+   }
+   MatrixXf G_quads(4, 4);
+   for (int i = 0; i < 4; i++) {
+      G_quads.block<4, 1>(0, i) = keys[i + k].coeffs();
+   }
+   Vector4f uVec(1.0f, u, u*u, u*u*u);
+   Quaternionf q;
+   q.coeffs() = G_quads * (Bcr * uVec);
+   return q.normalized();
+}
+
+/* How even the angular speed is, from samples every du: the average
+ *  (max - min) / mean within a segment, and the biggest jump in speed
+ *  across a key relative to the mean speed. */
+static void angularSpeedStats(const vector<Quaternionf> &q, float du, int samples_per_segment,
+                              float *variation, float *max_jump) {
+   vector<float> speed(q.size() - 1);
+   for (size_t i = 0; i + 1 < q.size(); i++) {
+      speed[i] = q[i].angularDistance(q[i+1]) / du;
+   }
+   int nsegs = (int)speed.size() / samples_per_segment;
+   float sum_variation = 0.0f;
+   *max_jump = 0.0f;
+   for (int k = 0; k < nsegs; k++) {
+      float lo = 1e30f, hi = 0.0f, mean = 0.0f;
+      for (int i = k * samples_per_segment; i < (k + 1) * samples_per_segment; i++) {
+         lo = min(lo, speed[i]);
+         hi = max(hi, speed[i]);
+         mean += speed[i];
+      }
+      mean /= samples_per_segment;
+      sum_variation += (hi - lo) / mean;
+      if (k > 0) {
+         int i = k * samples_per_segment;
+         *max_jump = max(*max_jump, fabs(speed[i] - speed[i-1]) / mean);
+      }
+   }
+   *variation = sum_variation / nsegs;
+}
+
+/* Rotation keys: the old Catmull-Rom on coefficients vs squad */
+static void benchSquad(const string &resource_dir) {
+   const int num_keys = 9;
+   const int num_samples = 1 << 20;
+   const int samples_per_segment = 1000;
+   srand(0);
+   
+   Matrix4f Bcr;
+   Bcr << 0.0f, -1.0f,  2.0f, -1.0f,
+          2.0f,  0.0f, -5.0f,  3.0f,
+          0.0f,  1.0f,  4.0f, -3.0f,
+          0.0f,  0.0f, -1.0f,  1.0f;
+   Bcr *= 0.5;
+   
+   // Keys like the app's: key j is at u = j - 1
+   QuaternionTrack track;
+   for (int j = 0; j < num_keys; j++) {
+      track.addKey(j - 1.0f, Quaternionf(Vector4f::Random()).normalized(), INTERP_SQUAD);
+   }
+   // Same keys, already in one hemisphere, so both get the same input
+   vector<Quaternionf> keys;
+   for (int j = 0; j < num_keys; j++) {
+      keys.push_back(track.getKeyValue(j));
+   }
+   int nsegs = num_keys - 3;
+   
+   vector<float> us(num_samples);
+   for (float &u : us) {
+      u = nsegs * (rand() / ((float)RAND_MAX + 1.0f));
+   }
+   Quaternionf sum(0.0f, 0.0f, 0.0f, 0.0f);
+   auto start = chrono::steady_clock::now();
+   for (float u : us) {
+      sum.coeffs() += catmullRomRotation(keys, Bcr, u).coeffs();
+   }
+   double cr_ns = millisSince(start) * 1e6 / num_samples;
+   
+   start = chrono::steady_clock::now();
+   for (float u : us) {
+      sum.coeffs() += catmullRomRotationXf(keys, Bcr, u).coeffs();
+   }
+   double cr_xf_ns = millisSince(start) * 1e6 / num_samples;
+   
+   TrackSampler<Quaternionf> sampler(&track);
+   start = chrono::steady_clock::now();
+   for (float u : us) {
+      sum.coeffs() += track.sample(u).coeffs();
+   }
+   double squad_ns = millisSince(start) * 1e6 / num_samples;
+   
+   // Smoothness, sampled in order
+   float du = 1.0f / samples_per_segment;
+   vector<Quaternionf> cr_curve, squad_curve;
+   for (int i = 0; i <= nsegs * samples_per_segment; i++) {
+      float u = i * du;
+      cr_curve.push_back(catmullRomRotation(keys, Bcr, u));
+      squad_curve.push_back(sampler.sample(u));
+   }
+   float cr_variation, cr_jump, squad_variation, squad_jump;
+   angularSpeedStats(cr_curve, du, samples_per_segment, &cr_variation, &cr_jump);
+   angularSpeedStats(squad_curve, du, samples_per_segment, &squad_variation, &squad_jump);
+   
+   cout << "Catmull-Rom on coefficients: " << cr_xf_ns << " ns/sample with MatrixXf, "
+        << cr_ns << " ns/sample with Matrix4f, angular speed varies "
+        << 100.0f * cr_variation << "% within a segment, jumps up to " << 100.0f * cr_jump << "% at keys" << endl;
+   cout << "squad:                       " << squad_ns << " ns/sample, angular speed varies "
+        << 100.0f * squad_variation << "% within a segment, jumps up to " << 100.0f * squad_jump << "% at keys"
+        << (sum.w() == 0.0f ? " " : "") << endl;
+}
+
+struct Benchmark {
+   const char *name;
+   void (*run)(const string &resource_dir);
+};
+
+static const Benchmark benchmarks[] = {
+   { "s2u", benchS2U },
+   { "spline", benchSpline },
+   { "fleet", benchFleet },
+   { "scene", benchScene },
+   { "tracks", benchTracks },
+   { "batch", benchBatch },
+   { "squad", benchSquad },
+};
+
+bool runBenchmark(const string &name, const string &resource_dir) {
+   for (const Benchmark &b : benchmarks) {
+      if (name == b.name) {
+         b.run(resource_dir);
+         return true;
+      }
+   }
+   cout << "No benchmark called " << name << ". Try one of: " << benchmarkNames() << endl;
+   return false;
+}
+
+string benchmarkNames() {
+   string names;
+   for (const Benchmark &b : benchmarks) {
+      names += (names.empty() ? "" : "|") + string(b.name);
+   }
+   return names;
+}
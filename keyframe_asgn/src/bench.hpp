@@ -0,0 +1,18 @@
+//
+//  bench.hpp
+//  Asgn1
+//
+//  Headless microbenchmarks, run with `Lab03 <RESOURCE_DIR> bench <name>`.
+//
+
+#ifndef bench_hpp
+#define bench_hpp
+
+#include <string>
+
+/* Runs the named benchmark. Returns false if there's no such benchmark. */
+bool runBenchmark(const std::string &name, const std::string &resource_dir);
+/* Names of all the benchmarks, separated by '|' */
+std::string benchmarkNames();
+
+#endif /* bench_hpp */
@@ -0,0 +1,75 @@
+//
+//  curve_renderer.cpp
+//  Asgn1
+//
+
+#include "curve_renderer.hpp"
+#include "spline.hpp"
+#include "GLSL.h"
+
+#include <algorithm>
+
+using namespace std;
+using namespace Eigen;
+
+CurveRenderer::CurveRenderer(int samples_per_segment, int num_segments) :
+   samples_per_segment(samples_per_segment),
+   num_segments(num_segments),
+   buffer_id(0),
+   built_version(0),
+   num_vertices(0) {
+}
+
+CurveRenderer::~CurveRenderer() {
+   if (buffer_id) {
+      glDeleteBuffers(1, &buffer_id);
+   }
+}
+
+void CurveRenderer::tessellate(const Spline& spline) {
+   int nsegs = spline.getNumSegments();
+   if (num_segments >= 0) {
+      nsegs = min(nsegs, num_segments);
+   }
+   
+   // Neighboring segments share their end points, so each segment after the
+   //  first only adds n - 1 new ones
+   int n = samples_per_segment;
+   vector<float> us;
+   for (int k = 0; k < nsegs; k++) {
+      for (int i = (k == 0 ? 0 : 1); i < n; i++) {
+         // u goes from 0 to 1 within this segment
+         us.push_back(k + i / (n - 1.0f));
+      }
+   }
+   vector<Vector3f> points(us.size());
+   if (!us.empty()) {
+      spline.evaluate(&us[0], us.size(), &points[0]);
+   }
+   
+   if (!buffer_id) {
+      glGenBuffers(1, &buffer_id);
+   }
+   glBindBuffer(GL_ARRAY_BUFFER, buffer_id);
+   glBufferData(GL_ARRAY_BUFFER, points.size() * sizeof(Vector3f), points.empty() ? 0 : points[0].data(), GL_STATIC_DRAW);
+   glBindBuffer(GL_ARRAY_BUFFER, 0);
+   
+   num_vertices = (int)points.size();
+   built_version = spline.getVersion();
+}
+
+void CurveRenderer::draw(const Spline& spline) {
+   if (!buffer_id || built_version != spline.getVersion()) {
+      tessellate(spline);
+   }
+   if (num_vertices < 2) {
+      return;
+   }
+   
+   glBindBuffer(GL_ARRAY_BUFFER, buffer_id);
+   glEnableClientState(GL_VERTEX_ARRAY);
+   glVertexPointer(3, GL_FLOAT, 0, (const void *)0);
+   glDrawArrays(GL_LINE_STRIP, 0, num_vertices);
+   glDisableClientState(GL_VERTEX_ARRAY);
+   glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
@@ -0,0 +1,40 @@
+//
+//  curve_renderer.hpp
+//  Asgn1
+//
+//  Draws a Spline as a line strip out of a vertex buffer. The curve only gets
+//  re-tessellated when the spline's control points change, so drawing it is
+//  a single glDrawArrays no matter how many segments there are.
+//
+
+#ifndef curve_renderer_hpp
+#define curve_renderer_hpp
+
+#include <vector>
+
+class Spline;
+
+class CurveRenderer {
+public:
+   /* samples_per_segment points per segment, for the first num_segments
+    *  segments (or all of them if num_segments is negative) */
+   CurveRenderer(int samples_per_segment, int num_segments = -1);
+   ~CurveRenderer();
+   
+   /* Draws with the old-style pipeline, so set up the matrices and color
+    *  first. Needs a GL context. */
+   void draw(const Spline& spline);
+   
+   int getNumVertices() const { return num_vertices; }
+   
+private:
+   void tessellate(const Spline& spline);
+   
+   int samples_per_segment;
+   int num_segments;
+   unsigned buffer_id;
+   unsigned built_version; // spline version that's in the buffer
+   int num_vertices;
+};
+
+#endif /* curve_renderer_hpp */
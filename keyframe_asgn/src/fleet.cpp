@@ -0,0 +1,144 @@
+//
+//  fleet.cpp
+//  Asgn1
+//
+
+#include "fleet.hpp"
+#include "helicopter.hpp"
+#include "Program.h"
+#include "Shape.h"
+#include "GLSL.h"
+
+#include <iostream>
+#include <cmath>
+
+using namespace std;
+using namespace Eigen;
+
+HelicopterFleet::HelicopterFleet() :
+   num_instances(0),
+   instance_buf_id(0) {
+}
+
+HelicopterFleet::~HelicopterFleet() {
+   if (instance_buf_id) {
+      glDeleteBuffers(1, &instance_buf_id);
+   }
+}
+
+bool HelicopterFleet::init(const string& RESOURCE_DIR) {
+   if (!glVertexAttribDivisor || !glDrawElementsInstanced) {
+      cerr << "Instanced drawing isn't supported, can't draw the fleet" << endl;
+      return false;
+   }
+   
+   prog = make_shared<Program>();
+   prog->setShaderNames(RESOURCE_DIR + "fleet_vert.glsl", RESOURCE_DIR + "fleet_frag.glsl");
+   prog->setVerbose(false);
+   if (!prog->init()) {
+      return false;
+   }
+   prog->addUniform("uProjMatrix");
+   prog->addUniform("uViewMatrix");
+   prog->addUniform("uTime");
+   prog->addUniform("uSpinRate");
+   prog->addUniform("uSpinAxis");
+   prog->addUniform("uSpinPivot");
+   prog->addUniform("UaColor");
+   prog->addUniform("UdColor");
+   prog->addAttribute("aPosition");
+   prog->addAttribute("aNormal");
+   prog->addAttribute("aModel");
+   prog->addAttribute("aTint");
+   
+   glGenBuffers(1, &instance_buf_id);
+   GLSL::checkError(GET_FILE_LINE);
+   return true;
+}
+
+void HelicopterFleet::resize(int n) {
+   int old_size = num_instances;
+   num_instances = n;
+   instance_data.resize(n * FLOATS_PER_INSTANCE);
+   for (int i = old_size; i < n; i++) {
+      setTransform(i, Vector3f::Zero(), Quaternionf::Identity());
+      setTint(i, Vector3f::Ones());
+   }
+}
+
+void HelicopterFleet::setTransform(int i, const Vector3f& pos, const Quaternionf& rot) {
+   Map<Matrix4f> M(&instance_data[i * FLOATS_PER_INSTANCE]);
+   M.setIdentity();
+   M.block<3, 3>(0, 0) = rot.toRotationMatrix();
+   M.block<3, 1>(0, 3) = pos;
+}
+
+void HelicopterFleet::setTint(int i, const Vector3f& tint, float prop_phase) {
+   float *t = &instance_data[i * FLOATS_PER_INSTANCE + 16];
+   t[0] = tint(0);
+   t[1] = tint(1);
+   t[2] = tint(2);
+   t[3] = prop_phase;
+}
+
+int HelicopterFleet::getDrawCalls() const {
+   return NUM_HELICOPTER_PARTS;
+}
+
+void HelicopterFleet::draw(const Matrix4f& P, const Matrix4f& V, double t) {
+   if (!prog || num_instances == 0) {
+      return;
+   }
+   
+   glBindBuffer(GL_ARRAY_BUFFER, instance_buf_id);
+   glBufferData(GL_ARRAY_BUFFER, instance_data.size() * sizeof(float), &instance_data[0], GL_STREAM_DRAW);
+   
+   prog->bind();
+   glUniformMatrix4fv(prog->getUniform("uProjMatrix"), 1, GL_FALSE, P.data());
+   glUniformMatrix4fv(prog->getUniform("uViewMatrix"), 1, GL_FALSE, V.data());
+   // Wrap the time to one turn of the propellors so it doesn't lose precision
+   float period = 2.0f * M_PI / PROP_SPIN_RATE;
+   glUniform1f(prog->getUniform("uTime"), (float)fmod(t, (double)period));
+   
+   // A mat4 attribute takes up 4 locations, one per column
+   const int stride = FLOATS_PER_INSTANCE * sizeof(float);
+   int h_model = prog->getAttribute("aModel");
+   int h_tint = prog->getAttribute("aTint");
+   for (int c = 0; c < 4; c++) {
+      GLSL::enableVertexAttribArray(h_model + c);
+      glVertexAttribPointer(h_model + c, 4, GL_FLOAT, GL_FALSE, stride, (const void *)(c * 4 * sizeof(float)));
+      glVertexAttribDivisor(h_model + c, 1);
+   }
+   GLSL::enableVertexAttribArray(h_tint);
+   glVertexAttribPointer(h_tint, 4, GL_FLOAT, GL_FALSE, stride, (const void *)(16 * sizeof(float)));
+   glVertexAttribDivisor(h_tint, 1);
+   glBindBuffer(GL_ARRAY_BUFFER, 0);
+   
+   for (int part = 0; part < NUM_HELICOPTER_PARTS; part++) {
+      const HelicopterPartInfo& info = getHelicopterPartInfo(part);
+      glUniform3fv(prog->getUniform("UaColor"), 1, info.ambient.data());
+      glUniform3fv(prog->getUniform("UdColor"), 1, info.diffuse.data());
+      if (info.spins) {
+         glUniform1f(prog->getUniform("uSpinRate"), PROP_SPIN_RATE);
+         glUniform3fv(prog->getUniform("uSpinAxis"), 1, info.spin_axis.data());
+         glUniform3fv(prog->getUniform("uSpinPivot"), 1, info.spin_pivot.data());
+      }
+      else {
+         glUniform1f(prog->getUniform("uSpinRate"), 0.0f);
+         glUniform3f(prog->getUniform("uSpinAxis"), 0.0f, 1.0f, 0.0f);
+         glUniform3f(prog->getUniform("uSpinPivot"), 0.0f, 0.0f, 0.0f);
+      }
+      getHelicopterPart(part)->drawInstanced(prog, num_instances);
+   }
+   
+   // Leave the divisors how everyone else expects them
+   for (int c = 0; c < 4; c++) {
+      glVertexAttribDivisor(h_model + c, 0);
+      GLSL::disableVertexAttribArray(h_model + c);
+   }
+   glVertexAttribDivisor(h_tint, 0);
+   GLSL::disableVertexAttribArray(h_tint);
+   
+   prog->unbind();
+   GLSL::checkError(GET_FILE_LINE);
+}
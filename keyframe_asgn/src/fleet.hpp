@@ -0,0 +1,58 @@
+//
+//  fleet.hpp
+//  Asgn1
+//
+//  Draws lots of helicopters at once: each of the four parts is one instanced
+//  draw for the whole fleet. Every helicopter's model matrix and tint come
+//  from a per-instance vertex buffer, and the propellors spin in the shader.
+//
+
+#ifndef fleet_hpp
+#define fleet_hpp
+
+#define EIGEN_DONT_ALIGN_STATICALLY
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <Eigen/Dense>
+
+class Program;
+
+// Model matrix (column major), then tint rgb and propellor phase
+#define FLOATS_PER_INSTANCE 20
+
+class HelicopterFleet {
+public:
+   HelicopterFleet();
+   ~HelicopterFleet();
+   
+   /* Loads the fleet shader. Needs a GL context, and loadHelicopter() to have
+    *  been called. Returns false if the driver can't do instancing. */
+   bool init(const std::string& RESOURCE_DIR);
+   
+   /* New helicopters start at the origin, untinted */
+   void resize(int n);
+   int size() const { return num_instances; }
+   
+   /* These only touch helicopter i's data, so different helicopters can be
+    *  set from different threads. */
+   void setTransform(int i, const Eigen::Vector3f& pos, const Eigen::Quaternionf& rot);
+   void setTint(int i, const Eigen::Vector3f& tint, float prop_phase = 0.0f);
+   /* FLOATS_PER_INSTANCE floats per helicopter */
+   float *getInstanceData() { return instance_data.empty() ? 0 : &instance_data[0]; }
+   
+   /* Uploads the instance data and draws everything. The data is uploaded
+    *  every time, since fleets are expected to move every frame. */
+   void draw(const Eigen::Matrix4f& P, const Eigen::Matrix4f& V, double t);
+   /* Draw calls per frame, however big the fleet is */
+   int getDrawCalls() const;
+   
+private:
+   int num_instances;
+   std::vector<float> instance_data;
+   std::shared_ptr<Program> prog;
+   unsigned instance_buf_id;
+};
+
+#endif /* fleet_hpp */
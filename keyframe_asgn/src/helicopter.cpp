@@ -9,33 +9,71 @@
 #include "helicopter.hpp"
 #include "GLSL.h"
 #include "Shape.h"
+#include "scene_graph.hpp"
 
 using namespace Eigen;
 using namespace std;
 
-shared_ptr<Shape> helibody_1;
-shared_ptr<Shape> helibody_2;
-shared_ptr<Shape> heliprop_1;
-shared_ptr<Shape> heliprop_2;
+shared_ptr<Shape> heli_parts[NUM_HELICOPTER_PARTS];
+HelicopterPartInfo heli_part_info[NUM_HELICOPTER_PARTS];
+
+static const char *HELI_PART_MESHES[NUM_HELICOPTER_PARTS] = {
+   "helicopter_body1.obj",
+   "helicopter_body2.obj",
+   "helicopter_prop1.obj",
+   "helicopter_prop2.obj",
+};
 
 void loadHelicopter(std::string RESOURCE_DIR) {
-   helibody_1 = make_shared<Shape>();
-   helibody_1->loadMesh(RESOURCE_DIR + "helicopter_body1.obj");
-   helibody_1->init();
+   for (int part = 0; part < NUM_HELICOPTER_PARTS; part++) {
+      heli_parts[part] = make_shared<Shape>();
+      heli_parts[part]->loadMesh(RESOURCE_DIR + HELI_PART_MESHES[part]);
+      heli_parts[part]->init();
+   }
+}
+
+static bool initPartInfo() {
+   Eigen::Vector3f prop1_center, prop2_center;
+   prop1_center << -0.0133f, 0.4819f, 0.0f;
+   prop2_center << 0.6228f, 0.1179f, 0.1365f;
    
-   helibody_2 = make_shared<Shape>();
-   helibody_2->loadMesh(RESOURCE_DIR + "helicopter_body2.obj");
-   helibody_2->init();
+   // BODY
+   HelicopterPartInfo& body_1 = heli_part_info[HELI_BODY_1];
+   body_1.ambient << 0.0f, 0.0f, 0.3f;
+   body_1.diffuse << 0.0f, 0.0f, 0.8f;
+   body_1.spins = false;
    
-   heliprop_1 = make_shared<Shape>();
-   heliprop_1->loadMesh(RESOURCE_DIR + "helicopter_prop1.obj");
-   heliprop_1->init();
+   // BODY 2
+   HelicopterPartInfo& body_2 = heli_part_info[HELI_BODY_2];
+   body_2.ambient << 0.0f, 0.3f, 0.0f;
+   body_2.diffuse << 0.0f, 0.8f, 0.0f;
+   body_2.spins = false;
    
-   heliprop_2 = make_shared<Shape>();
-   heliprop_2->loadMesh(RESOURCE_DIR + "helicopter_prop2.obj");
-   heliprop_2->init();
+   // PROPELLORS
+   HelicopterPartInfo& prop_1 = heli_part_info[HELI_PROP_1];
+   prop_1.ambient << 0.2f, 0.2f, 0.2f;
+   prop_1.diffuse << 0.8f, 0.8f, 0.8f;
+   prop_1.spins = true;
+   prop_1.spin_axis << 0.0f, 1.0f, 0.0f;
+   prop_1.spin_pivot = -prop1_center;
+   
+   HelicopterPartInfo& prop_2 = heli_part_info[HELI_PROP_2];
+   prop_2 = prop_1;
+   prop_2.spin_axis << 0.0f, 0.0f, 1.0f;
+   prop_2.spin_pivot = prop2_center;
+   
+   return true;
 }
 
+const HelicopterPartInfo& getHelicopterPartInfo(int part) {
+   static bool initialized = initPartInfo();
+   (void)initialized;
+   return heli_part_info[part];
+}
+
+shared_ptr<Shape> getHelicopterPart(int part) {
+   return heli_parts[part];
+}
 
 Eigen::Matrix4f addQuaternionToStack(const Eigen::Quaternionf& rot) {
    Matrix4f R = Matrix4f::Identity();
@@ -43,72 +81,78 @@ Eigen::Matrix4f addQuaternionToStack(const Eigen::Quaternionf& rot) {
    return R;
 }
 
-void drawHelicopter(const Eigen::Vector3f& pos, const Eigen::Quaternionf& rot, double t, MatrixStack* MV, std::shared_ptr<Program> prog) {
-   Eigen::Vector3f axis_prop1, axis_prop2;
-   axis_prop1 << 0.0f, 1.0f, 0.0f;
-   axis_prop2 << 0.0f, 0.0f, 1.0f;
-   
-   Eigen::Quaternionf quatern_prop1, quatern_prop2;
-   quatern_prop1 = Eigen::AngleAxisf(t*90.0f/180.0f*M_PI, axis_prop1);
-   quatern_prop2 = Eigen::AngleAxisf(t*90.0f/180.0f*M_PI, axis_prop2);
-   
-   Eigen::Vector3f prop1_center, prop2_center;
-   prop1_center << -0.0133f, 0.4819f, 0.0f;
-   prop2_center << 0.6228f, 0.1179f, 0.1365f;
-   
-   // BODY
-   glUniform3f(prog->getUniform("UaColor"), 0.0f, 0.0f, 0.3f);
-   glUniform3f(prog->getUniform("UdColor"), 0.0f, 0.0f, 0.8f);
-   
-   MV->pushMatrix();
-   MV->translate(pos);
-   MV->multMatrix(addQuaternionToStack(rot));
-   glUniformMatrix4fv(prog->getUniform("MV"), 1, GL_FALSE, MV->topMatrix().data());
-   helibody_1->draw(prog);
-   MV->popMatrix();
-   
-   // BODY 2
-   glUniform3f(prog->getUniform("UaColor"), 0.0f, 0.3f, 0.0f);
-   glUniform3f(prog->getUniform("UdColor"), 0.0f, 0.8f, 0.0f);
-   
-   MV->pushMatrix();
-   MV->translate(pos);
-   MV->multMatrix(addQuaternionToStack(rot));
-   glUniformMatrix4fv(prog->getUniform("MV"), 1, GL_FALSE, MV->topMatrix().data());
-   helibody_2->draw(prog);
-   MV->popMatrix();
-   
-   
-   
-   // PROPELLORS
-   glUniform3f(prog->getUniform("UaColor"), 0.2f, 0.2f, 0.2f);
-   glUniform3f(prog->getUniform("UdColor"), 0.8f, 0.8f, 0.8f);
-   
-   MV->pushMatrix();
-   
-   MV->translate(pos);
-   MV->multMatrix(addQuaternionToStack(rot));
-   
-   // Spinning propellor
-   MV->translate(-prop1_center);
-   MV->multMatrix(addQuaternionToStack(quatern_prop1));
-   MV->translate(prop1_center);
-   
-   glUniformMatrix4fv(prog->getUniform("MV"), 1, GL_FALSE, MV->topMatrix().data());
-   heliprop_1->draw(prog);
-   MV->popMatrix();
+void applyHelicopterPartTransform(int part, const Eigen::Vector3f& pos, const Eigen::Quaternionf& rot, double t, MatrixStack* MV) {
+   const HelicopterPartInfo& info = getHelicopterPartInfo(part);
    
-   
-   MV->pushMatrix();
    MV->translate(pos);
    MV->multMatrix(addQuaternionToStack(rot));
    
-   // Spinning propellor
-   MV->translate(prop2_center);
-   MV->multMatrix(addQuaternionToStack(quatern_prop2));
-   MV->translate(-prop2_center);
-   
-   glUniformMatrix4fv(prog->getUniform("MV"), 1, GL_FALSE, MV->topMatrix().data());
-   heliprop_2->draw(prog);
-MV->popMatrix();
-}
\ No newline at end of file
+   if (info.spins) {
+      // Spinning propellor
+      Eigen::Quaternionf spin;
+      spin = Eigen::AngleAxisf(t * PROP_SPIN_RATE, info.spin_axis);
+      MV->translate(info.spin_pivot);
+      MV->multMatrix(addQuaternionToStack(spin));
+      MV->translate(-info.spin_pivot);
+   }
+}
+
+void buildHelicopterTransforms(const Eigen::Vector3f& pos, const Eigen::Quaternionf& rot, double t, Eigen::Matrix4f parts[NUM_HELICOPTER_PARTS]) {
+   MatrixStack M;
+   for (int part = 0; part < NUM_HELICOPTER_PARTS; part++) {
+      M.pushMatrix();
+      applyHelicopterPartTransform(part, pos, rot, t, &M);
+      parts[part] = M.topMatrix();
+      M.popMatrix();
+   }
+}
+
+void drawHelicopter(const Eigen::Matrix4f parts[NUM_HELICOPTER_PARTS], MatrixStack* MV, std::shared_ptr<Program> prog) {
+   for (int part = 0; part < NUM_HELICOPTER_PARTS; part++) {
+      const HelicopterPartInfo& info = getHelicopterPartInfo(part);
+      glUniform3fv(prog->getUniform("UaColor"), 1, info.ambient.data());
+      glUniform3fv(prog->getUniform("UdColor"), 1, info.diffuse.data());
+      
+      MV->pushMatrix();
+      MV->multMatrix(parts[part]);
+      glUniformMatrix4fv(prog->getUniform("MV"), 1, GL_FALSE, MV->topMatrix().data());
+      heli_parts[part]->draw(prog);
+      MV->popMatrix();
+   }
+}
+
+void drawHelicopter(const Eigen::Vector3f& pos, const Eigen::Quaternionf& rot, double t, MatrixStack* MV, std::shared_ptr<Program> prog) {
+   Eigen::Matrix4f parts[NUM_HELICOPTER_PARTS];
+   buildHelicopterTransforms(pos, rot, t, parts);
+   drawHelicopter(parts, MV, prog);
+}
+
+HelicopterNodes addHelicopterNodes(SceneGraph* graph, int parent) {
+   HelicopterNodes nodes;
+   nodes.root = graph->addNode(parent);
+   for (int part = 0; part < NUM_HELICOPTER_PARTS; part++) {
+      nodes.parts[part] = graph->addNode(nodes.root);
+   }
+   return nodes;
+}
+
+void setHelicopterPose(SceneGraph* graph, const HelicopterNodes& nodes, const Eigen::Vector3f& pos, const Eigen::Quaternionf& rot) {
+   Matrix4f M = addQuaternionToStack(rot);
+   M.block<3, 1>(0, 3) = pos;
+   graph->setLocal(nodes.root, M);
+}
+
+void setHelicopterPropSpin(SceneGraph* graph, const HelicopterNodes& nodes, double t) {
+   for (int part = 0; part < NUM_HELICOPTER_PARTS; part++) {
+      const HelicopterPartInfo& info = getHelicopterPartInfo(part);
+      if (!info.spins) {
+         continue;
+      }
+      // Rotation about an axis through the pivot: R x + (pivot - R pivot)
+      Matrix3f R = AngleAxisf(t * PROP_SPIN_RATE, info.spin_axis).toRotationMatrix();
+      Matrix4f M = Matrix4f::Identity();
+      M.block<3, 3>(0, 0) = R;
+      M.block<3, 1>(0, 3) = info.spin_pivot - R * info.spin_pivot;
+      graph->setLocal(nodes.parts[part], M);
+   }
+}
@@ -16,8 +16,45 @@
 #include "MatrixStack.h"
 #include "Program.h"
 
+class Shape;
+class SceneGraph;
+
+// Propellors spin at 90 degrees a second
+#define PROP_SPIN_RATE (90.0f/180.0f*M_PI)
+
+/* The four meshes a helicopter is made of, and how each one is drawn */
+enum HelicopterPart { HELI_BODY_1, HELI_BODY_2, HELI_PROP_1, HELI_PROP_2, NUM_HELICOPTER_PARTS };
+
+struct HelicopterPartInfo {
+   Eigen::Vector3f ambient;
+   Eigen::Vector3f diffuse;
+   bool spins;
+   Eigen::Vector3f spin_axis;
+   Eigen::Vector3f spin_pivot; // the axis goes through this point
+};
+
 void loadHelicopter(std::string RESOURCE_DIR);
 void drawHelicopter(const Eigen::Vector3f& pos, const Eigen::Quaternionf& rot, double t, MatrixStack* MV, std::shared_ptr<Program> prog);
+/* Same, with the part transforms already built by buildHelicopterTransforms() */
+void drawHelicopter(const Eigen::Matrix4f parts[NUM_HELICOPTER_PARTS], MatrixStack* MV, std::shared_ptr<Program> prog);
 Eigen::Matrix4f addQuaternionToStack(const Eigen::Quaternionf& rot);
 
+const HelicopterPartInfo& getHelicopterPartInfo(int part);
+std::shared_ptr<Shape> getHelicopterPart(int part);
+/* Multiplies one part's transform (helicopter placement and propellor spin)
+ *  onto the top of MV. No GL calls. */
+void applyHelicopterPartTransform(int part, const Eigen::Vector3f& pos, const Eigen::Quaternionf& rot, double t, MatrixStack* MV);
+/* Model matrices of all the parts of a helicopter. No GL calls. */
+void buildHelicopterTransforms(const Eigen::Vector3f& pos, const Eigen::Quaternionf& rot, double t, Eigen::Matrix4f parts[NUM_HELICOPTER_PARTS]);
+
+/* A helicopter in a SceneGraph: the root places the whole thing, and the
+ *  parts hang off it. Only the propellors' local transforms ever change. */
+struct HelicopterNodes {
+   int root;
+   int parts[NUM_HELICOPTER_PARTS];
+};
+HelicopterNodes addHelicopterNodes(SceneGraph* graph, int parent = -1);
+void setHelicopterPose(SceneGraph* graph, const HelicopterNodes& nodes, const Eigen::Vector3f& pos, const Eigen::Quaternionf& rot);
+void setHelicopterPropSpin(SceneGraph* graph, const HelicopterNodes& nodes, double t);
+
 #endif /* helicopter_hpp */
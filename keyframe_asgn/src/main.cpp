@@ -1,5 +1,9 @@
 #include <iostream>
 #include <vector>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
 
 #define GLEW_STATIC
 #include <GL/glew.h>
@@ -11,7 +15,15 @@
 #include "MatrixStack.h"
 #include "Shape.h"
 #include "helicopter.hpp"
+#include "fleet.hpp"
 #include "util.hpp"
+#include "spline.hpp"
+#include "curve_renderer.hpp"
+#include "scene_graph.hpp"
+#include "batch_animator.hpp"
+#include "track.hpp"
+#include "ThreadPool.h"
+#include "bench.hpp"
 
 using namespace std;
 using namespace Eigen;
@@ -24,14 +36,28 @@ string RESOURCE_DIR = ""; // Where the resources are loaded from
 shared_ptr<Program> prog;
 shared_ptr<Camera> camera;
 shared_ptr<Shape> bunny;
+shared_ptr<ThreadPool> pool;
+shared_ptr<HelicopterFleet> staticFleet; // the helicopters sitting on the control points
 
 Matrix4f Bcr; // Catmull-Rom B matrix
 vector<Vector3f> cps; // Control points
+Spline spline; // cps and Bcr, precomputed
+shared_ptr<CurveRenderer> curveRenderer; // spline in a VBO, toggled with 'k'
 vector<pair<Quaternionf, Quaternionf> > quaternions; // Random quaternions
+QuaternionTrack copterRotations; // the interpolated copter's keys, squad, with u as time
+TrackSampler<Quaternionf> copterRotationSampler;
 vector<pair<float,float> > usTable;
+UniformS2U usUniform; // O(1) version of usTable, toggled with 'u'
+SceneGraph sceneGraph;
+BatchAnimator animator; // a flock of copters following the spline, toggled with 'f'
+shared_ptr<HelicopterFleet> animFleet;
+vector<float> flockTransforms; // where the flock goes when there's no animFleet (headless replays)
+#define ANIM_FLEET_SIZE 1000
+HelicopterNodes copterNodes; // the interpolated copter, in sceneGraph
 
 float smax = 0; // Total distance of spline
 #define TMAX 10  // Total length of animation
+#define ARC_LENGTH_TOLERANCE 1e-3f // Max arc length error per table entry
 float time_offset = 0;
 
 static void error_callback(int error, const char *description)
@@ -75,36 +101,9 @@ void mouse_button_callback(GLFWwindow* window, int button, int action, int mods)
 	}
 }
 
-static void init()
+/* Everything the animation needs that doesn't touch GL */
+static void initScene()
 {
-	GLSL::checkVersion();
-	
-	// Set background color
-	glClearColor(1.0f, 1.0f, 1.0f, 1.0f);
-	// Enable z-buffer test
-	glEnable(GL_DEPTH_TEST);
-	
-	keyToggles[(unsigned)'c'] = true;
-	
-	prog = make_shared<Program>();
-	prog->setShaderNames(RESOURCE_DIR + "simple_vert.glsl", RESOURCE_DIR + "simple_frag.glsl");
-	prog->setVerbose(false); // Set this to true when debugging.
-	prog->init();
-	prog->addUniform("uProjMatrix");
-	prog->addUniform("MV");
-   prog->addUniform("UaColor");
-   prog->addUniform("UdColor");
-	prog->addAttribute("aPosition");
-	prog->addAttribute("aNormal");
-	
-	bunny = make_shared<Shape>();
-	bunny->loadMesh(RESOURCE_DIR + "bunny.obj");
-	bunny->init();
-   
-   loadHelicopter(RESOURCE_DIR);
-   
-	camera = make_shared<Camera>();
-   
    Bcr << 0.0f, -1.0f,  2.0f, -1.0f,
           2.0f,  0.0f, -5.0f,  3.0f,
           0.0f,  1.0f,  4.0f, -3.0f,
@@ -159,7 +158,101 @@ static void init()
    quaternions.push_back(make_pair(roll_2, static_roll_2));
    quaternions.push_back(make_pair(tilt_forward, static_tilt_forward));
    
-   smax = buildTable(&usTable, cps, Bcr);
+   // Key j is where segment j - 1 starts. The copter is flipped around z
+   //  after interpolating, which is the same as flipping the keys first.
+   //  The track puts the keys in the same hemisphere and works out the squad
+   //  controls, so a frame is just three slerps.
+   //
+   // The old Catmull-Rom version read coeffs() (stored x, y, z, w) as
+   //  w, x, y, z, which is where the switched axes came from. The keys get
+   //  read the same way so the copter still looks right at every key.
+   Quaternionf adjustment;
+   adjustment = AngleAxisf(M_PI, Vector3f(0.0f, 0.0f, 1.0f));
+   for (size_t j = 0; j < quaternions.size(); j++) {
+      const Quaternionf& q = quaternions[j].first;
+      Quaternionf key(q.x(), q.y(), q.z(), q.w());
+      copterRotations.addKey(j - 1.0f, key * adjustment, INTERP_SQUAD);
+   }
+   copterRotationSampler.setTrack(&copterRotations);
+   
+   pool = make_shared<ThreadPool>();
+   spline.setControlPoints(cps, Bcr);
+   smax = buildTable(&usTable, spline, ARC_LENGTH_TOLERANCE, pool.get());
+   
+   usUniform.build(usTable, 8 * (int)usTable.size());
+   cout << "Uniform s->u table: " << usUniform.size() << " entries, max u error "
+        << usUniform.maxError(usTable, 16) << endl;
+   
+   copterNodes = addHelicopterNodes(&sceneGraph);
+   
+   // Spread out along the path, going about as fast as the main copter
+   animator.addPath(spline, ARC_LENGTH_TOLERANCE, pool.get());
+   for (int i = 0; i < ANIM_FLEET_SIZE; i++) {
+      float offset = smax * rand() / (float)RAND_MAX;
+      float speed = smax / TMAX * (0.5f + rand() / (float)RAND_MAX);
+      animator.addObject(0, offset, speed);
+   }
+}
+
+static void init()
+{
+	GLSL::checkVersion();
+	
+	// Set background color
+	glClearColor(1.0f, 1.0f, 1.0f, 1.0f);
+	// Enable z-buffer test
+	glEnable(GL_DEPTH_TEST);
+	
+	keyToggles[(unsigned)'c'] = true;
+	
+	prog = make_shared<Program>();
+	prog->setShaderNames(RESOURCE_DIR + "simple_vert.glsl", RESOURCE_DIR + "simple_frag.glsl");
+	prog->setVerbose(false); // Set this to true when debugging.
+	prog->init();
+	prog->addUniform("uProjMatrix");
+	prog->addUniform("MV");
+   prog->addUniform("UaColor");
+   prog->addUniform("UdColor");
+	prog->addAttribute("aPosition");
+	prog->addAttribute("aNormal");
+	
+	bunny = make_shared<Shape>();
+	bunny->loadMesh(RESOURCE_DIR + "bunny.obj");
+	bunny->init();
+   
+   loadHelicopter(RESOURCE_DIR);
+   
+	camera = make_shared<Camera>();
+   
+   initScene();
+   
+   // The static helicopters never move, so their transforms are set once here
+   staticFleet = make_shared<HelicopterFleet>();
+   if (staticFleet->init(RESOURCE_DIR)) {
+      staticFleet->resize((int)cps.size() - 3);
+      for (int i = 0; i < staticFleet->size(); i++) {
+         staticFleet->setTransform(i, cps[i], quaternions[i].second);
+      }
+   }
+   else {
+      staticFleet.reset();
+   }
+   
+   animFleet = make_shared<HelicopterFleet>();
+   if (animFleet->init(RESOURCE_DIR)) {
+      animFleet->resize(animator.getNumObjects());
+      for (int i = 0; i < animFleet->size(); i++) {
+         Vector3f tint = Vector3f(0.5f, 0.5f, 0.5f) + 0.5f * Vector3f::Random().cwiseAbs();
+         animFleet->setTint(i, tint, 4.0f * rand() / (float)RAND_MAX);
+      }
+   }
+   else {
+      animFleet.reset();
+   }
+   
+   // The helicopter stops at the start of the last segment, so that one
+   //  isn't drawn
+   curveRenderer = make_shared<CurveRenderer>(32, spline.getNumSegments() - 1);
    
 	// Initialize time.
 	glfwSetTime(0.0);
@@ -173,74 +266,108 @@ static void init()
 vector<Matrix4f> drawSpline(Matrix4f currMVMat) {
    vector<Matrix4f> result;
    
-   int ncps = (int)cps.size();
-   // Draw spline
-   MatrixXf G(3,ncps);
-   MatrixXf Gk(3,4);
-   for(int i = 0; i < ncps; ++i) {
-      G.block<3,1>(0,i) = cps[i];
+   if(!keyToggles[(unsigned)'k']) {
+      return result;
    }
+   
+   // Draw spline
    glLineWidth(1.0f);
-   for(int k = 0; k < ncps - 4; ++k) {
-      int n = 32; // curve discretization
-      // Gk is the 3x4 block starting at column k
-      Gk = G.block<3,4>(0,k);
-      glBegin(GL_LINE_STRIP);
-      glColor3f(1.0f, 0.0f, 0.0f);
-      for(int i = 0; i < n; ++i) {
-         // u goes from 0 to 1 within this segment
-         float u = i / (n - 1.0f);
-         // Compute spline point at u
-         Vector4f uVec(1.0f, u, u*u, u*u*u);
-         Vector3f P = Gk * Bcr * uVec;
-         if(keyToggles[(unsigned)'k']) {
-            glVertex3fv(P.data());
-         }
-      }
-      glEnd();
-   }
+   glColor3f(1.0f, 0.0f, 0.0f);
+   curveRenderer->draw(spline);
    
    return result;
 }
 
-/* Get the corresponding s-value from the given u-value */
-float s2u(float s)
+/* Everything about a frame that update() works out for draw() */
+struct FrameState {
+   double t;
+   float s; // arc length along the spline
+   float u; // spline parameter, 0 to the number of segments
+   Vector3f pos;
+   Quaternionf rot;
+   Matrix4f parts[NUM_HELICOPTER_PARTS]; // model matrices of the interpolated copter
+};
+
+/* Where the interpolated helicopter is along the spline at time t */
+static float timeToU(double t, float *s_out)
 {
-   for (int i = 0; i < usTable.size(); i++) {
-      if (s < usTable[i].second) {
-         float s0 = usTable[i-1].second;
-         float s1 = usTable[i].second;
-         
-         float u0 = usTable[i-1].first;
-         float u1 = usTable[i].first;
-         
-         float alpha = (s - s0) / (s1 - s0);
-         return (1.0f - alpha) * u0 + alpha * u1;
-      }
+   float tNorm = std::fmod(t + time_offset, TMAX) / TMAX;
+   float sNorm = tNorm;
+   float s = smax * sNorm;
+   *s_out = s;
+   return keyToggles[(unsigned)'u'] ? usUniform.lookup(s) : s2u(usTable, s);
+}
+
+/* Position and rotation of the interpolated helicopter at spline parameter u */
+static void evaluateCopter(float u, Vector3f *pos, Quaternionf *rot)
+{
+   *pos = spline.evaluate(u);
+   *rot = copterRotationSampler.sample(u);
+}
+
+/* World transforms of the interpolated copter's parts, through the scene graph */
+static void updateCopterTransforms(FrameState *frame)
+{
+   setHelicopterPose(&sceneGraph, copterNodes, frame->pos, frame->rot);
+   setHelicopterPropSpin(&sceneGraph, copterNodes, frame->t);
+   sceneGraph.update();
+   for (int part = 0; part < NUM_HELICOPTER_PARTS; part++) {
+      frame->parts[part] = sceneGraph.getWorld(copterNodes.parts[part]);
    }
-   
-   return 0.0f;
 }
 
-Quaternionf lastCopterQuat;
-Vector3f lastCopterPosn(0.0f, 0.0f, 0.0f);
+/* How long each part of update() took, in milliseconds */
+struct UpdateTimes {
+   double s2u;
+   double copter;
+   double transforms;
+   double flock;
+};
 
-void render()
+/* Advance the animation to time t. No GL calls. Times the parts if given
+ *  somewhere to put the times. */
+FrameState update(double t, UpdateTimes *times = 0)
 {
-   // Update time.
-   double t = glfwGetTime();
+   FrameState frame;
+   frame.t = t;
+   UpdateTimes local;
+   if (!times) {
+      times = &local;
+   }
    
-   float tNorm = std::fmod(t + time_offset, TMAX) / TMAX;
-   float sNorm = tNorm;
-   float s = smax * sNorm;
-   float u = s2u(s);
+   auto start = chrono::steady_clock::now();
+   frame.u = timeToU(t, &frame.s);
+   times->s2u = millisSince(start);
    
-   float k = 0;
+   start = chrono::steady_clock::now();
+   evaluateCopter(frame.u, &frame.pos, &frame.rot);
+   times->copter = millisSince(start);
    
-   while (u > 1) {
-      u--;
-      k++;
+   start = chrono::steady_clock::now();
+   updateCopterTransforms(&frame);
+   times->transforms = millisSince(start);
+   
+   start = chrono::steady_clock::now();
+   if (keyToggles[(unsigned)'f']) {
+      float *transforms = 0;
+      if (animFleet) {
+         transforms = animFleet->getInstanceData();
+      }
+      else {
+         flockTransforms.resize(animator.getNumObjects() * FLOATS_PER_INSTANCE);
+         transforms = flockTransforms.empty() ? 0 : &flockTransforms[0];
+      }
+      if (transforms) {
+         animator.evaluate(t, transforms, FLOATS_PER_INSTANCE, pool.get());
+      }
    }
+   times->flock = millisSince(start);
+   return frame;
+}
+
+void draw(const FrameState &frame)
+{
+   double t = frame.t;
    
 	// Get current frame buffer size.
 	int width, height;
@@ -273,9 +400,9 @@ void render()
 	MV->pushMatrix();
    
    if (keyToggles[(unsigned)' ']) {
-      Vector3f eyeposn = lastCopterQuat.toRotationMatrix() * Vector3f(5.0f, 0.0f, 0.0f);
-      Vector3f upvec = lastCopterQuat.toRotationMatrix() * Vector3f(0.0f, 1.0f, 0.0f);
-      MV->lookAt(lastCopterPosn + eyeposn, lastCopterPosn, upvec.normalized());
+      Vector3f eyeposn = frame.rot.toRotationMatrix() * Vector3f(5.0f, 0.0f, 0.0f);
+      Vector3f upvec = frame.rot.toRotationMatrix() * Vector3f(0.0f, 1.0f, 0.0f);
+      MV->lookAt(frame.pos + eyeposn, frame.pos, upvec.normalized());
    }
    else {
       camera->applyViewMatrix(MV);
@@ -314,62 +441,29 @@ void render()
 	// Now draw the shape using modern OpenGL
 	//////////////////////////////////////////////////////
 	
+   // Draw the static helicopters, all in one go if we can
+   if (staticFleet) {
+      staticFleet->draw(P->topMatrix(), MV->topMatrix(), t);
+   }
+   if (keyToggles[(unsigned)'f'] && animFleet) {
+      animFleet->draw(P->topMatrix(), MV->topMatrix(), t);
+   }
+   
 	// Bind the program
 	prog->bind();
 	
 	// Send projection matrix (same for all helis)
 	glUniformMatrix4fv(prog->getUniform("uProjMatrix"), 1, GL_FALSE, P->topMatrix().data());
    
-   Eigen::Quaternionf quatern_prop1;
-   
-   // Draw the static helicopters
-   for (int helicopter_ndx = 0; helicopter_ndx < cps.size() - 3; helicopter_ndx++) {
-      
-      // Generate the G Matrix for this helicopter's corresponding control points
-      MatrixXf G(3, 4);
-      for (int cp_ndx = 0; cp_ndx < 4; cp_ndx++) {
-         G.block<3, 1>(0, cp_ndx) = cps[cp_ndx + helicopter_ndx];
+   if (!staticFleet) {
+      for (int helicopter_ndx = 0; helicopter_ndx < cps.size() - 3; helicopter_ndx++) {
+         Quaternionf thisQuat = quaternions[helicopter_ndx].second;
+         drawHelicopter(cps[helicopter_ndx], thisQuat, t, MV.get(), prog);
       }
-      
-      Quaternionf thisQuat = quaternions[helicopter_ndx].second;
-      drawHelicopter(cps[helicopter_ndx], thisQuat, t, MV.get(), prog);
    }
    
    // Draw interpolated helicopter
-   Vector4f u_vec, d_u_vec;
-   
-   u_vec << 1, u, u*u, u*u*u;
-   d_u_vec << 0, 1, 2*u, 3*u*u;
-   
-   MatrixXf G(3, 4);
-   MatrixXf G_quads(4, 4);
-   for (int i = 0; i < 4; i++) {
-      G.block<3, 1>(0, i) = cps[i + k];
-      Quaternionf quaternionToAdd = quaternions[i + k].first;
-      if (k != cps.size() && quaternions[i+k].first.dot(quaternions[i+k+1].first) < 0) {
-         quaternionToAdd.inverse(); // Take the shortest path
-      }
-      
-      G_quads.block<4, 1>(0, i) = quaternionToAdd.coeffs();
-   }
-   
-   Vector3f interpolated_pos = G * Bcr * u_vec;
-   
-   Vector4f uVec(1.0f, u, u*u, u*u*u);
-   Vector4f qVec = (G_quads * (Bcr * uVec));
-   Quaternionf q;
-   q.w() = qVec(0);
-   q.vec() = qVec.segment<3>(1);
-   q.normalize();
-   
-   Quaternionf adjustment;
-   adjustment = AngleAxisf(M_PI, Vector3f(0.0f, 0.0f, 1.0f));
-   q *= adjustment;
-   
-   drawHelicopter(interpolated_pos, q, t, MV.get(), prog);
-   
-   lastCopterPosn = interpolated_pos;
-   lastCopterQuat = q;
+   drawHelicopter(frame.parts, MV.get(), prog);
 	
 	// Unbind the program
 	prog->unbind();
@@ -385,13 +479,142 @@ void render()
 	GLSL::checkError(GET_FILE_LINE);
 }
 
+void render()
+{
+   // Update time.
+   double t = glfwGetTime();
+   draw(update(t));
+}
+
+/* p-th percentile (0 to 100) of a set of timings */
+static double percentile(vector<double> ms, double p)
+{
+   sort(ms.begin(), ms.end());
+   int i = (int)ceil(p / 100.0 * ms.size()) - 1;
+   return ms[max(0, min((int)ms.size() - 1, i))];
+}
+
+/* One row of the replay report, in microseconds */
+static void printPhase(const char *name, const vector<double> &ms)
+{
+   printf("%-12s %10.3f %10.3f %10.3f\n", name, 1000.0 * percentile(ms, 50), 1000.0 * percentile(ms, 95), 1000.0 * percentile(ms, 99));
+}
+
+/* Steps the animation num_frames times, dt seconds apart, instead of
+ *  following the clock. Each frame goes through update(), timed phase by
+ *  phase, and is drawn too if there's a (hidden) window. The interpolated
+ *  copter's transforms go to dump_file, one line per frame, for diffing
+ *  runs. */
+static int replay(int num_frames, double dt, const string &dump_file, bool draw_frames)
+{
+   FILE *dump = 0;
+   if (!dump_file.empty()) {
+      dump = fopen(dump_file.c_str(), "w");
+      if (!dump) {
+         cerr << "Couldn't open " << dump_file << endl;
+         return -1;
+      }
+   }
+   
+   vector<double> s2u_ms, copter_ms, transforms_ms, flock_ms, draw_ms, total_ms;
+   for (int f = 0; f < num_frames; f++) {
+      auto frame_start = chrono::steady_clock::now();
+      UpdateTimes times;
+      FrameState frame = update(f * dt, &times);
+      s2u_ms.push_back(times.s2u);
+      copter_ms.push_back(times.copter);
+      transforms_ms.push_back(times.transforms);
+      flock_ms.push_back(times.flock);
+      
+      if (draw_frames) {
+         auto start = chrono::steady_clock::now();
+         draw(frame);
+         glFinish(); // so the GPU's time counts too
+         draw_ms.push_back(millisSince(start));
+      }
+      total_ms.push_back(millisSince(frame_start));
+      
+      if (dump) {
+         fprintf(dump, "%d %.6f %.6f %.6f", f, frame.t, frame.s, frame.u);
+         fprintf(dump, " %.6f %.6f %.6f", frame.pos(0), frame.pos(1), frame.pos(2));
+         fprintf(dump, " %.6f %.6f %.6f %.6f", frame.rot.w(), frame.rot.x(), frame.rot.y(), frame.rot.z());
+         for (int part = 0; part < NUM_HELICOPTER_PARTS; part++) {
+            for (int i = 0; i < 16; i++) {
+               fprintf(dump, " %.6f", frame.parts[part].data()[i]);
+            }
+         }
+         fprintf(dump, "\n");
+      }
+   }
+   if (dump) {
+      fclose(dump);
+   }
+   
+   if (num_frames > 0) {
+      printf("%d frames, dt = %g\n", num_frames, dt);
+      printf("%-12s %10s %10s %10s\n", "phase (us)", "p50", "p95", "p99");
+      printPhase("s2u", s2u_ms);
+      printPhase("copter", copter_ms);
+      printPhase("transforms", transforms_ms);
+      if (keyToggles[(unsigned)'f']) {
+         printPhase("flock", flock_ms);
+      }
+      if (draw_frames) {
+         printPhase("draw", draw_ms);
+      }
+      printPhase("total", total_ms);
+   }
+   return 0;
+}
+
+/* The renderers delete their buffers when they go, so they have to go
+ *  while the context is still there */
+static void releaseBuffers()
+{
+   curveRenderer.reset();
+   staticFleet.reset();
+   animFleet.reset();
+}
+
 int main(int argc, char **argv)
 {
 	if(argc < 2) {
 		cout << "Please specify the resource directory." << endl;
+		cout << "Usage: Lab03 <RESOURCE_DIR> [bench <" << benchmarkNames() << ">]" << endl;
+		cout << "       Lab03 <RESOURCE_DIR> replay <frames> <dt> [dump file] [--draw] [--flock]" << endl;
 		return 0;
 	}
 	RESOURCE_DIR = argv[1] + string("/");
+   
+   // Headless benchmarks don't need a window
+   if(argc > 3 && string(argv[2]) == "bench") {
+      return runBenchmark(argv[3], RESOURCE_DIR) ? 0 : -1;
+   }
+   
+   // Replays run on a fixed timestep, and only need a window to draw
+   bool replaying = argc > 4 && string(argv[2]) == "replay";
+   int replay_frames = 0;
+   double replay_dt = 0.0;
+   string replay_dump;
+   bool replay_draw = false;
+   if(replaying) {
+      replay_frames = atoi(argv[3]);
+      replay_dt = atof(argv[4]);
+      for(int i = 5; i < argc; i++) {
+         if(string(argv[i]) == "--draw") {
+            replay_draw = true;
+         } else if(string(argv[i]) == "--flock") {
+            // Same as pressing 'f'
+            keyToggles[(unsigned)'f'] = true;
+         } else {
+            replay_dump = argv[i];
+         }
+      }
+      if(!replay_draw) {
+         initScene();
+         return replay(replay_frames, replay_dt, replay_dump, false);
+      }
+   }
 	
 	// Set error callback.
 	glfwSetErrorCallback(error_callback);
@@ -399,6 +622,10 @@ int main(int argc, char **argv)
 	if(!glfwInit()) {
 		return -1;
 	}
+	// Drawn replays happen offscreen
+	if(replaying) {
+		glfwWindowHint(GLFW_VISIBLE, GL_FALSE);
+	}
 	// Create a windowed mode window and its OpenGL context.
 	window = glfwCreateWindow(640, 480, "ELLIOT FISKE", NULL, NULL);
 	if(!window) {
@@ -428,6 +655,13 @@ int main(int argc, char **argv)
 	glfwSetMouseButtonCallback(window, mouse_button_callback);
 	// Initialize scene.
 	init();
+	if(replaying) {
+		int rc = replay(replay_frames, replay_dt, replay_dump, true);
+		releaseBuffers();
+		glfwDestroyWindow(window);
+		glfwTerminate();
+		return rc;
+	}
 	// Loop until the user closes the window.
 	while(!glfwWindowShouldClose(window)) {
 		// Render scene.
@@ -438,6 +672,7 @@ int main(int argc, char **argv)
 		glfwPollEvents();
 	}
 	// Quit program.
+	releaseBuffers();
 	glfwDestroyWindow(window);
 	glfwTerminate();
 	return 0;
@@ -0,0 +1,120 @@
+//
+//  scene_graph.cpp
+//  Asgn1
+//
+
+#include "scene_graph.hpp"
+
+#include <cassert>
+
+using namespace std;
+using namespace Eigen;
+
+SceneGraph::SceneGraph() : sorted(true), last_update_count(0) {
+}
+
+int SceneGraph::addNode(int parent_node, const Matrix4f& local_transform) {
+   int id = size();
+   assert(parent_node >= -1 && parent_node < id);
+   parent_id.push_back(parent_node);
+   
+   // Tack it on the end for now, sort() puts it in its proper place
+   slot.push_back((int)local.size());
+   local.push_back(local_transform);
+   world.push_back(local_transform);
+   dirty.push_back(1);
+   sorted = false;
+   return id;
+}
+
+void SceneGraph::setLocal(int node, const Matrix4f& local_transform) {
+   int i = slot[node];
+   local[i] = local_transform;
+   dirty[i] = 1;
+}
+
+/* Lays the nodes out depth first */
+void SceneGraph::sort() {
+   int n = size();
+   vector<vector<int> > children(n);
+   vector<int> roots;
+   for (int id = 0; id < n; id++) {
+      if (parent_id[id] < 0) {
+         roots.push_back(id);
+      }
+      else {
+         children[parent_id[id]].push_back(id);
+      }
+   }
+   
+   vector<int> order;
+   order.reserve(n);
+   vector<int> stack;
+   for (int r = (int)roots.size() - 1; r >= 0; r--) {
+      stack.push_back(roots[r]);
+   }
+   while (!stack.empty()) {
+      int id = stack.back();
+      stack.pop_back();
+      order.push_back(id);
+      // Backwards so the first child comes off the stack first
+      for (int c = (int)children[id].size() - 1; c >= 0; c--) {
+         stack.push_back(children[id][c]);
+      }
+   }
+   
+   vector<Matrix4f> new_local(n);
+   for (int i = 0; i < n; i++) {
+      new_local[i] = local[slot[order[i]]];
+   }
+   for (int i = 0; i < n; i++) {
+      slot[order[i]] = i;
+   }
+   local.swap(new_local);
+   
+   parent.resize(n);
+   subtree_end.resize(n);
+   for (int i = 0; i < n; i++) {
+      int p = parent_id[order[i]];
+      parent[i] = p < 0 ? -1 : slot[p];
+   }
+   // A subtree ends where the parent's next child (or something that isn't
+   //  a descendant) starts. Going backwards, every node's subtree is known
+   //  by the time its parent needs it.
+   for (int i = 0; i < n; i++) {
+      subtree_end[i] = i + 1;
+   }
+   for (int i = n - 1; i >= 0; i--) {
+      if (parent[i] >= 0 && subtree_end[i] > subtree_end[parent[i]]) {
+         subtree_end[parent[i]] = subtree_end[i];
+      }
+   }
+   
+   world.resize(n);
+   dirty.assign(n, 1);
+   sorted = true;
+}
+
+void SceneGraph::update() {
+   if (!sorted) {
+      sort();
+   }
+   
+   int n = (int)local.size();
+   last_update_count = 0;
+   int i = 0;
+   while (i < n) {
+      if (!dirty[i]) {
+         i++;
+         continue;
+      }
+      // Parents come first, so the whole subtree can go in order
+      int end = subtree_end[i];
+      for (int j = i; j < end; j++) {
+         world[j] = parent[j] < 0 ? local[j] : world[parent[j]] * local[j];
+         dirty[j] = 0;
+      }
+      last_update_count += end - i;
+      i = end;
+   }
+}
@@ -0,0 +1,58 @@
+//
+//  scene_graph.hpp
+//  Asgn1
+//
+//  A transform hierarchy kept in flat arrays. Nodes are stored in depth-first
+//  order, so every parent comes before its children and every subtree is one
+//  contiguous range. update() is then a single pass over the arrays that
+//  only recomputes the subtrees under nodes whose local transform changed.
+//
+
+#ifndef scene_graph_hpp
+#define scene_graph_hpp
+
+#define EIGEN_DONT_ALIGN_STATICALLY
+
+#include <vector>
+#include <Eigen/Dense>
+
+class SceneGraph {
+public:
+   SceneGraph();
+   
+   /* Adds a node under parent (-1 for a root) and returns its id. Ids stay
+    *  the same no matter how the nodes get reordered internally. */
+   int addNode(int parent, const Eigen::Matrix4f& local = Eigen::Matrix4f::Identity());
+   int size() const { return (int)parent_id.size(); }
+   int getParent(int node) const { return parent_id[node]; }
+   
+   /* Setting a local transform marks the node's whole subtree for update */
+   void setLocal(int node, const Eigen::Matrix4f& local);
+   const Eigen::Matrix4f& getLocal(int node) const { return local[slot[node]]; }
+   /* Only up to date after update() */
+   const Eigen::Matrix4f& getWorld(int node) const { return world[slot[node]]; }
+   
+   /* Recomputes the world transforms of everything that changed */
+   void update();
+   /* How many world transforms the last update() recomputed */
+   int getLastUpdateCount() const { return last_update_count; }
+   
+private:
+   void sort();
+   
+   // By id
+   std::vector<int> parent_id;
+   std::vector<int> slot; // where each node lives in the arrays below
+   
+   // By slot, i.e. depth-first order
+   std::vector<Eigen::Matrix4f> local;
+   std::vector<Eigen::Matrix4f> world;
+   std::vector<int> parent;      // slot of the parent, -1 for roots
+   std::vector<int> subtree_end; // one past the last slot of the subtree
+   std::vector<char> dirty;
+   
+   bool sorted;
+   int last_update_count;
+};
+
+#endif /* scene_graph_hpp */
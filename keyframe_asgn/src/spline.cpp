@@ -0,0 +1,120 @@
+//
+//  spline.cpp
+//  Asgn1
+//
+
+#include "spline.hpp"
+
+#include <cmath>
+#include <algorithm>
+
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
+
+using namespace std;
+using namespace Eigen;
+
+#define FLOATS_PER_SEGMENT 16
+
+Spline::Spline() : num_segments(0), version(0) {
+}
+
+void Spline::setControlPoints(const vector<Vector3f>& cps, const Matrix4f& B) {
+   this->cps = cps;
+   num_segments = max(0, (int)cps.size() - 3);
+   coeffs.assign(num_segments * FLOATS_PER_SEGMENT, 0.0f);
+   deriv_coeffs.assign(num_segments * FLOATS_PER_SEGMENT, 0.0f);
+
+   for (int k = 0; k < num_segments; k++) {
+      Matrix<float, 3, 4> Gk;
+      for (int i = 0; i < 4; i++) {
+         Gk.col(i) = cps[k + i];
+      }
+      Matrix<float, 3, 4> C = Gk * B;
+
+      float *c = &coeffs[k * FLOATS_PER_SEGMENT];
+      float *d = &deriv_coeffs[k * FLOATS_PER_SEGMENT];
+      for (int p = 0; p < 4; p++) {
+         for (int axis = 0; axis < 3; axis++) {
+            c[4*p + axis] = C(axis, p);
+            if (p > 0) {
+               d[4*(p-1) + axis] = p * C(axis, p);
+            }
+         }
+      }
+   }
+
+   version++;
+}
+
+void Spline::locate(float u, int *k, float *local_u) const {
+   int seg = (int)floor(u);
+   seg = max(0, min(num_segments - 1, seg));
+   *k = seg;
+   *local_u = u - seg;
+}
+
+/* Horner's rule on one segment's coefficients, all 3 axes at once */
+static inline Vector3f horner(const float *c, float u) {
+#ifdef __SSE__
+   __m128 vu = _mm_set1_ps(u);
+   __m128 r = _mm_loadu_ps(c + 12);
+   r = _mm_add_ps(_mm_mul_ps(r, vu), _mm_loadu_ps(c + 8));
+   r = _mm_add_ps(_mm_mul_ps(r, vu), _mm_loadu_ps(c + 4));
+   r = _mm_add_ps(_mm_mul_ps(r, vu), _mm_loadu_ps(c));
+   float out[4];
+   _mm_storeu_ps(out, r);
+   return Vector3f(out[0], out[1], out[2]);
+#else
+   Vector3f r;
+   for (int axis = 0; axis < 3; axis++) {
+      r(axis) = c[axis] + u * (c[4 + axis] + u * (c[8 + axis] + u * c[12 + axis]));
+   }
+   return r;
+#endif
+}
+
+/* Batch Horner's rule: the samples can land in different segments, so each
+ *  one is a broadcast of u against its own segment's xyz coefficients. */
+static void hornerBatch(const float *coeffs, int num_segments, const float *u, size_t n, Vector3f *out) {
+   for (size_t i = 0; i < n; i++) {
+      int k = (int)floor(u[i]);
+      k = max(0, min(num_segments - 1, k));
+      out[i] = horner(coeffs + k * FLOATS_PER_SEGMENT, u[i] - k);
+   }
+}
+
+Vector3f Spline::evaluate(float u) const {
+   int k;
+   float t;
+   locate(u, &k, &t);
+   return evaluate(k, t);
+}
+
+Vector3f Spline::evaluateDerivative(float u) const {
+   int k;
+   float t;
+   locate(u, &k, &t);
+   return evaluateDerivative(k, t);
+}
+
+Vector3f Spline::evaluate(int k, float u) const {
+   return horner(&coeffs[k * FLOATS_PER_SEGMENT], u);
+}
+
+Vector3f Spline::evaluateDerivative(int k, float u) const {
+   return horner(&deriv_coeffs[k * FLOATS_PER_SEGMENT], u);
+}
+
+void Spline::evaluate(const float* u, size_t n, Vector3f* out) const {
+   if (num_segments > 0) {
+      hornerBatch(&coeffs[0], num_segments, u, n, out);
+   }
+}
+
+void Spline::evaluateDerivative(const float* u, size_t n, Vector3f* out) const {
+   if (num_segments > 0) {
+      hornerBatch(&deriv_coeffs[0], num_segments, u, n, out);
+   }
+}
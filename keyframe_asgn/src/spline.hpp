@@ -0,0 +1,56 @@
+//
+//  spline.hpp
+//  Asgn1
+//
+//  A cubic spline (Catmull-Rom by default) with the per-segment coefficients
+//  computed once up front, so evaluating it is just a cubic polynomial.
+//
+
+#ifndef spline_hpp
+#define spline_hpp
+
+#define EIGEN_DONT_ALIGN_STATICALLY
+
+#include <stddef.h>
+#include <vector>
+#include <Eigen/Dense>
+
+class Spline {
+public:
+   Spline();
+
+   /* Recompute the coefficients. Segment k uses control points k..k+3, so
+    *  there are cps.size() - 3 segments. */
+   void setControlPoints(const std::vector<Eigen::Vector3f>& cps, const Eigen::Matrix4f& B);
+   const std::vector<Eigen::Vector3f>& getControlPoints() const { return cps; }
+   int getNumSegments() const { return num_segments; }
+   /* Goes up every time the control points change */
+   unsigned getVersion() const { return version; }
+
+   /* u goes from 0 to getNumSegments(). The integer part picks the segment and
+    *  the fractional part is the u within it. */
+   Eigen::Vector3f evaluate(float u) const;
+   Eigen::Vector3f evaluateDerivative(float u) const;
+   /* Same as above, for a local u in [0, 1] within segment k */
+   Eigen::Vector3f evaluate(int k, float u) const;
+   Eigen::Vector3f evaluateDerivative(int k, float u) const;
+
+   /* Batch versions, for lots of samples at once. No allocation, and each
+    *  sample is a handful of SSE multiply-adds. */
+   void evaluate(const float* u, size_t n, Eigen::Vector3f* out) const;
+   void evaluateDerivative(const float* u, size_t n, Eigen::Vector3f* out) const;
+
+private:
+   void locate(float u, int *k, float *local_u) const;
+
+   std::vector<Eigen::Vector3f> cps;
+   int num_segments;
+   unsigned version;
+   // Per segment, 4 powers of u (constant term first) x 4 floats (xyz + pad).
+   //  P(u) = c0 + u*c1 + u^2*c2 + u^3*c3
+   std::vector<float> coeffs;
+   // Same for P'(u) = d0 + u*d1 + u^2*d2, with d3 = 0
+   std::vector<float> deriv_coeffs;
+};
+
+#endif /* spline_hpp */
@@ -0,0 +1,74 @@
+//
+//  track.cpp
+//  Asgn1
+//
+
+#include "track.hpp"
+
+#include <cmath>
+#include <algorithm>
+
+using namespace std;
+using namespace Eigen;
+
+/* log of a unit quaternion: (0, axis * half angle) */
+static Vector3f quatLog(const Quaternionf& q) {
+   float sin_theta = q.vec().norm();
+   if (sin_theta < 1e-6f) {
+      return q.vec();
+   }
+   float theta = atan2(sin_theta, q.w());
+   return q.vec() * (theta / sin_theta);
+}
+
+/* exp of a pure quaternion (0, v), the inverse of quatLog */
+static Quaternionf quatExp(const Vector3f& v) {
+   float theta = v.norm();
+   Quaternionf q;
+   q.w() = cos(theta);
+   q.vec() = theta < 1e-6f ? v : Vector3f(v * (sin(theta) / theta));
+   return q;
+}
+
+Quaternionf squadControl(const Quaternionf& prev, const Quaternionf& curr, const Quaternionf& next) {
+   Quaternionf inv = curr.conjugate();
+   Vector3f sum = quatLog(inv * next) + quatLog(inv * prev);
+   return (curr * quatExp(-0.25f * sum)).normalized();
+}
+
+/* Slerp that always goes from a to b as given. Eigen's slerp takes the
+ *  shorter way round, which flips halfway through squad's outer slerp
+ *  whenever the inner two end up more than 90 degrees apart. */
+static Quaternionf slerpNoInvert(const Quaternionf& a, const Quaternionf& b, float t) {
+   float d = max(-1.0f, min(1.0f, a.dot(b)));
+   float theta = acos(d);
+   float sin_theta = sqrt(1.0f - d * d);
+   Quaternionf q;
+   if (sin_theta < 1e-4f) {
+      q.coeffs() = (1.0f - t) * a.coeffs() + t * b.coeffs();
+      return q.normalized();
+   }
+   q.coeffs() = (sin((1.0f - t) * theta) * a.coeffs() + sin(t * theta) * b.coeffs()) / sin_theta;
+   return q;
+}
+
+Quaternionf squad(const Quaternionf& q0, const Quaternionf& q1, const Quaternionf& s0, const Quaternionf& s1, float h) {
+   return slerpNoInvert(slerpNoInvert(q0, q1, h), slerpNoInvert(s0, s1, h), 2.0f * h * (1.0f - h));
+}
+
+void trackKeyAdded(vector<Quaternionf>& values, vector<Quaternionf>& controls, int first) {
+   int n = (int)values.size();
+   int keys = n - first;
+   // q and -q are the same rotation, so pick whichever is closer to the last
+   //  key. Then nothing downstream has to worry about the long way round.
+   if (keys >= 2 && values[n-1].dot(values[n-2]) < 0.0f) {
+      values[n-1].coeffs() *= -1.0f;
+   }
+
+   // The ends have no neighbor on one side, so they're their own control.
+   //  Adding a key gives the previous one its second neighbor.
+   controls.push_back(values[n-1]);
+   if (keys >= 3) {
+      controls[n-2] = squadControl(values[n-3], values[n-2], values[n-1]);
+   }
+}
@@ -0,0 +1,324 @@
+//
+//  track.hpp
+//  Asgn1
+//
+//  Keyframe tracks. A Track<T> is a list of (time, value) keys for a float,
+//  Vector3f or Quaternionf, stored as separate arrays of times, values and
+//  interpolation modes. Each key's mode says how to get from it to the next
+//  key. A TrackSampler remembers where it was last time, so playing a track
+//  forwards doesn't have to search for the right key every frame.
+//
+//  For lots of tracks, a TrackSet keeps all of their keys in the same arrays
+//  (one track after another) along with a cursor per track, so sampling
+//  every track in a frame is one pass through memory.
+//
+
+#ifndef track_hpp
+#define track_hpp
+
+#define EIGEN_DONT_ALIGN_STATICALLY
+
+#include <vector>
+#include <algorithm>
+#include <cassert>
+#include <Eigen/Dense>
+
+enum Interpolation {
+   INTERP_STEP,        // hold the value until the next key
+   INTERP_LINEAR,      // normalized lerp for quaternions
+   INTERP_CATMULL_ROM, // uses the keys on either side too
+   INTERP_SLERP,       // quaternions only, linear for everything else
+   INTERP_SQUAD        // quaternions only, Catmull-Rom for everything else
+};
+
+/* Squad helpers, also handy outside of tracks. squadControl() is the inner
+ *  control quaternion for curr, given its neighbors (all in the same
+ *  hemisphere). squad() goes from q0 to q1 with controls s0 and s1. */
+Eigen::Quaternionf squadControl(const Eigen::Quaternionf& prev, const Eigen::Quaternionf& curr, const Eigen::Quaternionf& next);
+Eigen::Quaternionf squad(const Eigen::Quaternionf& q0, const Eigen::Quaternionf& q1,
+                         const Eigen::Quaternionf& s0, const Eigen::Quaternionf& s1, float h);
+
+/* The per-type math. The templates do floats and vectors, the overloads do
+ *  quaternions. */
+template <typename T>
+inline T trackLerp(const T& a, const T& b, float alpha) {
+   return (1.0f - alpha) * a + alpha * b;
+}
+
+inline Eigen::Quaternionf trackLerp(const Eigen::Quaternionf& a, const Eigen::Quaternionf& b, float alpha) {
+   Eigen::Quaternionf q;
+   q.coeffs() = (1.0f - alpha) * a.coeffs() + alpha * b.coeffs();
+   return q.normalized();
+}
+
+template <typename T>
+inline T trackCatmullRom(const T& p0, const T& p1, const T& p2, const T& p3, float u) {
+   return 0.5f * ((2.0f * p1) +
+                  (p2 - p0) * u +
+                  (2.0f * p0 - 5.0f * p1 + 4.0f * p2 - p3) * (u * u) +
+                  (3.0f * p1 - p0 - 3.0f * p2 + p3) * (u * u * u));
+}
+
+inline Eigen::Quaternionf trackCatmullRom(const Eigen::Quaternionf& p0, const Eigen::Quaternionf& p1,
+                                          const Eigen::Quaternionf& p2, const Eigen::Quaternionf& p3, float u) {
+   Eigen::Quaternionf q;
+   q.coeffs() = trackCatmullRom(p0.coeffs(), p1.coeffs(), p2.coeffs(), p3.coeffs(), u);
+   return q.normalized();
+}
+
+template <typename T>
+inline T trackSlerp(const T& a, const T& b, float alpha) {
+   return trackLerp(a, b, alpha);
+}
+
+inline Eigen::Quaternionf trackSlerp(const Eigen::Quaternionf& a, const Eigen::Quaternionf& b, float alpha) {
+   return a.slerp(alpha, b);
+}
+
+/* What a track with no keys evaluates to: zero, or no rotation */
+template <typename T>
+inline T trackEmptyValue(const T*) {
+   return T::Zero();
+}
+
+inline float trackEmptyValue(const float*) {
+   return 0.0f;
+}
+
+inline Eigen::Quaternionf trackEmptyValue(const Eigen::Quaternionf*) {
+   return Eigen::Quaternionf::Identity();
+}
+
+/* Called after every new key of a track whose keys start at first:
+ *  quaternion keys get flipped into the previous key's hemisphere, and get
+ *  their squad controls worked out. */
+template <typename T>
+inline void trackKeyAdded(std::vector<T>& values, std::vector<T>& controls, int first) {
+}
+
+void trackKeyAdded(std::vector<Eigen::Quaternionf>& values, std::vector<Eigen::Quaternionf>& controls, int first);
+
+template <typename T>
+inline T trackSquad(const T* values, const T* controls, int n, int k, float alpha) {
+   return trackCatmullRom(values[std::max(0, k - 1)], values[k], values[k + 1], values[std::min(n - 1, k + 2)], alpha);
+}
+
+inline Eigen::Quaternionf trackSquad(const Eigen::Quaternionf* values, const Eigen::Quaternionf* controls,
+                                     int n, int k, float alpha) {
+   return squad(values[k], values[k + 1], controls[k], controls[k + 1], alpha);
+}
+
+/* The guts of sampling, shared by Track and TrackSet. These work on one
+ *  track's n keys. */
+
+/* The key whose segment t is in, by binary search. Before the start it's 0,
+ *  and past the end it's the last key. */
+inline int trackFindKey(const float* times, int n, float t) {
+   int k = (int)(std::upper_bound(times, times + n, t) - times) - 1;
+   return std::max(0, k);
+}
+
+/* Moves a cursor (a key from an earlier sample) to t's segment. Moving
+ *  forward by a little, like playing at a frame rate, just checks the next
+ *  few keys, so it's O(1). Jumping back or far ahead does a binary search. */
+inline int trackMoveCursor(const float* times, int n, int cursor, float t) {
+   if (n == 0) {
+      return 0;
+   }
+   if (t < times[cursor]) {
+      return trackFindKey(times, n, t);
+   }
+   // How many keys to step over before giving up and searching
+   const int MAX_STEPS = 4;
+   int steps = 0;
+   while (cursor < n - 1 && t >= times[cursor + 1]) {
+      if (++steps > MAX_STEPS) {
+         return trackFindKey(times, n, t);
+      }
+      cursor++;
+   }
+   return cursor;
+}
+
+/* Value at time t, given t's segment k. Clamps to the first and last keys
+ *  outside the track. */
+template <typename T>
+inline T trackEvaluate(const float* times, const T* values, const unsigned char* modes, const T* controls,
+                       int n, int k, float t) {
+   if (n == 0) {
+      return trackEmptyValue(values);
+   }
+   if (k >= n - 1) {
+      return values[n - 1];
+   }
+   if (t <= times[k]) {
+      return values[k];
+   }
+   float alpha = std::min(1.0f, (t - times[k]) / (times[k + 1] - times[k]));
+
+   switch (modes[k]) {
+      case INTERP_STEP:
+         return values[k];
+      case INTERP_LINEAR:
+         return trackLerp(values[k], values[k + 1], alpha);
+      case INTERP_CATMULL_ROM:
+         return trackCatmullRom(values[std::max(0, k - 1)], values[k], values[k + 1],
+                                values[std::min(n - 1, k + 2)], alpha);
+      case INTERP_SLERP:
+         return trackSlerp(values[k], values[k + 1], alpha);
+      case INTERP_SQUAD:
+      default:
+         return trackSquad(values, controls, n, k, alpha);
+   }
+}
+
+template <typename T>
+class Track {
+public:
+   /* Keys have to be added in order of time */
+   void addKey(float time, const T& value, Interpolation mode = INTERP_LINEAR) {
+      assert(times.empty() || time > times.back());
+      times.push_back(time);
+      values.push_back(value);
+      modes.push_back((unsigned char)mode);
+      trackKeyAdded(values, controls, 0);
+   }
+
+   int getNumKeys() const { return (int)times.size(); }
+   float getStartTime() const { return times.empty() ? 0.0f : times.front(); }
+   float getEndTime() const { return times.empty() ? 0.0f : times.back(); }
+   float getKeyTime(int k) const { return times[k]; }
+   const T& getKeyValue(int k) const { return values[k]; }
+
+   /* Without keys these are key 0 and trackEmptyValue() */
+   int findKey(float t) const {
+      if (getNumKeys() == 0) {
+         return 0;
+      }
+      return trackFindKey(&times[0], getNumKeys(), t);
+   }
+   int moveCursor(int cursor, float t) const {
+      if (getNumKeys() == 0) {
+         return 0;
+      }
+      return trackMoveCursor(&times[0], getNumKeys(), cursor, t);
+   }
+   /* Value at time t, starting from key k's segment */
+   T evaluate(int k, float t) const {
+      if (getNumKeys() == 0) {
+         return trackEmptyValue((const T*)0);
+      }
+      return trackEvaluate(&times[0], &values[0], &modes[0], controls.empty() ? 0 : &controls[0], getNumKeys(), k, t);
+   }
+   /* Value at time t, searching for the key. For playback use a sampler. */
+   T sample(float t) const {
+      return evaluate(findKey(t), t);
+   }
+
+private:
+   std::vector<float> times;
+   std::vector<T> values;
+   std::vector<unsigned char> modes;
+   std::vector<T> controls; // squad controls, quaternion tracks only
+};
+
+/* Samples a track, remembering which key it was at */
+template <typename T>
+class TrackSampler {
+public:
+   TrackSampler(const Track<T>* track = 0) : track(track), cursor(0) {}
+
+   void setTrack(const Track<T>* track) {
+      this->track = track;
+      cursor = 0;
+   }
+
+   T sample(float t) {
+      cursor = track->moveCursor(cursor, t);
+      return track->evaluate(cursor, t);
+   }
+
+   int getCursor() const { return cursor; }
+
+private:
+   const Track<T>* track;
+   int cursor;
+};
+
+/* Lots of tracks of the same type, with all the keys in shared arrays */
+template <typename T>
+class TrackSet {
+public:
+   TrackSet() {
+      first_key.push_back(0);
+   }
+
+   /* Starts a new track and returns its index. Keys go to the newest track. */
+   int addTrack() {
+      first_key.push_back(first_key.back());
+      cursors.push_back(0);
+      return getNumTracks() - 1;
+   }
+   void addKey(float time, const T& value, Interpolation mode = INTERP_LINEAR) {
+      int first = first_key[first_key.size() - 2];
+      assert((int)times.size() == first || time > times.back());
+      times.push_back(time);
+      values.push_back(value);
+      modes.push_back((unsigned char)mode);
+      trackKeyAdded(values, controls, first);
+      first_key.back()++;
+   }
+   /* Room for this many keys altogether, so adding them doesn't reallocate */
+   void reserve(int num_keys) {
+      times.reserve(num_keys);
+      values.reserve(num_keys);
+      modes.reserve(num_keys);
+   }
+
+   int getNumTracks() const { return (int)first_key.size() - 1; }
+   int getNumKeys(int track) const { return first_key[track + 1] - first_key[track]; }
+
+   /* One track at time t, searching for the key */
+   T sample(int track, float t) const {
+      int first = first_key[track];
+      int n = first_key[track + 1] - first;
+      return trackEvaluate(times.data() + first, values.data() + first, modes.data() + first,
+                           controls.empty() ? 0 : controls.data() + first, n, trackFindKey(times.data() + first, n, t), t);
+   }
+
+   /* Every track at time t, using (and moving) each track's cursor. Tracks
+    *  begin to end is beginning to end of the arrays. */
+   void sampleAll(float t, T* out) {
+      sampleRange(0, getNumTracks(), t, out);
+   }
+   /* Same for tracks [begin, end) only, out[0] being track begin. Different
+    *  ranges can be sampled from different threads. */
+   void sampleRange(int begin, int end, float t, T* out) {
+      const T* ctrl = controls.empty() ? 0 : controls.data();
+      for (int i = begin; i < end; i++) {
+         int first = first_key[i];
+         int n = first_key[i + 1] - first;
+         int k = trackMoveCursor(times.data() + first, n, cursors[i], t);
+         cursors[i] = k;
+         out[i - begin] = trackEvaluate(times.data() + first, values.data() + first, modes.data() + first,
+                                        ctrl ? ctrl + first : 0, n, k, t);
+      }
+   }
+
+private:
+   std::vector<int> first_key; // track i's keys are [first_key[i], first_key[i+1])
+   std::vector<float> times;
+   std::vector<T> values;
+   std::vector<unsigned char> modes;
+   std::vector<T> controls;
+   std::vector<int> cursors; // per track, relative to its first key
+};
+
+typedef Track<float> FloatTrack;
+typedef Track<Eigen::Vector3f> Vector3Track;
+typedef Track<Eigen::Quaternionf> QuaternionTrack;
+typedef TrackSet<float> FloatTrackSet;
+typedef TrackSet<Eigen::Vector3f> Vector3TrackSet;
+typedef TrackSet<Eigen::Quaternionf> QuaternionTrackSet;
+
+#endif /* track_hpp */
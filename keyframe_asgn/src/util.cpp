@@ -9,66 +9,174 @@
 
 #include "util.hpp"
 #include "GLSL.h"
+#include "ThreadPool.h"
+#include "spline.hpp"
+
+#include <algorithm>
 
 using namespace std;
 using namespace Eigen;
 
 
-#define MAX_SAMPLES 5
+// Deepest a segment gets subdivided, i.e. at most 2^20 table entries per segment
+#define MAX_DEPTH 20
+
+/* 3-point Gauss quadrature of the speed |P'(u)| over [ua, ub] of segment k */
+static float gaussLength(const Spline& spline, int k, float ua, float ub) {
+   float ubua_2 =     (ub - ua) / 2.0f;
+   float ubua_2_pos = (ub + ua) / 2.0f;
+   
+   Vector3f p_prime_1 = spline.evaluateDerivative(k, ubua_2 * -0.77459f + ubua_2_pos);
+   Vector3f p_prime_2 = spline.evaluateDerivative(k, ubua_2 * 0.0f      + ubua_2_pos);
+   Vector3f p_prime_3 = spline.evaluateDerivative(k, ubua_2 * 0.77459f  + ubua_2_pos);
+   
+   float w1 = 5.0f/9.0f;
+   float w2 = 8.0f/9.0f;
+   float w3 = 5.0f/9.0f;
+   
+   return ubua_2 * (
+     w1*p_prime_1.norm() + w2*p_prime_2.norm() + w3*p_prime_3.norm()
+   );
+}
 
-Vector4f uvecify(float u) {
-   return Vector4f(0.0f, 1.0f, 2*u, 3*u*u);
+/* Appends (u at start, arc length) pieces covering [ua, ub] to pieces.
+ *  A piece is kept whole once splitting it no longer changes its length
+ *  estimate, and its quarters are about equally long (so lerping u across it
+ *  in s is accurate). Otherwise recurse into the halves. */
+static void subdivide(const Spline& spline, int k, float ua, float ub, float whole, float tolerance, int depth,
+                      vector<pair<float,float> > *pieces) {
+   float du = 0.25f * (ub - ua);
+   float quarters[4];
+   for (int i = 0; i < 4; i++) {
+      quarters[i] = gaussLength(spline, k, ua + i * du, ua + (i + 1) * du);
+   }
+   float left = quarters[0] + quarters[1];
+   float right = quarters[2] + quarters[3];
+   float length = left + right;
+   
+   bool converged = fabs(length - whole) <= tolerance;
+   bool even = fabs(quarters[0] - 0.25f * length) <= tolerance &&
+               fabs(left - 0.5f * length) <= tolerance &&
+               fabs(quarters[3] - 0.25f * length) <= tolerance;
+   if ((converged && even) || depth >= MAX_DEPTH) {
+      pieces->push_back(make_pair(ua, length));
+      return;
+   }
+   
+   float um = 0.5f * (ua + ub);
+   subdivide(spline, k, ua, um, left, tolerance, depth + 1, pieces);
+   subdivide(spline, k, um, ub, right, tolerance, depth + 1, pieces);
 }
 
-float buildTable(std::vector<std::pair<float,float> > *usTable, std::vector<Eigen::Vector3f> cps, const Eigen::Matrix4f& Bcr)
+float buildTable(std::vector<std::pair<float,float> > *usTable, const Spline& spline, float tolerance, ThreadPool *pool)
 {
    usTable->clear();
    
-   int ncps = cps.size();
+   int nsegs = spline.getNumSegments();
+   if (nsegs < 1) {
+      return 0.0f;
+   }
    
-   // Get the G and B matrices
-   MatrixXf G(3, cps.size());
-   MatrixXf Gk(3,4);
-   for(int i = 0; i < cps.size(); ++i) {
-      G.block<3,1>(0,i) = cps[i];
+   // Segments don't depend on each other, so subdivide them all in parallel
+   vector<vector<pair<float,float> > > pieces(nsegs);
+   auto buildSegments = [&](int begin, int end, int thread) {
+      for (int k = begin; k < end; k++) {
+         subdivide(spline, k, 0.0f, 1.0f, gaussLength(spline, k, 0.0f, 1.0f), tolerance, 0, &pieces[k]);
+      }
+   };
+   if (pool) {
+      pool->parallelForDynamic(nsegs, 1, buildSegments);
+   }
+   else {
+      buildSegments(0, nsegs, 0);
    }
    
+   // Stitch them together with a running total
    float total_dist = 0.0f;
-   float s = 0;
-   
-   for(int k = 0; k < ncps - 3; ++k) {
-      Gk = G.block<3,4>(0,k);
-      
-      for (int sampleNum = 0; sampleNum < MAX_SAMPLES; sampleNum++) {
-         float ub = (float) (sampleNum + 1) / (float) MAX_SAMPLES;
-         float ua = (float) (sampleNum)     / (float) MAX_SAMPLES;
-         
-         float ubua_2 =     (ub - ua) / 2.0f;
-         float ubua_2_pos = (ub + ua) / 2.0f;
-         
-         Vector4f u_prime_1 = uvecify(ubua_2 * -0.77459f + ubua_2_pos);
-         Vector4f u_prime_2 = uvecify(ubua_2 * 0.0f      + ubua_2_pos);
-         Vector4f u_prime_3 = uvecify(ubua_2 * 0.77459f  + ubua_2_pos);
-         
-         Vector3f p_prime_1 = Gk * Bcr * u_prime_1;
-         Vector3f p_prime_2 = Gk * Bcr * u_prime_2;
-         Vector3f p_prime_3 = Gk * Bcr * u_prime_3;
-         
-         float w1 = 5.0f/9.0f;
-         float w2 = 8.0f/9.0f;
-         float w3 = 5.0f/9.0f;
-         
-         s = ubua_2 * (
-           w1*p_prime_1.norm() + w2*p_prime_2.norm() + w3*p_prime_3.norm()
-         );
-         
-         usTable->push_back(make_pair(ua + k, total_dist));
-         
-         total_dist += s;
+   float last_seg_start = 0.0f;
+   for (int k = 0; k < nsegs; k++) {
+      if (k == nsegs - 1) {
+         last_seg_start = total_dist;
       }
+      for (const pair<float,float>& piece : pieces[k]) {
+         usTable->push_back(make_pair(piece.first + k, total_dist));
+         total_dist += piece.second;
+      }
+   }
+   usTable->push_back(make_pair((float)nsegs, total_dist));
+   
+   return last_seg_start;
+}
+
+/* For upper_bound: is s before this table entry's s-value? */
+static bool sBefore(float s, const pair<float,float>& entry) {
+   return s < entry.second;
+}
+
+float s2u(const vector<pair<float,float> > &usTable, float s) {
+   if (usTable.size() < 2) {
+      return usTable.empty() ? 0.0f : usTable[0].first;
    }
    
-   return (*usTable)[(ncps-4) * MAX_SAMPLES].second;
+   // First entry past s (never the 0th, so there's always an entry before it).
+   //  Past the end of the table we clamp to the last u.
+   int i = (int)(upper_bound(usTable.begin() + 1, usTable.end(), s, sBefore) - usTable.begin());
+   i = min(i, (int)usTable.size() - 1);
+   
+   float s0 = usTable[i-1].second;
+   float s1 = usTable[i].second;
+   
+   float u0 = usTable[i-1].first;
+   float u1 = usTable[i].first;
+   
+   float alpha = s1 > s0 ? (s - s0) / (s1 - s0) : 0.0f;
+   alpha = max(0.0f, min(1.0f, alpha));
+   return (1.0f - alpha) * u0 + alpha * u1;
+}
+
+UniformS2U::UniformS2U() : s_min(0.0f), ds_inv(0.0f) {
+}
+
+void UniformS2U::build(const vector<pair<float,float> > &usTable, int num_entries) {
+   us.clear();
+   if (usTable.empty() || num_entries < 2) {
+      return;
+   }
+   
+   s_min = usTable.front().second;
+   float ds = (usTable.back().second - s_min) / (num_entries - 1);
+   ds_inv = ds > 0.0f ? 1.0f / ds : 0.0f;
+   
+   for (int j = 0; j < num_entries; j++) {
+      us.push_back(s2u(usTable, s_min + j * ds));
+   }
+}
+
+float UniformS2U::lookup(float s) const {
+   // Nothing to interpolate between before build() has made a table
+   if (us.size() < 2) {
+      return us.empty() ? 0.0f : us[0];
+   }
+   float x = (s - s_min) * ds_inv;
+   int j = max(0, min((int)us.size() - 2, (int)x));
+   float alpha = max(0.0f, min(1.0f, x - j));
+   return (1.0f - alpha) * us[j] + alpha * us[j+1];
+}
+
+float UniformS2U::maxError(const vector<pair<float,float> > &usTable, int samples_per_entry) const {
+   float max_err = 0.0f;
+   for (int i = 0; i + 1 < (int)usTable.size(); i++) {
+      for (int k = 0; k < samples_per_entry; k++) {
+         float alpha = (float)k / samples_per_entry;
+         float s = (1.0f - alpha) * usTable[i].second + alpha * usTable[i+1].second;
+         max_err = max(max_err, fabs(lookup(s) - s2u(usTable, s)));
+      }
+   }
+   return max_err;
+}
+
+double millisSince(chrono::steady_clock::time_point start) {
+   return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
 }
 
 void drawFrame() {
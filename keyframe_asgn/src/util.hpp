@@ -11,9 +11,41 @@
 
 #include <stdio.h>
 #include <vector>
+#include <chrono>
 #include <Eigen/Dense>
 
-float buildTable(std::vector<std::pair<float,float> > *usTable, std::vector<Eigen::Vector3f> cps, Eigen::Matrix4f Bcr);
+class ThreadPool;
+class Spline;
+
+/* Fills usTable with (u, s) pairs along the spline and returns the arc length
+ *  up to the start of the last segment. Each segment is subdivided until the
+ *  arc length of every piece is known to within `tolerance`, and until
+ *  lerping u between table entries is off by less than `tolerance` in s. */
+float buildTable(std::vector<std::pair<float,float> > *usTable, const Spline& spline, float tolerance = 1e-3f, ThreadPool *pool = 0);
 void drawFrame();
 
+/* Milliseconds since start, for timing things */
+double millisSince(std::chrono::steady_clock::time_point start);
+
+/* Get the u-value at arc length s by binary searching the (u, s) table */
+float s2u(const std::vector<std::pair<float,float> > &usTable, float s);
+
+/* The same s -> u mapping resampled at evenly spaced s-values, so a lookup
+ *  is just an index computation and a lerp instead of a search. */
+class UniformS2U {
+public:
+   UniformS2U();
+   void build(const std::vector<std::pair<float,float> > &usTable, int num_entries);
+   float lookup(float s) const;
+   /* Biggest difference in u from s2u() on the exact table, sampled
+    *  samples_per_entry times between each pair of exact entries. */
+   float maxError(const std::vector<std::pair<float,float> > &usTable, int samples_per_entry) const;
+   int size() const { return (int)us.size(); }
+   
+private:
+   std::vector<float> us;
+   float s_min;
+   float ds_inv;
+};
+
 #endif /* util_hpp */
@@ -0,0 +1,301 @@
+#include "BVH.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <limits>
+
+using namespace std;
+using namespace Eigen;
+
+// Max triangles per leaf
+#define LEAF_SIZE 4
+// Depth at which the tree is cut into independently refit subtrees. 2^6 = 64
+// subtrees keeps every core busy without making the serial top part big.
+#define SPLIT_DEPTH 6
+
+static inline Vector3f vertexAt(const vector<float> &pos, unsigned int i)
+{
+	return Vector3f(pos[3*i], pos[3*i+1], pos[3*i+2]);
+}
+
+// Sorts triangle indices by one coordinate of their centroid
+class CentroidSorter
+{
+public:
+	CentroidSorter(const vector<Vector3f> &c, int axis) : c(c), axis(axis) {}
+	bool operator()(int a, int b) const { return c[a](axis) < c[b](axis); }
+private:
+	const vector<Vector3f> &c;
+	int axis;
+};
+
+// Closest point to p on triangle abc (Ericson, Real-Time Collision Detection 5.1.5)
+static Vector3f closestPointOnTriangle(const Vector3f &p, const Vector3f &a, const Vector3f &b, const Vector3f &c)
+{
+	Vector3f ab = b - a;
+	Vector3f ac = c - a;
+	Vector3f ap = p - a;
+	float d1 = ab.dot(ap);
+	float d2 = ac.dot(ap);
+	if(d1 <= 0.0f && d2 <= 0.0f) return a;
+	Vector3f bp = p - b;
+	float d3 = ab.dot(bp);
+	float d4 = ac.dot(bp);
+	if(d3 >= 0.0f && d4 <= d3) return b;
+	float vc = d1*d4 - d3*d2;
+	if(vc <= 0.0f && d1 >= 0.0f && d3 <= 0.0f) {
+		return a + (d1 / (d1 - d3)) * ab;
+	}
+	Vector3f cp = p - c;
+	float d5 = ab.dot(cp);
+	float d6 = ac.dot(cp);
+	if(d6 >= 0.0f && d5 <= d6) return c;
+	float vb = d5*d2 - d1*d6;
+	if(vb <= 0.0f && d2 >= 0.0f && d6 <= 0.0f) {
+		return a + (d2 / (d2 - d6)) * ac;
+	}
+	float va = d3*d6 - d5*d4;
+	if(va <= 0.0f && (d4 - d3) >= 0.0f && (d5 - d6) >= 0.0f) {
+		return b + ((d4 - d3) / ((d4 - d3) + (d5 - d6))) * (c - b);
+	}
+	float denom = 1.0f / (va + vb + vc);
+	return a + ab * (vb * denom) + ac * (vc * denom);
+}
+
+BVH::BVH() :
+	splitDepth(SPLIT_DEPTH)
+{
+}
+
+BVH::~BVH()
+{
+}
+
+void BVH::build(const vector<float> &pos, const vector<unsigned int> &ele)
+{
+	this->ele = ele;
+	nodes.clear();
+	subtrees.clear();
+	topNodes.clear();
+
+	int ntris = (int)ele.size() / 3;
+	triIndices.resize(ntris);
+	vector<Vector3f> centroids(ntris);
+	for(int i = 0; i < ntris; ++i) {
+		triIndices[i] = i;
+		centroids[i] = (vertexAt(pos, ele[3*i]) + vertexAt(pos, ele[3*i+1]) + vertexAt(pos, ele[3*i+2])) / 3.0f;
+	}
+	if(ntris == 0) {
+		return;
+	}
+	nodes.reserve(2 * ntris / LEAF_SIZE + 1);
+	buildRecursive(centroids, 0, ntris, 0);
+	refit(pos);
+}
+
+int BVH::buildRecursive(const vector<Vector3f> &centroids, int begin, int end, int depth)
+{
+	int index = (int)nodes.size();
+	Node node;
+	node.bmin.setZero();
+	node.bmax.setZero();
+	node.first = begin;
+	node.count = end - begin;
+	nodes.push_back(node);
+	if(depth < splitDepth) {
+		topNodes.push_back(index);
+	}
+
+	if(end - begin > LEAF_SIZE) {
+		// Split at the median centroid along the longest axis
+		Vector3f cmin = centroids[triIndices[begin]];
+		Vector3f cmax = cmin;
+		for(int i = begin + 1; i < end; ++i) {
+			cmin = cmin.cwiseMin(centroids[triIndices[i]]);
+			cmax = cmax.cwiseMax(centroids[triIndices[i]]);
+		}
+		int axis;
+		float extent = (cmax - cmin).maxCoeff(&axis);
+		if(extent > 0.0f) {
+			int mid = (begin + end) / 2;
+			nth_element(triIndices.begin() + begin, triIndices.begin() + mid, triIndices.begin() + end, CentroidSorter(centroids, axis));
+			buildRecursive(centroids, begin, mid, depth + 1);
+			int right = buildRecursive(centroids, mid, end, depth + 1);
+			nodes[index].first = right;
+			nodes[index].count = 0;
+		}
+	}
+
+	if(depth == splitDepth) {
+		subtrees.push_back(make_pair(index, (int)nodes.size()));
+	}
+	return index;
+}
+
+void BVH::refitNode(const vector<float> &pos, int i)
+{
+	Node &node = nodes[i];
+	if(node.count > 0) {
+		Vector3f bmin = Vector3f::Constant(numeric_limits<float>::max());
+		Vector3f bmax = -bmin;
+		for(int k = node.first; k < node.first + node.count; ++k) {
+			int tri = triIndices[k];
+			for(int j = 0; j < 3; ++j) {
+				Vector3f p = vertexAt(pos, ele[3*tri + j]);
+				bmin = bmin.cwiseMin(p);
+				bmax = bmax.cwiseMax(p);
+			}
+		}
+		node.bmin = bmin;
+		node.bmax = bmax;
+	} else {
+		const Node &l = nodes[i + 1];
+		const Node &r = nodes[node.first];
+		node.bmin = l.bmin.cwiseMin(r.bmin);
+		node.bmax = l.bmax.cwiseMax(r.bmax);
+	}
+}
+
+void BVH::refitRange(const vector<float> &pos, int begin, int end)
+{
+	// Children always come after their parent, so walking backwards is bottom-up.
+	for(int i = end - 1; i >= begin; --i) {
+		refitNode(pos, i);
+	}
+}
+
+void BVH::refit(const vector<float> &pos, ThreadPool *pool)
+{
+	if(pool) {
+		pool->parallelForDynamic((int)subtrees.size(), 1, [&](int begin, int end, int thread) {
+			for(int s = begin; s < end; ++s) {
+				refitRange(pos, subtrees[s].first, subtrees[s].second);
+			}
+		});
+	} else {
+		for(int s = 0; s < (int)subtrees.size(); ++s) {
+			refitRange(pos, subtrees[s].first, subtrees[s].second);
+		}
+	}
+	for(int k = (int)topNodes.size() - 1; k >= 0; --k) {
+		refitNode(pos, topNodes[k]);
+	}
+}
+
+// Slab test. Returns the entry distance, or infinity on a miss.
+static inline float intersectBox(const Vector3f &bmin, const Vector3f &bmax, const Vector3f &orig, const Vector3f &invDir, float tmax)
+{
+	Vector3f t0 = (bmin - orig).cwiseProduct(invDir);
+	Vector3f t1 = (bmax - orig).cwiseProduct(invDir);
+	float tnear = max(0.0f, t0.cwiseMin(t1).maxCoeff());
+	float tfar = min(tmax, t0.cwiseMax(t1).minCoeff());
+	return tnear <= tfar ? tnear : numeric_limits<float>::infinity();
+}
+
+bool BVH::rayCast(const vector<float> &pos, const Vector3f &orig, const Vector3f &dir, float tmax, Hit &hit) const
+{
+	if(nodes.empty()) {
+		return false;
+	}
+	const float inf = numeric_limits<float>::infinity();
+	Vector3f invDir(1.0f / dir(0), 1.0f / dir(1), 1.0f / dir(2));
+	hit.tri = -1;
+	hit.t = tmax;
+
+	int stack[64];
+	int top = 0;
+	if(intersectBox(nodes[0].bmin, nodes[0].bmax, orig, invDir, hit.t) == inf) {
+		return false;
+	}
+	stack[top++] = 0;
+	while(top > 0) {
+		const Node &node = nodes[stack[--top]];
+		if(node.count > 0) {
+			for(int k = node.first; k < node.first + node.count; ++k) {
+				// Moller-Trumbore
+				int tri = triIndices[k];
+				Vector3f a = vertexAt(pos, ele[3*tri]);
+				Vector3f e1 = vertexAt(pos, ele[3*tri+1]) - a;
+				Vector3f e2 = vertexAt(pos, ele[3*tri+2]) - a;
+				Vector3f p = dir.cross(e2);
+				float det = e1.dot(p);
+				if(fabs(det) < 1e-12f) {
+					continue;
+				}
+				float invDet = 1.0f / det;
+				Vector3f s = orig - a;
+				float u = s.dot(p) * invDet;
+				if(u < 0.0f || u > 1.0f) {
+					continue;
+				}
+				Vector3f q = s.cross(e1);
+				float v = dir.dot(q) * invDet;
+				if(v < 0.0f || u + v > 1.0f) {
+					continue;
+				}
+				float t = e2.dot(q) * invDet;
+				if(t >= 0.0f && t < hit.t) {
+					hit.t = t;
+					hit.tri = tri;
+					hit.u = u;
+					hit.v = v;
+				}
+			}
+		} else {
+			// Visit the nearer child first so the farther one can be culled
+			int l = (int)(&node - &nodes[0]) + 1;
+			int r = node.first;
+			float tl = intersectBox(nodes[l].bmin, nodes[l].bmax, orig, invDir, hit.t);
+			float tr = intersectBox(nodes[r].bmin, nodes[r].bmax, orig, invDir, hit.t);
+			if(tl > tr) {
+				swap(l, r);
+				swap(tl, tr);
+			}
+			if(tr != inf) {
+				stack[top++] = r;
+			}
+			if(tl != inf) {
+				stack[top++] = l;
+			}
+		}
+	}
+	return hit.tri != -1;
+}
+
+int BVH::sphereOverlap(const vector<float> &pos, const Vector3f &center, float radius, vector<int> &tris) const
+{
+	if(nodes.empty()) {
+		return 0;
+	}
+	int found = 0;
+	float r2 = radius * radius;
+	int stack[64];
+	int top = 0;
+	stack[top++] = 0;
+	while(top > 0) {
+		int i = stack[--top];
+		const Node &node = nodes[i];
+		// Squared distance from the center to the box
+		Vector3f d = (node.bmin - center).cwiseMax(center - node.bmax).cwiseMax(Vector3f::Zero());
+		if(d.squaredNorm() > r2) {
+			continue;
+		}
+		if(node.count > 0) {
+			for(int k = node.first; k < node.first + node.count; ++k) {
+				int tri = triIndices[k];
+				Vector3f p = closestPointOnTriangle(center,
+				                                   vertexAt(pos, ele[3*tri]),
+				                                   vertexAt(pos, ele[3*tri+1]),
+				                                   vertexAt(pos, ele[3*tri+2]));
+				if((p - center).squaredNorm() <= r2) {
+					tris.push_back(tri);
+					++found;
+				}
+			}
+		} else {
+			stack[top++] = node.first;
+			stack[top++] = i + 1;
+		}
+	}
+	return found;
+}
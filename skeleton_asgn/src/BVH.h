@@ -0,0 +1,73 @@
+#pragma once
+#ifndef _BVH_H_
+#define _BVH_H_
+
+#include <vector>
+
+#define EIGEN_DONT_ALIGN_STATICALLY
+#include <Eigen/Dense>
+
+class ThreadPool;
+
+// Bounding volume hierarchy over the triangles of a deforming mesh.
+//
+// The tree topology is built once from the bind pose. After that, every frame
+// only the boxes are refit from the new vertex positions, which is much cheaper
+// than a rebuild and is good enough since skinning keeps neighboring triangles
+// close together.
+class BVH
+{
+public:
+	struct Hit
+	{
+		float t;   // distance along the ray (in units of |dir|)
+		int tri;   // triangle index (into the element buffer / 3)
+		float u;   // barycentric coords of the hit point
+		float v;
+	};
+
+	BVH();
+	virtual ~BVH();
+
+	// Builds the tree topology. pos is xyz-packed, ele holds 3 indices per
+	// triangle. The element buffer is copied; positions are not kept.
+	void build(const std::vector<float> &pos, const std::vector<unsigned int> &ele);
+	// Recomputes all boxes bottom-up from new positions of the same mesh.
+	void refit(const std::vector<float> &pos, ThreadPool *pool = 0);
+
+	// Closest hit along orig + t*dir for t in [0, tmax]. pos must be the
+	// positions the tree was last refit to.
+	bool rayCast(const std::vector<float> &pos, const Eigen::Vector3f &orig, const Eigen::Vector3f &dir, float tmax, Hit &hit) const;
+	// Appends every triangle touching the sphere to tris and returns how many
+	// were found.
+	int sphereOverlap(const std::vector<float> &pos, const Eigen::Vector3f &center, float radius, std::vector<int> &tris) const;
+
+	int getNumNodes() const { return (int)nodes.size(); }
+	int getNumTris() const { return (int)triIndices.size(); }
+
+private:
+	// Nodes are stored in depth-first order, so the left child of node i is
+	// always i+1 and every subtree occupies a contiguous range of the array.
+	struct Node
+	{
+		Eigen::Vector3f bmin;
+		Eigen::Vector3f bmax;
+		int first; // leaf: first entry in triIndices, inner: right child
+		int count; // leaf: number of triangles, inner: 0
+	};
+
+	int buildRecursive(const std::vector<Eigen::Vector3f> &centroids, int begin, int end, int depth);
+	void refitRange(const std::vector<float> &pos, int begin, int end);
+	void refitNode(const std::vector<float> &pos, int i);
+
+	std::vector<Node> nodes;
+	std::vector<int> triIndices;
+	std::vector<unsigned int> ele;
+	// Subtrees refit independently in parallel, as [root, end) node ranges,
+	// followed by the few nodes above them which are refit serially.
+	std::vector<std::pair<int, int> > subtrees;
+	std::vector<int> topNodes;
+	int splitDepth;
+};
+
+#endif
@@ -0,0 +1,300 @@
+#include "MotionDatabase.h"
+
+#include <cassert>
+#include <cmath>
+#include <limits>
+#include <algorithm>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+using namespace std;
+using namespace Eigen;
+
+// Bones of the Chebyshev skeleton used for the features
+#define ROOT_BONE 0
+#define LEFT_FOOT_BONE 6
+#define RIGHT_FOOT_BONE 10
+
+// How far ahead (in frames) the future trajectory is sampled
+static const int TRAJECTORY_FRAMES[3] = { 10, 20, 30 };
+
+// Features are quantized to [-QUANT_MAX, QUANT_MAX] so that squared
+// differences summed in pairs by _mm_madd_epi16 can't overflow 32 bits.
+#define QUANT_MAX 1023
+// Candidates kept from the quantized scan for the exact re-rank
+#define NUM_CANDIDATES 16
+
+// Feature dims that share one normalization scale: foot positions, foot
+// velocities, hip velocity, trajectory positions, trajectory directions.
+static const int GROUP_BEGIN[6] = { 0, 6, 12, 15, 21, 27 };
+
+// The character's frame at a given animation frame: root projected onto the
+// ground and the root's +z axis flattened to a heading.
+class CharacterFrame
+{
+public:
+	CharacterFrame(const MotionDatabase::Frames &frames, int numBones, int f)
+	{
+		const Matrix4f &M = frames[f*numBones + ROOT_BONE];
+		origin = M.block<3,1>(0,3);
+		origin(1) = 0.0f;
+		Vector3f fwd = M.block<3,3>(0,0) * Vector3f(0.0f, 0.0f, 1.0f);
+		fwd(1) = 0.0f;
+		if(fwd.squaredNorm() < 1e-8f) {
+			fwd << 0.0f, 0.0f, 1.0f;
+		}
+		zAxis = fwd.normalized();
+		xAxis << zAxis(2), 0.0f, -zAxis(0);
+	}
+
+	Vector3f toLocalPoint(const Vector3f &p) const { return toLocalVector(p - origin); }
+	Vector3f toLocalVector(const Vector3f &v) const { return Vector3f(v.dot(xAxis), v(1), v.dot(zAxis)); }
+
+	Vector3f origin;
+	Vector3f xAxis;
+	Vector3f zAxis;
+};
+
+static inline Vector3f bonePosition(const MotionDatabase::Frames &frames, int numBones, int f, int bone)
+{
+	return frames[f*numBones + bone].block<3,1>(0,3);
+}
+
+MotionDatabase::MotionDatabase() :
+	stride(0),
+	quantScale(1.0f)
+{
+	for(int d = 0; d < FEATURE_SIZE; ++d) {
+		offset[d] = 0.0f;
+		scale[d] = 1.0f;
+	}
+}
+
+MotionDatabase::~MotionDatabase()
+{
+}
+
+int MotionDatabase::addClip(const string &name, const Frames &frames, int numBones)
+{
+	int numFrames = (int)frames.size() / numBones;
+	int clip = (int)clipNames.size();
+	// Skip the bind pose and the first frame (needed for velocities), and the
+	// tail end where there is no future trajectory to look at.
+	int first = 2;
+	int last = numFrames - 1 - TRAJECTORY_FRAMES[2];
+	clipNames.push_back(name);
+	clipFirstEntry.push_back((int)entryClip.size());
+	clipFirstFrame.push_back(first);
+
+	for(int f = first; f <= last; ++f) {
+		CharacterFrame cf(frames, numBones, f);
+		float feature[FEATURE_SIZE];
+		float *x = feature;
+
+		const int feet[2] = { LEFT_FOOT_BONE, RIGHT_FOOT_BONE };
+		for(int k = 0; k < 2; ++k) {
+			Vector3f p = cf.toLocalPoint(bonePosition(frames, numBones, f, feet[k]));
+			*x++ = p(0); *x++ = p(1); *x++ = p(2);
+		}
+		// Velocities are central differences, in units per frame
+		for(int k = 0; k < 2; ++k) {
+			Vector3f v = 0.5f * (bonePosition(frames, numBones, f+1, feet[k]) - bonePosition(frames, numBones, f-1, feet[k]));
+			v = cf.toLocalVector(v);
+			*x++ = v(0); *x++ = v(1); *x++ = v(2);
+		}
+		Vector3f hipVel = cf.toLocalVector(0.5f * (bonePosition(frames, numBones, f+1, ROOT_BONE) - bonePosition(frames, numBones, f-1, ROOT_BONE)));
+		*x++ = hipVel(0); *x++ = hipVel(1); *x++ = hipVel(2);
+
+		for(int k = 0; k < 3; ++k) {
+			CharacterFrame future(frames, numBones, f + TRAJECTORY_FRAMES[k]);
+			Vector3f p = cf.toLocalPoint(future.origin);
+			*x++ = p(0); *x++ = p(2);
+		}
+		for(int k = 0; k < 3; ++k) {
+			CharacterFrame future(frames, numBones, f + TRAJECTORY_FRAMES[k]);
+			Vector3f d = cf.toLocalVector(future.zAxis);
+			*x++ = d(0); *x++ = d(2);
+		}
+		assert(x - feature == FEATURE_SIZE);
+
+		raw.insert(raw.end(), feature, feature + FEATURE_SIZE);
+		entryClip.push_back(clip);
+		entryFrame.push_back(f);
+	}
+	return clip;
+}
+
+void MotionDatabase::build()
+{
+	int n = getNumEntries();
+	if(n == 0) {
+		return;
+	}
+
+	// Each group of features gets scaled to unit standard deviation as a whole,
+	// so e.g. foot positions don't outweigh the trajectory just because there
+	// are more of them or they have bigger numbers.
+	VectorXd mean = VectorXd::Zero(FEATURE_SIZE);
+	VectorXd var = VectorXd::Zero(FEATURE_SIZE);
+	for(int i = 0; i < n; ++i) {
+		for(int d = 0; d < FEATURE_SIZE; ++d) {
+			mean(d) += raw[i*FEATURE_SIZE + d];
+		}
+	}
+	mean /= n;
+	for(int i = 0; i < n; ++i) {
+		for(int d = 0; d < FEATURE_SIZE; ++d) {
+			double dx = raw[i*FEATURE_SIZE + d] - mean(d);
+			var(d) += dx * dx;
+		}
+	}
+	var /= n;
+	for(int g = 0; g < 5; ++g) {
+		double groupVar = 0.0;
+		for(int d = GROUP_BEGIN[g]; d < GROUP_BEGIN[g+1]; ++d) {
+			groupVar += var(d);
+		}
+		groupVar /= (GROUP_BEGIN[g+1] - GROUP_BEGIN[g]);
+		float s = groupVar > 1e-12 ? (float)(1.0 / sqrt(groupVar)) : 1.0f;
+		for(int d = GROUP_BEGIN[g]; d < GROUP_BEGIN[g+1]; ++d) {
+			offset[d] = (float)mean(d);
+			scale[d] = s;
+		}
+	}
+
+	// Pad rows to a whole number of SSE registers (8 shorts)
+	stride = (FEATURE_SIZE + 7) / 8 * 8;
+	normalized.assign((size_t)n * stride, 0.0f);
+	float maxAbs = 0.0f;
+	for(int i = 0; i < n; ++i) {
+		normalize(&raw[i*FEATURE_SIZE], &normalized[(size_t)i*stride]);
+		for(int d = 0; d < FEATURE_SIZE; ++d) {
+			maxAbs = max(maxAbs, fabs(normalized[(size_t)i*stride + d]));
+		}
+	}
+	quantScale = maxAbs > 0.0f ? QUANT_MAX / maxAbs : 1.0f;
+	quantized.assign((size_t)n * stride, 0);
+	for(size_t k = 0; k < normalized.size(); ++k) {
+		quantized[k] = (short)floor(normalized[k] * quantScale + 0.5f);
+	}
+}
+
+void MotionDatabase::normalize(const float *in, float *out) const
+{
+	for(int d = 0; d < FEATURE_SIZE; ++d) {
+		out[d] = (in[d] - offset[d]) * scale[d];
+	}
+}
+
+VectorXf MotionDatabase::getFeature(int clip, int frame) const
+{
+	int entry = clipFirstEntry[clip] + frame - clipFirstFrame[clip];
+	assert(entry >= clipFirstEntry[clip] && entry < getNumEntries() && entryClip[entry] == clip);
+	return Map<const VectorXf>(&raw[entry*FEATURE_SIZE], FEATURE_SIZE);
+}
+
+float MotionDatabase::exactCost(const float *q, int entry) const
+{
+	const float *x = &normalized[(size_t)entry*stride];
+	float cost = 0.0f;
+	for(int d = 0; d < FEATURE_SIZE; ++d) {
+		float dx = q[d] - x[d];
+		cost += dx * dx;
+	}
+	return cost;
+}
+
+static inline int quantizedCost(const short *q, const short *x, int stride)
+{
+#ifdef __SSE2__
+	__m128i acc = _mm_setzero_si128();
+	for(int d = 0; d < stride; d += 8) {
+		__m128i diff = _mm_sub_epi16(_mm_loadu_si128((const __m128i *)(q + d)), _mm_loadu_si128((const __m128i *)(x + d)));
+		acc = _mm_add_epi32(acc, _mm_madd_epi16(diff, diff));
+	}
+	acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(1, 0, 3, 2)));
+	acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(2, 3, 0, 1)));
+	return _mm_cvtsi128_si32(acc);
+#else
+	int cost = 0;
+	for(int d = 0; d < stride; ++d) {
+		int diff = q[d] - x[d];
+		cost += diff * diff;
+	}
+	return cost;
+#endif
+}
+
+MotionDatabase::Match MotionDatabase::findBest(const VectorXf &query) const
+{
+	assert(query.size() == FEATURE_SIZE);
+	Match match = { -1, -1, numeric_limits<float>::max() };
+	int n = getNumEntries();
+	if(n == 0) {
+		return match;
+	}
+
+	vector<float> q(stride, 0.0f);
+	vector<short> qq(stride, 0);
+	normalize(query.data(), &q[0]);
+	for(int d = 0; d < FEATURE_SIZE; ++d) {
+		float v = max(-(float)QUANT_MAX, min((float)QUANT_MAX, q[d] * quantScale));
+		qq[d] = (short)floor(v + 0.5f);
+	}
+
+	// Keep the few best under the quantized metric...
+	int candCost[NUM_CANDIDATES];
+	int candEntry[NUM_CANDIDATES];
+	int numCand = 0;
+	int worst = 0;
+	const short *x = &quantized[0];
+	for(int i = 0; i < n; ++i, x += stride) {
+		int cost = quantizedCost(&qq[0], x, stride);
+		if(numCand < NUM_CANDIDATES) {
+			candCost[numCand] = cost;
+			candEntry[numCand] = i;
+			if(cost > candCost[worst]) {
+				worst = numCand;
+			}
+			++numCand;
+		} else if(cost < candCost[worst]) {
+			candCost[worst] = cost;
+			candEntry[worst] = i;
+			for(int k = 0; k < NUM_CANDIDATES; ++k) {
+				if(candCost[k] > candCost[worst]) {
+					worst = k;
+				}
+			}
+		}
+	}
+
+	// ...then pick the exact best among them
+	for(int k = 0; k < numCand; ++k) {
+		float cost = exactCost(&q[0], candEntry[k]);
+		if(cost < match.cost) {
+			match.clip = entryClip[candEntry[k]];
+			match.frame = entryFrame[candEntry[k]];
+			match.cost = cost;
+		}
+	}
+	return match;
+}
+
+MotionDatabase::Match MotionDatabase::findBestExact(const VectorXf &query) const
+{
+	assert(query.size() == FEATURE_SIZE);
+	Match match = { -1, -1, numeric_limits<float>::max() };
+	vector<float> q(FEATURE_SIZE);
+	normalize(query.data(), &q[0]);
+	for(int i = 0; i < getNumEntries(); ++i) {
+		float cost = exactCost(&q[0], i);
+		if(cost < match.cost) {
+			match.clip = entryClip[i];
+			match.frame = entryFrame[i];
+			match.cost = cost;
+		}
+	}
+	return match;
+}
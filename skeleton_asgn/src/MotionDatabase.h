@@ -0,0 +1,78 @@
+#pragma once
+#ifndef _MOTIONDATABASE_H_
+#define _MOTIONDATABASE_H_
+
+#include <string>
+#include <vector>
+
+#define EIGEN_DONT_ALIGN_STATICALLY
+#include <Eigen/Dense>
+#include <Eigen/StdVector>
+
+// Pose database for motion matching.
+//
+// Every usable frame of every clip becomes one entry with a feature vector:
+//   - both feet's positions and velocities, relative to the character
+//   - the hip velocity
+//   - where the root will be, and which way it will face, 10/20/30 frames ahead
+// Everything is expressed in the character's own frame (root on the ground,
+// facing +z), so the same step matches no matter where or which way it was
+// recorded.
+//
+// Searching is a brute-force scan over 16-bit quantized features with SSE2,
+// followed by an exact float re-rank of the few best candidates.
+class MotionDatabase
+{
+public:
+	typedef std::vector<Eigen::Matrix4f, Eigen::aligned_allocator<Eigen::Matrix4f> > Frames;
+
+	struct Match
+	{
+		int clip;
+		int frame;
+		float cost;
+	};
+
+	MotionDatabase();
+	virtual ~MotionDatabase();
+
+	// Adds a clip in the layout load_animation() returns (numBones matrices
+	// per frame, frame 0 being the bind pose). Returns the clip index.
+	int addClip(const std::string &name, const Frames &frames, int numBones);
+	// Normalizes the features and builds the search index. Call once all
+	// clips are added and before searching.
+	void build();
+
+	// Feature of a frame of a clip, in the same units a query should use
+	Eigen::VectorXf getFeature(int clip, int frame) const;
+	// Best match for a query feature
+	Match findBest(const Eigen::VectorXf &query) const;
+	// Same, but an exact float scan over everything. For checking findBest.
+	Match findBestExact(const Eigen::VectorXf &query) const;
+
+	int getNumEntries() const { return (int)entryClip.size(); }
+	int getNumClips() const { return (int)clipNames.size(); }
+	int getFeatureSize() const { return FEATURE_SIZE; }
+	const std::string &getClipName(int clip) const { return clipNames[clip]; }
+
+	static const int FEATURE_SIZE = 27;
+
+private:
+	void normalize(const float *in, float *out) const;
+	float exactCost(const float *q, int entry) const;
+
+	std::vector<std::string> clipNames;
+	std::vector<int> clipFirstEntry; // first entry of each clip
+	std::vector<int> clipFirstFrame; // frame number of that entry
+	std::vector<int> entryClip;
+	std::vector<int> entryFrame;
+	std::vector<float> raw;        // FEATURE_SIZE per entry
+	std::vector<float> normalized; // stride floats per entry, zero padded
+	std::vector<short> quantized;  // stride shorts per entry, zero padded
+	int stride;
+	float offset[FEATURE_SIZE];
+	float scale[FEATURE_SIZE];
+	float quantScale;
+};
+
+#endif
@@ -8,6 +8,7 @@
 #include "GLSL.h"
 #include "Program.h"
 #include "Grid.h"
+#include "ThreadPool.h"
 
 #define TINYOBJLOADER_IMPLEMENTATION
 #include "tiny_obj_loader.h"
@@ -170,36 +171,52 @@ void Shape::init(const std::shared_ptr<Program> prog)
 	GLSL::checkError(GET_FILE_LINE);
 }
 
-void Shape::do_cpu_skinning() const {
-   // Modify the position buffer with our cute new skinnings and stuff
-   vector<float> skinned_vertices;
-   for (int i = 0; i < posBuf.size(); i += 3) {
-      Vector4f orig_vertex;
-      orig_vertex << posBuf[i], posBuf[i+1], posBuf[i+2], 1;
-      
-      Vector4f result_vertex; // Stores the result of adding up all the results
-      // from multiplying orig_vertex by each bone
-      result_vertex << 0, 0, 0, 0;
-      
-      vector<int> curr_bones = multid_valid_bones[i/3];
-      
-      for (int ndx = 0; ndx < curr_bones.size(); ndx++) {
-         int j = curr_bones[ndx];
+void Shape::skin(int frame, vector<float> &out, ThreadPool *pool) const {
+   // Fold the inverse bind pose into each bone's transform once per frame,
+   //  instead of doing two matrix multiplies per bone per vertex.
+   Matrix4f bone_xforms[NUM_BONES];
+   for (int j = 0; j < NUM_BONES; j++) {
+      bone_xforms[j] = anim_frames[frame*NUM_BONES + j] * bind_pose[j];
+   }
+   
+   out.resize(posBuf.size());
+   auto skinVertices = [&](int begin, int end, int thread) {
+      for (int v = begin; v < end; v++) {
+         Vector4f orig_vertex(posBuf[3*v], posBuf[3*v+1], posBuf[3*v+2], 1.0f);
+         Vector4f result_vertex = Vector4f::Zero();
          
-         Vector4f weight_changed_vertex;
-         weight_changed_vertex << orig_vertex.x(), orig_vertex.y(), orig_vertex.z(), 1;
-          
-         weight_changed_vertex = bind_pose[j] * weight_changed_vertex;
-         weight_changed_vertex = anim_frames[(k+1)*NUM_BONES + j] * weight_changed_vertex;
-         weight_changed_vertex *= gpu_skinning_weights[ndx];
+         for (int ndx = 0; ndx < (int)num_bones_for_vertex[v]; ndx++) {
+            int j = (int)valid_bones[v*15 + ndx];
+            result_vertex += gpu_skinning_weights[v*15 + ndx] * (bone_xforms[j] * orig_vertex);
+         }
          
-         result_vertex += weight_changed_vertex;
+         out[3*v]   = result_vertex.x();
+         out[3*v+1] = result_vertex.y();
+         out[3*v+2] = result_vertex.z();
       }
-      
-      skinned_vertices.push_back(result_vertex.x());
-      skinned_vertices.push_back(result_vertex.y());
-      skinned_vertices.push_back(result_vertex.z());
+   };
+   
+   int num_verts = (int)posBuf.size() / 3;
+   if (pool) {
+      pool->parallelFor(num_verts, skinVertices);
    }
+   else {
+      skinVertices(0, num_verts, 0);
+   }
+}
+
+int Shape::getCurrFrame() const {
+   return k + 1;
+}
+
+int Shape::getNumFrames() const {
+   return num_frames;
+}
+
+void Shape::do_cpu_skinning() const {
+   // Modify the position buffer with our cute new skinnings and stuff
+   vector<float> skinned_vertices;
+   skin(k + 1, skinned_vertices);
    
    // Send the modified position array to the GPU
    glBindBuffer(GL_ARRAY_BUFFER, posBufID);
@@ -8,6 +8,7 @@
 #include <Eigen/Dense>
 
 class Program;
+class ThreadPool;
 
 Eigen::Matrix4f get_curr_anim();
 
@@ -19,6 +20,15 @@ public:
    void loadMesh(const std::string &meshName, const std::string &resource_dir, const std::string &anim_file, const std::string &attachment_file);
 	void init(const std::shared_ptr<Program> prog);
    void draw(const std::shared_ptr<Program> prog, bool cpu_skinning) const;
+   
+   // Writes the positions of the mesh skinned to the given animation frame
+   // into out (xyz-packed, same layout as the position buffer).
+   void skin(int frame, std::vector<float> &out, ThreadPool *pool = 0) const;
+   // The animation frame the last draw() used
+   int getCurrFrame() const;
+   int getNumFrames() const;
+   const std::vector<float> &getPosBuf() const { return posBuf; }
+   const std::vector<unsigned int> &getEleBuf() const { return eleBuf; }
 	
 private:
 	std::vector<unsigned int> eleBuf;
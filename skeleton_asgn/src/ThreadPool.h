@@ -0,0 +1,49 @@
+#pragma once
+#ifndef _THREADPOOL_H_
+#define _THREADPOOL_H_
+
+#include <vector>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+// A fixed set of worker threads that stay alive between calls, so that
+// per-frame work can be split across cores without spawning threads every
+// frame. The calling thread always takes part as thread 0.
+//
+// Jobs must not call back into the same pool.
+class ThreadPool
+{
+public:
+	// nthreads <= 0 uses one thread per hardware core.
+	ThreadPool(int nthreads = 0);
+	virtual ~ThreadPool();
+
+	int getNumThreads() const { return nthreads; }
+
+	// Splits [0, n) into one contiguous chunk per thread and calls
+	// fn(begin, end, thread) on each. The split only depends on n and the
+	// thread count, so results are reproducible run to run.
+	void parallelFor(int n, const std::function<void(int, int, int)> &fn);
+
+	// Hands out [0, n) in chunks of `grain` to whichever thread is free.
+	// Better when the cost per item is uneven.
+	void parallelForDynamic(int n, int grain, const std::function<void(int, int, int)> &fn);
+
+private:
+	void dispatch(const std::function<void(int)> &job);
+	void workerLoop(int thread);
+
+	int nthreads;
+	std::vector<std::thread> workers;
+	std::mutex mtx;
+	std::condition_variable startCond;
+	std::condition_variable doneCond;
+	std::function<void(int)> job;
+	unsigned generation;
+	int pending;
+	bool quit;
+};
+
+#endif
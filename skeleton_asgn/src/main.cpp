@@ -1,5 +1,6 @@
 #include <iostream>
 #include <vector>
+#include <chrono>
 
 #define GLEW_STATIC
 #include <GL/glew.h>
@@ -10,8 +11,15 @@
 #include "Program.h"
 #include "MatrixStack.h"
 #include "Shape.h"
+#include "BVH.h"
+#include "Grid.h"
+#include "MotionDatabase.h"
+#include "ThreadPool.h"
 
 using namespace std;
+using namespace Eigen;
+
+#define NUM_BONES 18
 
 bool keyToggles[256] = {false}; // only for English keyboards!
 
@@ -24,6 +32,12 @@ string ANIMATION_FILE = ""; //uh huh
 shared_ptr<Program> prog;
 shared_ptr<Camera> camera;
 shared_ptr<Shape> wobbler;
+shared_ptr<ThreadPool> pool;
+
+// For picking: the skinned mesh positions of the current frame and a BVH over them
+BVH bvh;
+vector<float> skinned_pos;
+Matrix4f last_P, last_MV;
 
 static void error_callback(int error, const char *description)
 {
@@ -50,6 +64,27 @@ static void cursor_position_callback(GLFWwindow* window, double xmouse, double y
 	}
 }
 
+/* Shoot a ray through the clicked pixel and report what part of the mesh it hit */
+static void pick(double xmouse, double ymouse, int width, int height)
+{
+   float x = 2.0f * (float)xmouse / width - 1.0f;
+   float y = 1.0f - 2.0f * (float)ymouse / height;
+   
+   Matrix4f inv = (last_P * last_MV).inverse();
+   Vector4f near_pt = inv * Vector4f(x, y, -1.0f, 1.0f);
+   Vector4f far_pt  = inv * Vector4f(x, y,  1.0f, 1.0f);
+   Vector3f orig = near_pt.head<3>() / near_pt.w();
+   Vector3f dir  = far_pt.head<3>() / far_pt.w() - orig;
+   
+   BVH::Hit hit;
+   if (bvh.rayCast(skinned_pos, orig, dir, 1.0f, hit)) {
+      cout << "Picked triangle " << hit.tri << " at " << (orig + hit.t * dir).transpose() << endl;
+   }
+   else {
+      cout << "Picked nothing" << endl;
+   }
+}
+
 void mouse_button_callback(GLFWwindow* window, int button, int action, int mods)
 {
 	// Get the current mouse position.
@@ -63,6 +98,10 @@ void mouse_button_callback(GLFWwindow* window, int button, int action, int mods)
 		bool ctrl  = mods & GLFW_MOD_CONTROL;
 		bool alt   = mods & GLFW_MOD_ALT;
 		camera->mouseClicked(xmouse, ymouse, shift, ctrl, alt);
+      
+      if (keyToggles[(unsigned)'p'] && !skinned_pos.empty()) {
+         pick(xmouse, ymouse, width, height);
+      }
 	}
 }
 
@@ -109,6 +148,9 @@ static void init()
    wobbler = make_shared<Shape>();
 	wobbler->loadMesh(OBJ_FILE, RESOURCE_DIR, ANIMATION_FILE, ATTACHMENT_FILE);
 	wobbler->init(prog);
+   
+   pool = make_shared<ThreadPool>();
+   bvh.build(wobbler->getPosBuf(), wobbler->getEleBuf());
 	
 	camera = make_shared<Camera>();
 	
@@ -212,6 +254,14 @@ void render()
    glUniform1i(prog->getUniform("gpu_rendering"), cpu_skinning ? 0 : 1);
    
 	wobbler->draw(prog, cpu_skinning);
+   
+   // Keep the BVH in sync with the animation while picking is on
+   if (keyToggles[(unsigned)'p']) {
+      wobbler->skin(wobbler->getCurrFrame(), skinned_pos, pool.get());
+      bvh.refit(skinned_pos, pool.get());
+      last_P = P->topMatrix();
+      last_MV = MV->topMatrix();
+   }
 	
 	// Unbind the program
 	prog->unbind();
@@ -227,10 +277,192 @@ void render()
 	GLSL::checkError(GET_FILE_LINE);
 }
 
+static double millisSince(chrono::steady_clock::time_point start)
+{
+   return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+}
+
+/* Headless benchmark: BVH refit time per frame, rays/sec and sphere queries/sec */
+static void benchBVH()
+{
+   auto shape = make_shared<Shape>();
+   shape->loadMesh(OBJ_FILE, RESOURCE_DIR, ANIMATION_FILE, ATTACHMENT_FILE);
+   int num_frames = shape->getNumFrames();
+   if (num_frames < 2) {
+      return;
+   }
+   
+   ThreadPool bench_pool;
+   BVH tree;
+   auto start = chrono::steady_clock::now();
+   tree.build(shape->getPosBuf(), shape->getEleBuf());
+   double build_ms = millisSince(start);
+   cout << tree.getNumTris() << " triangles, " << tree.getNumNodes() << " nodes, "
+        << bench_pool.getNumThreads() << " threads" << endl;
+   cout << "Build:             " << build_ms << " ms" << endl;
+   
+   // Refit once per animation frame, first serially, then on the pool
+   vector<float> pos;
+   for (int use_pool = 0; use_pool < 2; use_pool++) {
+      double total_ms = 0.0, max_ms = 0.0;
+      for (int f = 1; f < num_frames; f++) {
+         shape->skin(f, pos, &bench_pool);
+         start = chrono::steady_clock::now();
+         tree.refit(pos, use_pool ? &bench_pool : 0);
+         double ms = millisSince(start);
+         total_ms += ms;
+         max_ms = max(max_ms, ms);
+      }
+      cout << (use_pool ? "Refit (parallel): " : "Refit (serial):   ")
+           << total_ms / (num_frames - 1) << " ms avg, " << max_ms << " ms max" << endl;
+   }
+   
+   // Random rays aimed from outside the mesh at points inside its bounding box
+   Vector3f bmin = Vector3f::Constant(1e30f), bmax = -bmin;
+   for (size_t i = 0; i < pos.size(); i += 3) {
+      Vector3f p(pos[i], pos[i+1], pos[i+2]);
+      bmin = bmin.cwiseMin(p);
+      bmax = bmax.cwiseMax(p);
+   }
+   Vector3f center = 0.5f * (bmin + bmax);
+   float size = (bmax - bmin).norm();
+   
+   srand(0);
+   const int num_rays = 1000000;
+   vector<Vector3f> origs(num_rays), dirs(num_rays);
+   for (int i = 0; i < num_rays; i++) {
+      Vector3f out_dir = Vector3f::Random().normalized();
+      Vector3f target = center + 0.5f * (bmax - bmin).cwiseProduct(Vector3f::Random());
+      origs[i] = center + size * out_dir;
+      dirs[i] = (target - origs[i]).normalized();
+   }
+   
+   vector<int> hits(bench_pool.getNumThreads(), 0);
+   start = chrono::steady_clock::now();
+   for (int i = 0; i < num_rays; i++) {
+      BVH::Hit hit;
+      hits[0] += tree.rayCast(pos, origs[i], dirs[i], 2.0f * size, hit);
+   }
+   double ray_ms = millisSince(start);
+   cout << "Rays (1 thread):   " << num_rays / ray_ms * 1e-3 << " Mrays/s, " << hits[0] << " hits" << endl;
+   
+   fill(hits.begin(), hits.end(), 0);
+   start = chrono::steady_clock::now();
+   bench_pool.parallelFor(num_rays, [&](int begin, int end, int thread) {
+      for (int i = begin; i < end; i++) {
+         BVH::Hit hit;
+         hits[thread] += tree.rayCast(pos, origs[i], dirs[i], 2.0f * size, hit);
+      }
+   });
+   ray_ms = millisSince(start);
+   cout << "Rays (" << bench_pool.getNumThreads() << " threads):  " << num_rays / ray_ms * 1e-3 << " Mrays/s" << endl;
+   
+   // The refit tree should give exactly the same answers as a fresh build
+   BVH rebuilt;
+   rebuilt.build(pos, shape->getEleBuf());
+   int mismatches = 0;
+   for (int i = 0; i < 10000; i++) {
+      BVH::Hit a, b;
+      bool hit_a = tree.rayCast(pos, origs[i], dirs[i], 2.0f * size, a);
+      bool hit_b = rebuilt.rayCast(pos, origs[i], dirs[i], 2.0f * size, b);
+      if (hit_a != hit_b || (hit_a && a.t != b.t)) {
+         mismatches++;
+      }
+   }
+   cout << "Refit vs rebuild:  " << mismatches << " mismatches in 10000 rays" << endl;
+   
+   // Sphere overlap, e.g. a foot-sized sphere against the mesh
+   const int num_spheres = 100000;
+   vector<int> tris;
+   long long total_found = 0;
+   start = chrono::steady_clock::now();
+   for (int i = 0; i < num_spheres; i++) {
+      tris.clear();
+      Vector3f c = center + 0.5f * (bmax - bmin).cwiseProduct(Vector3f::Random());
+      total_found += tree.sphereOverlap(pos, c, 0.05f * size, tris);
+   }
+   double sphere_ms = millisSince(start);
+   cout << "Spheres (1 thread): " << num_spheres / sphere_ms * 1e-3 << " Mqueries/s, "
+        << (double)total_found / num_spheres << " tris per query" << endl;
+}
+
+/* Headless benchmark: motion matching queries/sec as the pose database grows */
+static void benchMatching(const vector<string> &clip_files)
+{
+   vector<MotionDatabase::Frames> clips;
+   for (const string &file : clip_files) {
+      clips.push_back(load_animation(file));
+   }
+   
+   // Queries come from clips with some frames left after the ones the
+   // database skips at either end
+   const int min_frames = 40;
+   vector<int> long_clips;
+   for (size_t ndx = 0; ndx < clips.size(); ndx++) {
+      if (clips[ndx].size() / NUM_BONES > min_frames) {
+         long_clips.push_back((int)ndx);
+      }
+   }
+   if (long_clips.empty()) {
+      cout << "No clip is longer than " << min_frames << " frames" << endl;
+      return;
+   }
+   
+   srand(0);
+   const int max_copies = 32;
+   for (int copies = 1; copies <= max_copies; copies *= 2) {
+      // Bigger databases are made by adding the same clips over and over
+      MotionDatabase db;
+      for (int c = 0; c < copies; c++) {
+         for (size_t ndx = 0; ndx < clips.size(); ndx++) {
+            db.addClip(clip_files[ndx], clips[ndx], NUM_BONES);
+         }
+      }
+      auto start = chrono::steady_clock::now();
+      db.build();
+      double build_ms = millisSince(start);
+      
+      // Queries are real poses with some noise on them
+      const int num_queries = 500;
+      vector<VectorXf> queries;
+      for (int i = 0; i < num_queries; i++) {
+         int clip = long_clips[rand() % long_clips.size()];
+         int frame = 2 + rand() % (clips[clip].size() / NUM_BONES - min_frames);
+         VectorXf q = db.getFeature(clip, frame);
+         queries.push_back(q + 0.01f * q.cwiseAbs().cwiseProduct(VectorXf::Random(q.size())));
+      }
+      
+      vector<MotionDatabase::Match> fast(num_queries), exact(num_queries);
+      start = chrono::steady_clock::now();
+      for (int i = 0; i < num_queries; i++) {
+         fast[i] = db.findBest(queries[i]);
+      }
+      double fast_ms = millisSince(start) / num_queries;
+      
+      start = chrono::steady_clock::now();
+      for (int i = 0; i < num_queries; i++) {
+         exact[i] = db.findBestExact(queries[i]);
+      }
+      double exact_ms = millisSince(start) / num_queries;
+      
+      int same = 0;
+      for (int i = 0; i < num_queries; i++) {
+         same += fast[i].frame == exact[i].frame && fast[i].cost == exact[i].cost;
+      }
+      
+      cout << db.getNumEntries() << " poses (build " << build_ms << " ms): "
+           << fast_ms * 1e3 << " us/query (" << 1e3 / fast_ms << " queries/s) quantized, "
+           << exact_ms * 1e3 << " us/query exact, "
+           << same << "/" << num_queries << " same answer" << endl;
+   }
+}
+
 int main(int argc, char **argv)
 {
 	if(argc < 5) {
 		cout << "Please specify all 4 arguments :3" << endl;
+		cout << "Usage: Asgn2 <RESOURCE_DIR> <OBJ> <ATTACHMENT> <ANIMATION> [bvh]" << endl;
+		cout << "   or: Asgn2 <RESOURCE_DIR> <OBJ> <ATTACHMENT> <ANIMATION> match [MORE ANIMATIONS...]" << endl;
 		return 0;
 	}
    
@@ -238,6 +470,20 @@ int main(int argc, char **argv)
    OBJ_FILE = argv[2];
    ATTACHMENT_FILE = argv[3];
    ANIMATION_FILE = argv[4];
+   
+   // Run the headless benchmark instead of opening a window
+   if (argc > 5 && string(argv[5]) == "bvh") {
+      benchBVH();
+      return 0;
+   }
+   if (argc > 5 && string(argv[5]) == "match") {
+      vector<string> clip_files(1, ANIMATION_FILE);
+      for (int ndx = 6; ndx < argc; ndx++) {
+         clip_files.push_back(argv[ndx]);
+      }
+      benchMatching(clip_files);
+      return 0;
+   }
 	
 	// Set error callback.
 	glfwSetErrorCallback(error_callback);